@@ -0,0 +1,106 @@
+#!/bin/bash
+# Checks that avr_io_pins.h compiles to what it should:
+# - invalid pins, fields and values do not compile, with host g++,
+# - fast_paths.cpp, built with avr-g++ -Os, has per function the
+#   instructions its "insns:" comment says, ret included, as disassembled
+#   by avr-objdump.
+# Usage: check_insns.sh [-u]
+#	-u	write what avr-g++ emitted into the "insns:" comments instead,
+#		then review the diff of fast_paths.cpp
+# Exit: 0 passed, 1 failed, 2 instructions not checked, no toolchain.
+# Toolchain: sudo apt -y install gcc-avr avr-libc
+
+S=`realpath "${BASH_SOURCE[0]}"`
+THIS_D=`dirname $S`
+FW_D=`dirname $(dirname $THIS_D)`
+SRC="$THIS_D/fast_paths.cpp"
+MCU=${MCU:-atmega328p}
+AVR_CXX=${AVR_CXX:-avr-g++}
+AVR_OBJDUMP=${AVR_OBJDUMP:-avr-objdump}
+B=`mktemp -d`
+trap "rm -rf $B" EXIT
+
+UPDATE=0
+if test "$1" == "-u"
+then
+	UPDATE=1
+fi
+
+FAILED=0
+
+for T in TEST_BAD_PIN TEST_BAD_FIELD TEST_BAD_VALUE
+do
+	if g++ -std=c++11 -fsyntax-only -I"$FW_D" -D$T "$THIS_D/test_avr_io_pins.cpp" 2> /dev/null
+	then
+		echo "FAIL: $T compiled"
+		FAILED=1
+	else
+		echo "OK: $T rejected"
+	fi
+done
+
+if ! which $AVR_CXX $AVR_OBJDUMP > /dev/null
+then
+	echo "NOT CHECKED: no $AVR_CXX or $AVR_OBJDUMP, instructions not counted"
+	test $FAILED == 0 && exit 2
+	exit $FAILED
+fi
+
+# Same flags as avrwaf.
+$AVR_CXX -mmcu=$MCU -Os -std=c++11 -Wall -I"$FW_D" \
+	-c "$SRC" -o $B/fast_paths.o || exit 1
+$AVR_OBJDUMP -d $B/fast_paths.o > $B/fast_paths.lst
+
+# Mnemonics of a function, until the blank line after it. Lines are
+# "addr:<tab>bytes<tab>mnemonic<tab>operands", first field which is only
+# a word is the mnemonic.
+mnemonics() {
+	sed -n "/<$1>:/,/^$/p" $B/fast_paths.lst \
+		| grep -E '^ *[0-9a-f]+:' \
+		| awk -F'\t' '{
+			for(i = 2; i <= NF; i++){
+				if($i ~ /^[a-z][a-z0-9.]*$/){
+					print $i
+					break
+				}
+			}
+		}' \
+		| tr '\n' ' ' \
+		| sed 's/ $//'
+}
+
+# Functions under an "insns:" comment.
+FUNCS=`grep -A1 --no-group-separator '^// insns:' "$SRC" \
+	| sed -n 's|^void \([a-z_0-9]*\)().*|\1|p'`
+
+for FUNC in $FUNCS
+do
+	EXPECTED=`grep -B1 "^void $FUNC()" "$SRC" | sed -n 's|^// insns: ||p'`
+	GOT=`mnemonics $FUNC`
+	if test "$GOT" == ""
+	then
+		echo "FAIL: $FUNC not found in listing"
+		FAILED=1
+	elif test $UPDATE == 1
+	then
+		awk -v f="$FUNC" -v g="$GOT" '
+			NR > 1 {
+				if(index($0, "void " f "()") == 1 && prev ~ /^\/\/ insns:/){
+					prev = "// insns: " g
+				}
+				print prev
+			}
+			{ prev = $0 }
+			END { print prev }
+		' "$SRC" > $B/src && cp $B/src "$SRC"
+		echo "UPDATED: $FUNC: $GOT"
+	elif test "$GOT" == "$EXPECTED"
+	then
+		echo "OK: $FUNC: $GOT"
+	else
+		echo "FAIL: $FUNC: $GOT, expected $EXPECTED"
+		FAILED=1
+	fi
+done
+
+exit $FAILED
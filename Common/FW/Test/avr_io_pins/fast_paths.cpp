@@ -0,0 +1,50 @@
+/*
+ * Fast paths of avr_io_pins.h, built for ATmega328P by check_insns.sh,
+ * which compares the instructions of each function, ret included, with
+ * the "insns:" comment above it. check_insns.sh -u writes them from what
+ * avr-g++ emitted.
+ */
+
+#include "avr_io_pins.h"
+
+typedef io_pin<io_port_b, 5> led;
+typedef io_pin<io_port_d, 2> button;
+
+AVR_IO_PINS__REG(io_reg_eimsk, EIMSK);
+AVR_IO_PINS__REG(io_reg_tccr0a, TCCR0A);
+AVR_IO_PINS__REG(io_reg_tccr0b, TCCR0B);
+typedef io_field<io_reg_eimsk, 0> int0;
+typedef io_field<io_reg_tccr0a, 0, 2> wgm01;
+typedef io_field<io_reg_tccr0a, 6, 2> com0a;
+typedef io_field<io_reg_tccr0b, 0, 3> cs0;
+
+extern "C" {
+
+// insns: sbi ret
+void pin_out() { led::out(); }
+
+// insns: sbi ret
+void pin_set() { led::set(); }
+
+// insns: cbi ret
+void pin_clear() { led::clear(); }
+
+// insns: ldi out ret
+void pin_toggle() { led::toggle(); }
+
+// insns: sbis rjmp ret
+void pin_wait() { while(!button::read()){} }
+
+// insns: sbi ret
+void field_set_bit() { int0::write<1>(); }
+
+// insns: cbi ret
+void field_clear_bit() { int0::write<0>(); }
+
+// insns: ldi out ret
+void reg_write() { io_reg_tccr0a::ref() = com0a::val<2>() | wgm01::val<3>(); }
+
+// insns: in andi ori out ret
+void field_write() { cs0::write<3>(); }
+
+}
@@ -0,0 +1,138 @@
+/*
+ * Host test of avr_io_pins.h, registers are a mock register file.
+ * With -DTEST_BAD_PIN, -DTEST_BAD_FIELD or -DTEST_BAD_VALUE it must not
+ * compile, see check_insns.sh.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "avr_io_pins.h"
+
+static volatile u8 regs[8];
+
+template<int I>
+struct mock_reg {
+	static inline volatile u8& ref() { return regs[I]; }
+};
+
+// Old AVR, PINx read only.
+typedef io_port<mock_reg<0>, mock_reg<1>, mock_reg<2>, 0x3f, false> port_x;
+// New AVR, write 1 to PINx toggles, done by hand below.
+typedef io_port<mock_reg<3>, mock_reg<4>, mock_reg<5>, 0x7f, true> port_y;
+
+typedef io_pin<port_x, 0> x0;
+typedef io_pin<port_x, 5> x5;
+typedef io_pin<port_y, 6> y6;
+
+typedef io_field<mock_reg<6>, 0, 3> cs;
+typedef io_field<mock_reg<6>, 3> wgm2;
+typedef io_field<mock_reg<6>, 6, 2> foc;
+
+#ifdef TEST_BAD_PIN
+typedef io_pin<port_x, 6> x6; // Not on port_x.
+static void bad() { x6::set(); }
+#endif
+#ifdef TEST_BAD_FIELD
+typedef io_field<mock_reg<7>, 6, 3> over; // Past bit 7.
+static void bad() { over::write(1); }
+#endif
+#ifdef TEST_BAD_VALUE
+static void bad() { cs::write<8>(); }
+#endif
+
+static int failed = 0;
+
+#define CHECK(cond) \
+	do{ \
+		if(!(cond)){ \
+			fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failed++; \
+		} \
+	}while(0)
+
+static void reset() {
+	for(u8 i = 0; i < sizeof(regs); i++){
+		regs[i] = 0;
+	}
+}
+
+static void test_pins() {
+	reset();
+	x5::out();
+	CHECK(regs[1] == 0x20);
+	x0::out();
+	x5::in();
+	CHECK(regs[1] == 0x01);
+
+	x5::set();
+	x0::set();
+	CHECK(regs[2] == 0x21);
+	x5::clear();
+	CHECK(regs[2] == 0x01);
+	x5::write(true);
+	CHECK(regs[2] == 0x21);
+	x0::write(false);
+	CHECK(regs[2] == 0x20);
+
+	// PINx read only, so PORTx is flipped.
+	x5::toggle();
+	CHECK(regs[2] == 0x00 && regs[0] == 0x00);
+	x5::toggle();
+	CHECK(regs[2] == 0x20);
+
+	// Only the bit of the pin is written to PINx, others stay.
+	regs[5] = 0x0f;
+	y6::toggle();
+	CHECK(regs[3] == 0x40 && regs[5] == 0x0f);
+
+	regs[0] = 0x21;
+	CHECK(x0::read() && x5::read());
+	regs[0] = 0x1e;
+	CHECK(!x0::read() && !x5::read());
+
+	regs[1] = 0xff;
+	regs[2] = 0x00;
+	x5::pull_up();
+	CHECK(regs[1] == 0xdf && regs[2] == 0x20);
+}
+
+static void test_fields() {
+	static_assert(cs::mask == 0x07 && cs::max == 7, "cs");
+	static_assert(wgm2::mask == 0x08 && wgm2::max == 1, "wgm2");
+	static_assert(foc::mask == 0xc0 && foc::max == 3, "foc");
+	static_assert((foc::val<2>() | wgm2::val<1>() | cs::val<5>()) == 0x8d, "val");
+	static_assert(cs::val(0xff) == 0x07, "val masks");
+
+	reset();
+	regs[6] = 0xff;
+	cs::write(2);
+	CHECK(regs[6] == 0xfa);
+	CHECK(cs::read() == 2);
+	cs::write<0>();
+	CHECK(regs[6] == 0xf8);
+	cs::write<7>();
+	CHECK(regs[6] == 0xff);
+	wgm2::write<0>();
+	CHECK(regs[6] == 0xf7 && wgm2::read() == 0);
+	wgm2::write<1>();
+	CHECK(regs[6] == 0xff && wgm2::read() == 1);
+	foc::write<1>();
+	CHECK(regs[6] == 0x7f && foc::read() == 1);
+
+	// Whole register, other fields cleared.
+	regs[6] = foc::val<3>() | cs::val<1>();
+	CHECK(regs[6] == 0xc1);
+	CHECK(foc::read() == 3 && wgm2::read() == 0 && cs::read() == 1);
+}
+
+int main() {
+	test_pins();
+	test_fields();
+	if(failed){
+		fprintf(stderr, "%d checks failed!\n", failed);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed.\n");
+	return EXIT_SUCCESS;
+}
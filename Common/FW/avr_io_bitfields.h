@@ -13,30 +13,25 @@
 #error "Need C++!"
 #endif
 
-namespace _priv_bf_to_u8 {
-	template<typename T>
-	union bf_to_u8_un {
-		T bf;
-		u8 a;
-	};
-};
+// First byte, through memcpy(), which folds away, as reading the other
+// member of an union is not defined in C++. For pins and fields see
+// avr_io_pins.h.
 template<typename T>
 u8 bf_to_u8(const T&& bf) {
-	return _priv_bf_to_u8::bf_to_u8_un<T>{ .bf = bf }.a;
+	u8 a;
+	__builtin_memcpy(&a, &bf, 1);
+	return a;
 }
 
 template<typename T>
 static inline void set_bf(volatile T& bf_ptr, const T&& bf_init) {
-#if 0
-	*(T*)&bf_ptr = bf_init;
-#else
-	auto op = (u8*)&bf_ptr;
-	auto ope = op + sizeof(T);
-	auto ip = (u8*)&bf_init;
-	for(; op != ope; op++, ip++){
-		*op = *ip;
+	// Whole bytes, so a constant bf_init is one ldi and out/sts per byte.
+	u8 ip[sizeof(T)];
+	__builtin_memcpy(ip, &bf_init, sizeof(T));
+	auto op = (volatile u8*)&bf_ptr;
+	for(u8 i = 0; i < sizeof(T); i++){
+		op[i] = ip[i];
 	}
-#endif
 }
 
 
@@ -0,0 +1,172 @@
+
+#ifndef AVR_IO_PINS_H
+#define AVR_IO_PINS_H
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef __AVR__
+#include <avr/io.h>
+#endif
+#include "type_shorts.h"
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __cplusplus
+#error "Need C++!"
+#endif
+
+// Pins and register fields as types, everything known at compile time.
+// Registers are reached at constant addresses with constant masks, so
+// avr-g++ -Os emits sbi/cbi/sbic/sbis for single bits of the low I/O
+// space and a single out/sts for whole registers. Pins which the MCU does
+// not have and fields which do not fit the register do not compile.
+//
+// A register is any type with static volatile u8& ref(). On AVR those
+// come from AVR_IO_PINS__REG(), in tests from an array, see
+// Common/FW/Test/avr_io_pins.
+//
+//	typedef io_pin<io_port_b, 5> led;
+//	led::out();
+//	led::set();
+//
+//	AVR_IO_PINS__REG(io_reg_adcsra, ADCSRA);
+//	typedef io_field<io_reg_adcsra, 0, 3> adps;
+//	typedef io_field<io_reg_adcsra, 7> aden;
+//	io_reg_adcsra::ref() = aden::val<1>() | adps::val<7>(); // Single out.
+//	adps::write<6>(); // Read-modify-write of adps only.
+
+///////////////////////////////////////////////////////////////////////////////
+
+#define AVR_IO_PINS__REG(name, sfr) \
+	struct name { \
+		static inline volatile u8& ref() { return sfr; } \
+	}
+
+/**
+ * @param Pins mask of pins the MCU has on the port.
+ * @param Toggle if writing 1 to PINx toggles PORTx, not on old MCUs.
+ */
+template<typename Pin, typename Ddr, typename Port, u8 Pins, bool Toggle = true>
+struct io_port {
+	typedef Pin pin;
+	typedef Ddr ddr;
+	typedef Port port;
+	static constexpr u8 pins = Pins;
+	static constexpr bool pin_toggles = Toggle;
+};
+
+template<typename Port, u8 Bit>
+struct io_pin {
+	static_assert(Bit < 8, "Pin out of port!");
+	static_assert(Port::pins >> Bit & 1, "No such pin on this MCU!");
+
+	static constexpr u8 mask = 1 << Bit;
+
+	static inline void out() { Port::ddr::ref() |= mask; }
+	static inline void in() { Port::ddr::ref() &= u8(~mask); }
+	static inline void set() { Port::port::ref() |= mask; }
+	static inline void clear() { Port::port::ref() &= u8(~mask); }
+	static inline void write(bool v) {
+		if(v){
+			set();
+		}else{
+			clear();
+		}
+	}
+	static inline void toggle() {
+		if(Port::pin_toggles){
+			Port::pin::ref() = mask;
+		}else{
+			Port::port::ref() ^= mask;
+		}
+	}
+	static inline bool read() { return Port::pin::ref() & mask; }
+	static inline void pull_up() {
+		in();
+		set();
+	}
+};
+
+/**
+ * @a Width bits from bit @a Pos of register @a Reg.
+ */
+template<typename Reg, u8 Pos, u8 Width = 1>
+struct io_field {
+	static_assert(Width >= 1 && Pos + Width <= 8, "Field out of register!");
+
+	static constexpr u8 max = (1u << Width) - 1;
+	static constexpr u8 mask = max << Pos;
+
+	/**
+	 * @return @a v in place, to or with other fields for a whole register.
+	 */
+	static constexpr u8 val(u8 v) { return (v << Pos) & mask; }
+	template<u8 V>
+	static constexpr u8 val() {
+		static_assert(V <= max, "Value does not fit the field!");
+		return V << Pos;
+	}
+
+	static inline u8 read() { return (Reg::ref() & mask) >> Pos; }
+	static inline void write(u8 v) {
+		Reg::ref() = (Reg::ref() & u8(~mask)) | val(v);
+	}
+	template<u8 V>
+	static inline void write() {
+		// Single bit fields end up as sbi/cbi.
+		if(val<V>() == 0){
+			Reg::ref() &= u8(~mask);
+		}else if(val<V>() == mask){
+			Reg::ref() |= mask;
+		}else{
+			Reg::ref() = (Reg::ref() & u8(~mask)) | val<V>();
+		}
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef __AVR__
+
+#define AVR_IO_PINS__PORT(x, X, pins, toggle) \
+	AVR_IO_PINS__REG(io_reg_pin##x, PIN##X); \
+	AVR_IO_PINS__REG(io_reg_ddr##x, DDR##X); \
+	AVR_IO_PINS__REG(io_reg_port##x, PORT##X); \
+	typedef io_port< \
+		io_reg_pin##x, \
+		io_reg_ddr##x, \
+		io_reg_port##x, \
+		pins, \
+		toggle \
+	> io_port_##x
+
+#if __AVR_ATtiny13A__
+
+AVR_IO_PINS__PORT(b, B, 0x3f, true);
+
+#elif __AVR_ATmega16__ || __AVR_ATmega32__
+
+// PINx is read only on these.
+AVR_IO_PINS__PORT(a, A, 0xff, false);
+AVR_IO_PINS__PORT(b, B, 0xff, false);
+AVR_IO_PINS__PORT(c, C, 0xff, false);
+AVR_IO_PINS__PORT(d, D, 0xff, false);
+
+// Arduino UNO
+#elif __AVR_ATmega328P__
+
+AVR_IO_PINS__PORT(b, B, 0xff, true);
+AVR_IO_PINS__PORT(c, C, 0x7f, true); // PC6 is RESET.
+AVR_IO_PINS__PORT(d, D, 0xff, true);
+
+#else
+
+#error "avr_io_pins.h: pin map missing for this MCU"
+
+#endif
+
+#endif // __AVR__
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // AVR_IO_PINS_H
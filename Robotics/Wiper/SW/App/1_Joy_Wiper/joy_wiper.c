@@ -1,4 +1,6 @@
 
+#define _GNU_SOURCE // rt_profile.h
+
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -8,9 +10,17 @@
 #include <semaphore.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include "include/gpio_ctrl.h"
 #include "gpio.h"
+#include "../../Common/include/rt_profile.h"
+#include "../../Common/include/periodic.h"
+#include "../../Common/include/rt_log.h"
+#include "../../Common/include/joy_input.h"
 
 int gpio_write(int fd, uint8_t pin, uint8_t value) {
 	uint8_t pkg[3];
@@ -20,7 +30,7 @@ int gpio_write(int fd, uint8_t pin, uint8_t value) {
 	
 
 	if (write(fd, &pkg, 3) != 3) {
-		perror("Failed to write to GPIO");
+		RT_LOG__ERROR("Failed to write pin %d to GPIO, errno %d\n", pin, errno);
 		return -1;
 	}
 	return 0;
@@ -29,71 +39,193 @@ int gpio_write(int fd, uint8_t pin, uint8_t value) {
 #define BUTTON_CW 0         // Button index for clockwise (increase angle)
 #define BUTTON_CCW 1        // Button index for counterclockwise (decrease angle)
 
-struct js_event js_event_data;
+// Preallocated, so nothing is allocated once the loop runs.
+#define MAX_BUTTONS 64
+
+#define DEFAULT_RATE_HZ 100
+#define JS_DEV_FN "/dev/input/js0"
 
-volatile uint8_t* volatile buttons;
+volatile uint8_t buttons[MAX_BUTTONS];
 pthread_mutex_t button_printf_mtx = PTHREAD_MUTEX_INITIALIZER;
 sem_t buttons_intitialized;
+// Set by js_reader() before it posts buttons_intitialized, 0 if it failed.
+static int reader_ready = 0;
+// Written by main to stop js_reader() in its epoll_wait().
+static int stop_fd = -1;
+
+static volatile sig_atomic_t stats_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig) {
+	if (sig == SIGUSR1) {
+		stats_requested = 1;
+	} else {
+		stop_requested = 1;
+	}
+}
 
 void* js_reader(void* arg) {
-	int js_fd;
-	int num_of_axes = 0;
-	int num_of_buttons = 0;
-
-	// Open the joystick device file in read-only mode
-	js_fd = open("/dev/input/js0", O_RDONLY);
-	if (js_fd == -1) {
+	const char* js_path = arg;
+	joy_input_t* in = NULL;
+	int ep_fd = -1;
+	static struct js_event evs[JOY_INPUT__MAX_EVENTS];
+
+	// Big with evdev maps, keep it off the stack.
+	in = malloc(sizeof(*in));
+	if (in == NULL) {
+		perror("Memory allocation failed");
+		goto exit;
+	}
+	// Open the joystick device file, non-blocking, drained in batches
+	if (joy_input__open(in, js_path) != 0) {
 		perror("Error opening joystick device");
-		return NULL;
+		free(in);
+		in = NULL;
+		goto exit;
 	}
 
-	ioctl(js_fd, JSIOCGAXES, &num_of_axes);
-	ioctl(js_fd, JSIOCGBUTTONS, &num_of_buttons);
+	printf("Joystick initialized with %d buttons%s\n", in->num_of_buttons, in->evdev ? " (evdev)" : "");
 
-	//TODO Allocated buttons array
-	buttons = (volatile uint8_t*)malloc(num_of_buttons * sizeof(uint8_t));
-    if (buttons == NULL) {
-        perror("Memory allocation failed");
-        return NULL;
-    }
-	// Initialize buttons to 0
-    for (int i = 0; i < num_of_buttons; i++) {
-        buttons[i] = 0;
-    }
-	printf("Joystick initialized with %d buttons\n", num_of_buttons);
+	ep_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = in->fd };
+	if (ep_fd < 0 || epoll_ctl(ep_fd, EPOLL_CTL_ADD, in->fd, &ev) != 0) {
+		perror("Failed to set up epoll");
+		goto exit;
+	}
+	ev.data.fd = stop_fd;
+	if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, stop_fd, &ev) != 0) {
+		perror("Failed to add stop to epoll");
+		goto exit;
+	}
 
+	rt_log__thread_init();
+	reader_ready = 1;
 	sem_post(&buttons_intitialized);
 
 	while (1) {
-		if (read(js_fd, &js_event_data, sizeof(struct js_event)) != sizeof(struct js_event)) {
+		struct epoll_event ready[2];
+		int nr = epoll_wait(ep_fd, ready, 2, -1);
+		if (nr < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Error polling joystick device");
+			break;
+		}
+		int stop = 0;
+		for (int i = 0; i < nr; i++) {
+			stop |= ready[i].data.fd == stop_fd;
+		}
+		if (stop) {
+			break;
+		}
+		// Whatever is queued, one read() and one lock per batch.
+		int n;
+		while ((n = joy_input__read(in, evs)) > 0) {
+			pthread_mutex_lock(&button_printf_mtx);
+			for (int i = 0; i < n; i++) {
+				if ((evs[i].type & JS_EVENT_BUTTON) && evs[i].number < MAX_BUTTONS) {
+					buttons[evs[i].number] = evs[i].value;
+				}
+			}
+			pthread_mutex_unlock(&button_printf_mtx);
+
+			for (int i = 0; i < n; i++) {
+				if (evs[i].type & JS_EVENT_BUTTON) {
+					RT_LOG__INFO("Button %d %s (value: %d)\n",
+						evs[i].number,
+						(evs[i].value == 0) ? "released" : "pressed",
+						evs[i].value
+					);
+				} else if (evs[i].type & JS_EVENT_AXIS) {
+					RT_LOG__DEBUG("Axis %d moved (value: %d)\n",
+						evs[i].number,
+						evs[i].value
+					);
+				}
+			}
+		}
+		if (n < 0) {
 			perror("Error reading joystick event");
 			break;
 		}
-
-		if (js_event_data.type & JS_EVENT_BUTTON) {
-            pthread_mutex_lock(&button_printf_mtx);
-			printf("Button %d %s (value: %d)\n",
-				js_event_data.number,
-				(js_event_data.value == 0) ? "released" : "pressed",
-				js_event_data.value
-			);
-
-        	buttons[js_event_data.number] = js_event_data.value;
-
-            pthread_mutex_unlock(&button_printf_mtx);
-        } else if (js_event_data.type & JS_EVENT_AXIS) {
-		 	printf("Axis %d moved (value: %d)\n",
-		 		js_event_data.number,
-		 		js_event_data.value
-			);
-	    }
 	}
 
-	close(js_fd);
+exit:
+	if (ep_fd >= 0) {
+		close(ep_fd);
+	}
+	if (in) {
+		joy_input__close(in);
+		free(in);
+	}
+	if (!reader_ready) {
+		// main waits for it, and gives up.
+		sem_post(&buttons_intitialized);
+	}
 	return NULL;
 }
 
-int main() {
+static void usage(FILE* f) {
+	fprintf(f,
+"\nUsage: "\
+"\n	joy_wiper [-j <device>] [-f <Hz>] [-R] [-p <prio>[@<cpu>]] [-q <prio>[@<cpu>]]"\
+"\n	-j	joystick device, jsX or evdev eventX (default %s)"\
+"\n	-f	control loop rate (default %d Hz)"\
+"\n	-R	real-time profile: SCHED_FIFO, mlockall and prefault"\
+"\n	-p	actuator (main loop) priority and CPU (default %d, any CPU)"\
+"\n	-q	joystick reader priority and CPU (default %d, any CPU)"\
+"\n"\
+"\nSend SIGUSR1 to print loop jitter statistics.\n",
+		JS_DEV_FN,
+		DEFAULT_RATE_HZ,
+		RT_PROFILE__ACTUATOR_PRIO,
+		RT_PROFILE__READER_PRIO
+	);
+}
+
+int main(int argc, char** argv) {
+	int rt = 0;
+	const char* js_path = JS_DEV_FN;
+	int rate_hz = DEFAULT_RATE_HZ;
+	rt_profile__thread_t actuator_thread = { RT_PROFILE__ACTUATOR_PRIO, -1 };
+	rt_profile__thread_t reader_thread = { RT_PROFILE__READER_PRIO, -1 };
+	int opt;
+	while ((opt = getopt(argc, argv, "j:f:Rp:q:h")) != -1) {
+		switch (opt) {
+			case 'j':
+				js_path = optarg;
+				break;
+			case 'f':
+				rate_hz = atoi(optarg);
+				if (rate_hz <= 0) {
+					fprintf(stderr, "ERROR: Invalid rate \"%s\"!\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'R':
+				rt = 1;
+				break;
+			case 'p':
+			case 'q':
+				if (rt_profile__parse_thread(optarg, opt == 'p' ? &actuator_thread : &reader_thread)) {
+					fprintf(stderr, "ERROR: Invalid priority \"%s\"!\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'h':
+				usage(stdout);
+				return 0;
+			default:
+				usage(stderr);
+				return EXIT_FAILURE;
+		}
+	}
+
+	// Before any thread exists, so that their stacks get locked too.
+	if (rt && rt_profile__lock_memory() != 0) {
+		perror("Failed to lock memory");
+	}
 
 	// Open GPIO device
 	int gpio_fd = open(DEV_STREAM_FN, O_RDWR);
@@ -103,43 +235,92 @@ int main() {
 		return EXIT_FAILURE;
 	}
 
+	// Formatter stays at normal priority, started before -R applies.
+	int e = rt_log__start(stdout);
+	if (e != 0) {
+		fprintf(stderr, "Failed to start logger: %s\n", strerror(e));
+		close(gpio_fd);
+		return EXIT_FAILURE;
+	}
+
 	sem_init(&buttons_intitialized, 0, 0);
 
+	stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (stop_fd < 0) {
+		perror("Failed to create stop eventfd");
+		rt_log__stop();
+		close(gpio_fd);
+		return EXIT_FAILURE;
+	}
+
 	pthread_t reader;
-	pthread_create(&reader, NULL, js_reader, NULL);
+	pthread_create(&reader, NULL, js_reader, (void*)js_path);
 
+	if (rt) {
+		int r = rt_profile__set_thread(reader, &reader_thread);
+		if (r == 0) {
+			r = rt_profile__set_thread(pthread_self(), &actuator_thread);
+		}
+		if (r != 0) {
+			fprintf(stderr, "Failed to set real-time scheduling: %s\n", strerror(r));
+		}
+		rt_profile__log(stdout);
+	}
 
 	sem_wait(&buttons_intitialized);
+	if (!reader_ready) {
+		// No input, no point in driving the wiper.
+		pthread_join(reader, NULL);
+		rt_log__stop();
+		close(stop_fd);
+		close(gpio_fd);
+		return EXIT_FAILURE;
+	}
 
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGUSR1, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	// Absolute deadlines, so the period does not stretch by the loop body.
+	periodic_t loop;
+	if (periodic__init(&loop, rate_hz, 0) != 0) {
+		perror("Failed to create loop timer");
+		close(gpio_fd);
+		return EXIT_FAILURE;
+	}
 
-	uint8_t* prev_buttons = (uint8_t*)malloc(3 * sizeof(uint8_t));
-    if (prev_buttons == NULL) {
-        perror("Memory allocation failed");
-        return 1;
-    }
-	// Initialize prev_states to 0
-    for (int i = 0; i < 3; i++) {
-        prev_buttons[i] = 0;
-    }
+	uint8_t prev_buttons[3] = { 0, 0, 0 };
 
+	rt_log__thread_init();
+	while (!stop_requested) {
+		if (periodic__tick(&loop) < 0) {
+			perror("Failed to wait for loop timer");
+			break;
+		}
+		if (stats_requested) {
+			stats_requested = 0;
+			periodic__print(stdout, "loop", &loop);
+		}
 
-	while (1) {
 		pthread_mutex_lock(&button_printf_mtx);
 		//TODO Other buttons
 		if(buttons[0] && (buttons[0] != prev_buttons[0])){ // CCW BUTTON
-			printf("CCW\n");
+			RT_LOG__INFO("CCW\n");
 			gpio_write(gpio_fd, 3, 1); // CCW
 			gpio_write(gpio_fd, 4, 0); // CCW
 
 			gpio_write(gpio_fd, 2, 1); // EN = 1
 		} else if (buttons[1] && (buttons[1] != prev_buttons[1])) { // CW BUTTON
-			printf("CW\n");
+			RT_LOG__INFO("CW\n");
 			gpio_write(gpio_fd, 3, 0); // CW
 			gpio_write(gpio_fd, 4, 1); // CW
 
 			gpio_write(gpio_fd, 2, 1); // EN = 1
 		}else if (buttons[2] && (buttons[2] != prev_buttons[2])) { //STOP BUTTON - X
-			printf("STOP\n");
+			RT_LOG__INFO("STOP\n");
 			gpio_write(gpio_fd, 2, 0); // EN = 0
 		}
 
@@ -147,24 +328,21 @@ int main() {
 		prev_buttons[1] = buttons[1];
 		prev_buttons[2] = buttons[2];
 		pthread_mutex_unlock(&button_printf_mtx);
-		usleep(10000); 
-		
 	}
 
-	printf("Exiting...\n");
-	
-	
+	// Reader wakes up on stop_fd in its epoll_wait() and closes the
+	// joystick itself.
+	uint64_t one = 1;
+	if (write(stop_fd, &one, sizeof(one)) < 0) {
+		perror("Failed to stop joystick reader");
+	}
 	pthread_join(reader, NULL);
+	close(stop_fd);
 
-	if (buttons != NULL) {
-        free((void*)buttons);
-        buttons = NULL;
-    }
-
-	if (prev_buttons != NULL) {
-        free(prev_buttons);
-        prev_buttons = NULL;
-    }
+	rt_log__stop();
+	printf("Exiting...\n");
+	periodic__print(stdout, "loop", &loop);
+	periodic__close(&loop);
 
 	close(gpio_fd);
 	pthread_mutex_destroy(&button_printf_mtx);
@@ -0,0 +1,199 @@
+
+#ifndef COMPONENT_H
+#define COMPONENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <zmq.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Nodes as components, which a process hosts one or several of.
+//
+// A component is set up by init() from its command line, as its main()
+// did, runs its loop in run() until shutdown(), and releases all it has
+// when run() returns. Components of one process share a ZeroMQ context,
+// so they connect over inproc://, where a message is handed over between
+// threads by pointer, without syscalls or copies through the kernel.
+//
+// Built with COMPONENT__NO_MAIN, a node leaves out its main(), so that
+// wiper_launch links several of them into one binary.
+
+typedef struct {
+	const char* name;
+	/**
+	 * Parse @a argv, as main() would, and set up, with sockets in @a context.
+	 * @return 0 if Ok, 1 if there is nothing to run, e.g. on -h, -1 on
+	 * error; unless 0, nothing is left to release.
+	 */
+	int (*init)(int argc, char** argv, void* context);
+	/**
+	 * Loop until shutdown(), then release everything.
+	 * @return exit status.
+	 */
+	int (*run)(void);
+	/**
+	 * Make run() return. Any thread, also before run() started.
+	 */
+	void (*shutdown)(void);
+	/**
+	 * Print statistics to stdout. Any thread.
+	 */
+	void (*print_stats)(void);
+} component_t;
+
+// Components of 2_IPC.
+extern const component_t joy_node__component;
+extern const component_t wiper_node__component;
+
+typedef struct {
+	const component_t* c;
+	int argc;
+	char** argv;
+	pthread_t thread;
+	int status;
+} component__instance_t;
+
+/**
+ * SCHED_FIFO priority @a prio, and CPU @a cpu unless -1, for the ZeroMQ
+ * I/O threads of @a context. Only takes effect before the first socket
+ * of the context starts them.
+ */
+static inline void component__io_rt(void* context, int prio, int cpu) {
+	if(
+		zmq_ctx_set(context, ZMQ_THREAD_SCHED_POLICY, SCHED_FIFO) != 0 ||
+		zmq_ctx_set(context, ZMQ_THREAD_PRIORITY, prio) != 0
+	){
+		perror("Failed to set ZeroMQ I/O thread priority");
+	}
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+	if(cpu >= 0 && zmq_ctx_set(context, ZMQ_THREAD_AFFINITY_CPU_ADD, cpu) != 0){
+		perror("Failed to pin ZeroMQ I/O thread");
+	}
+#else
+	(void)cpu;
+#endif
+}
+
+static inline void* component__thread(void* arg) {
+	component__instance_t* inst = arg;
+	inst->status = inst->c->run();
+	// One stopped, e.g. on error, so stop all of them.
+	kill(getpid(), SIGTERM);
+	return NULL;
+}
+
+/**
+ * Host @a n components in this process, each running in a thread of its
+ * own. This thread takes the signals: SIGUSR1 prints statistics of all,
+ * SIGINT/SIGTERM or any component returning shuts all down. Unless
+ * @a io_prio is 0, ZeroMQ I/O threads of the shared context run at it, on
+ * @a io_cpu unless -1, set before any component creates a socket.
+ * @return EXIT_SUCCESS if all were set up and returned so.
+ */
+static inline int component__host(
+	component__instance_t* insts,
+	int n,
+	int io_prio,
+	int io_cpu
+) {
+	// Blocked before any thread exists, so that all inherit it and only
+	// sigwait() below takes them.
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGUSR1);
+	if(pthread_sigmask(SIG_BLOCK, &sigs, NULL) != 0){
+		perror("Failed to block signals");
+		return EXIT_FAILURE;
+	}
+
+	void* context = zmq_ctx_new();
+	if(!context){
+		perror("Failed to create ZeroMQ context");
+		return EXIT_FAILURE;
+	}
+	if(io_prio){
+		component__io_rt(context, io_prio, io_cpu);
+	}
+
+	int r = EXIT_SUCCESS;
+	int stop = 0;
+	int num_of_inited = 0;
+	for(; num_of_inited < n; num_of_inited++){
+		component__instance_t* inst = &insts[num_of_inited];
+		optind = 0; // getopt() from scratch on another argv.
+		int e = inst->c->init(inst->argc, inst->argv, context);
+		if(e != 0){
+			if(e < 0){
+				fprintf(stderr, "Failed to set up %s\n", inst->c->name);
+				r = EXIT_FAILURE;
+			}
+			stop = 1;
+			break;
+		}
+	}
+	int num_of_started = 0;
+	for(; num_of_started < num_of_inited; num_of_started++){
+		component__instance_t* inst = &insts[num_of_started];
+		if(pthread_create(&inst->thread, NULL, component__thread, inst) != 0){
+			perror("Failed to create component thread");
+			r = EXIT_FAILURE;
+			break;
+		}
+	}
+	// Those set up but not started release all in run() too.
+	for(int i = num_of_started; i < num_of_inited; i++){
+		insts[i].c->shutdown();
+		insts[i].status = insts[i].c->run();
+	}
+
+	int running = !stop && r == EXIT_SUCCESS;
+	while(running){
+		int sig;
+		if(sigwait(&sigs, &sig) != 0){
+			continue;
+		}
+		if(sig == SIGUSR1){
+			for(int i = 0; i < num_of_started; i++){
+				insts[i].c->print_stats();
+			}
+		}else{
+			printf("Caught signal %d, exiting...\n", sig);
+			running = 0;
+		}
+	}
+
+	// In reverse order of setup.
+	for(int i = num_of_started - 1; i >= 0; i--){
+		insts[i].c->shutdown();
+		pthread_join(insts[i].thread, NULL);
+	}
+	for(int i = 0; i < num_of_inited; i++){
+		if(insts[i].status != EXIT_SUCCESS){
+			r = EXIT_FAILURE;
+		}
+	}
+
+	// All sockets are closed by now, else this would wait for them.
+	zmq_ctx_destroy(context);
+	return r;
+}
+
+/**
+ * main() of a standalone node.
+ */
+static inline int component__main(const component_t* c, int argc, char** argv) {
+	component__instance_t inst = { .c = c, .argc = argc, .argv = argv };
+	return component__host(&inst, 1, 0, -1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // COMPONENT_H
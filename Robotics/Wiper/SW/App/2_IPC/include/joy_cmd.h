@@ -0,0 +1,439 @@
+
+#ifndef JOY_CMD_H
+#define JOY_CMD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <zmq.h>
+
+#include "joy_msg.h"
+#include "../../../Common/include/trace_hist.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Acknowledged command channel from joy_node to wiper nodes.
+//
+// joy_node binds a ROUTER socket, each wiper_node -a connects a DEALER with
+// its node id as routing id, and says hello with the topics it takes, now
+// and then, as a heartbeat. Each state for a topic of the node goes to it
+// as a command with an id, and the node acks it once its GPIO writes are
+// done, or right away if it already applied a newer one.
+//
+// Up to a window of commands is in flight per node, beyond that only the
+// latest state waits for room. Commands are whole states, so the newest
+// one in flight supersedes the older ones: an ack is cumulative, and only
+// the newest is sent again on timeout, until it is acked or given up.
+
+#define JOY_CMD__HELLO 'H'
+#define JOY_CMD__COMMAND 'C'
+#define JOY_CMD__ACK 'A'
+
+#define JOY_CMD__MAX_ID 32 // Routing id, i.e. node id.
+#define JOY_CMD__MAX_TOPICS 6
+#define JOY_CMD__MAX_PEERS 16
+#define JOY_CMD__MAX_WINDOW 16
+// Node says hello this often, and is forgotten after missing a few.
+#define JOY_CMD__HELLO_PERIOD_MS 1000
+#define JOY_CMD__PEER_TIMEOUT_MS 3500
+
+// joy_cmd_ack_t.status
+#define JOY_CMD__APPLIED 0
+#define JOY_CMD__STALE 1 // Newer command was applied already.
+
+typedef struct __attribute__((packed)) {
+	uint8_t type; // JOY_CMD__HELLO.
+	uint8_t num_of_topics;
+	char topics[JOY_CMD__MAX_TOPICS][JOY_MSG__TOPIC_SIZE];
+} joy_cmd_hello_t;
+
+/**
+ * Same size as joy_frame_t, with the state at the same offset, so that
+ * wiper_rx receives either into the same slots.
+ */
+typedef struct __attribute__((packed)) {
+	uint8_t type;    // JOY_CMD__COMMAND.
+	uint8_t attempt; // 0 on first send, +1 per retry.
+	uint8_t reserved[6];
+	uint32_t session; // Of joy_node run, ids start over with it.
+	uint32_t id;      // +1 per command to the node, also in msg.seq.
+	joy_msg_t msg;
+} joy_cmd_t;
+
+_Static_assert(sizeof(joy_cmd_t) == sizeof(joy_frame_t), "joy_cmd_t layout changed");
+_Static_assert(
+	offsetof(joy_cmd_t, msg) == offsetof(joy_frame_t, msg),
+	"joy_cmd_t layout changed"
+);
+
+typedef struct __attribute__((packed)) {
+	uint8_t type;    // JOY_CMD__ACK.
+	uint8_t status;  // JOY_CMD__APPLIED or JOY_CMD__STALE.
+	uint8_t attempt; // Of the command acked.
+	uint8_t reserved;
+	uint32_t session;
+	uint32_t id;
+	uint32_t reserved2;
+	uint64_t rx_time_ns;    // CLOCK_REALTIME when received.
+	uint64_t apply_time_ns; // CLOCK_REALTIME when GPIO writes were done.
+} joy_cmd_ack_t;
+
+_Static_assert(sizeof(joy_cmd_ack_t) == 32, "joy_cmd_ack_t layout changed");
+
+static inline size_t joy_cmd__hello_size(int num_of_topics) {
+	return offsetof(joy_cmd_hello_t, topics) + num_of_topics*JOY_MSG__TOPIC_SIZE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// joy_node side, used from its sender thread only. Counters are read by
+// other threads.
+
+typedef struct {
+	uint8_t attempt;
+	uint64_t first_ns; // CLOCK_MONOTONIC of first send.
+	uint64_t sent_ns;  // Of latest attempt.
+	joy_cmd_t cmd;
+} joy_cmd__flight_t;
+
+typedef struct {
+	uint8_t rid[JOY_CMD__MAX_ID];
+	size_t rid_size;
+	uint64_t seen_ns; // Last hello or ack.
+	uint32_t next_id;
+	// Oldest first, ids ascending.
+	joy_cmd__flight_t flights[JOY_CMD__MAX_WINDOW];
+	int num_in_flight;
+	int has_pending; // State waiting for room in the window.
+	joy_msg_t pending;
+} joy_cmd__peer_t;
+
+typedef struct {
+	char topic[JOY_MSG__TOPIC_SIZE]; // Only nodes which take it.
+	uint32_t session;
+	int window;
+	uint64_t timeout_ns;
+	int max_retries;
+	joy_cmd__peer_t peers[JOY_CMD__MAX_PEERS];
+	int num_of_peers;
+	// Ids given out to all nodes. A node which comes back starts above
+	// its old ids, so that it does not take the new ones as stale.
+	uint32_t issued;
+	_Atomic int nodes; // num_of_peers, for other threads.
+	_Atomic uint64_t sent;      // Commands, not counting retries.
+	_Atomic uint64_t acked;
+	_Atomic uint64_t stale;     // Acked as superseded.
+	_Atomic uint64_t retries;
+	_Atomic uint64_t lost;      // Given up, or node gone with them.
+	_Atomic uint64_t coalesced; // Overwritten while waiting for room.
+	_Atomic uint64_t send_errors;
+} joy_cmd_client_t;
+
+#define JOY_CMD__ADD(x, n) \
+	atomic_store_explicit(&(x), atomic_load_explicit(&(x), memory_order_relaxed) + (n), memory_order_relaxed)
+
+static inline void joy_cmd__init(
+	joy_cmd_client_t* c,
+	const char topic[JOY_MSG__TOPIC_SIZE],
+	uint32_t session,
+	int window,
+	int timeout_ms,
+	int max_retries
+) {
+	memset(c, 0, sizeof(*c));
+	memcpy(c->topic, topic, JOY_MSG__TOPIC_SIZE);
+	c->session = session;
+	c->window = window < JOY_CMD__MAX_WINDOW ? window : JOY_CMD__MAX_WINDOW;
+	c->timeout_ns = (uint64_t)timeout_ms*1000000ULL;
+	c->max_retries = max_retries;
+}
+
+static inline void joy_cmd__remove_peer(joy_cmd_client_t* c, joy_cmd__peer_t* p) {
+	JOY_CMD__ADD(c->lost, p->num_in_flight);
+	*p = c->peers[--c->num_of_peers];
+	atomic_store_explicit(&c->nodes, c->num_of_peers, memory_order_relaxed);
+}
+
+/**
+ * @return 0 if Ok, -1 if the node is gone and was removed.
+ */
+static inline int joy_cmd__send(
+	joy_cmd_client_t* c,
+	void* socket,
+	joy_cmd__peer_t* p,
+	joy_cmd__flight_t* f,
+	uint64_t now_ns
+) {
+	f->sent_ns = now_ns;
+	f->cmd.attempt = f->attempt;
+	f->cmd.msg.pub_time_ns = joy_msg__now_ns();
+	if(
+		zmq_send(socket, p->rid, p->rid_size, ZMQ_SNDMORE | ZMQ_DONTWAIT) < 0 ||
+		zmq_send(socket, &f->cmd, sizeof(f->cmd), ZMQ_DONTWAIT) < 0
+	){
+		if(errno == EHOSTUNREACH){
+			// ZMQ_ROUTER_MANDATORY: disconnected, forget it at once.
+			joy_cmd__remove_peer(c, p);
+			return -1;
+		}
+		// Queue full, it is sent again on timeout.
+		JOY_CMD__ADD(c->send_errors, 1);
+	}
+	return 0;
+}
+
+/**
+ * Command @a msg to one node, or keep it until there is room.
+ * @return 0 if Ok, -1 if the node is gone and was removed.
+ */
+static inline int joy_cmd__submit_to(
+	joy_cmd_client_t* c,
+	void* socket,
+	joy_cmd__peer_t* p,
+	const joy_msg_t* msg,
+	uint64_t now_ns
+) {
+	if(p->num_in_flight == c->window){
+		if(p->has_pending){
+			JOY_CMD__ADD(c->coalesced, 1);
+		}
+		p->pending = *msg;
+		p->has_pending = 1;
+		return 0;
+	}
+	joy_cmd__flight_t* f = &p->flights[p->num_in_flight++];
+	memset(f, 0, sizeof(*f));
+	f->first_ns = now_ns;
+	f->cmd.type = JOY_CMD__COMMAND;
+	f->cmd.session = c->session;
+	f->cmd.id = p->next_id++;
+	c->issued++;
+	f->cmd.msg = *msg;
+	f->cmd.msg.seq = f->cmd.id;
+	JOY_CMD__ADD(c->sent, 1);
+	return joy_cmd__send(c, socket, p, f, now_ns);
+}
+
+static inline int joy_cmd__send_pending(
+	joy_cmd_client_t* c,
+	void* socket,
+	joy_cmd__peer_t* p,
+	uint64_t now_ns
+) {
+	if(!p->has_pending || p->num_in_flight == c->window){
+		return 0;
+	}
+	p->has_pending = 0;
+	return joy_cmd__submit_to(c, socket, p, &p->pending, now_ns);
+}
+
+/**
+ * Command @a msg to all nodes.
+ */
+static inline void joy_cmd__submit(
+	joy_cmd_client_t* c,
+	void* socket,
+	const joy_msg_t* msg,
+	uint64_t now_ns
+) {
+	for(int i = 0; i < c->num_of_peers; ){
+		if(joy_cmd__submit_to(c, socket, &c->peers[i], msg, now_ns) == 0){
+			i++;
+		} // Else last peer was moved to i.
+	}
+}
+
+static inline joy_cmd__peer_t* joy_cmd__find_peer(
+	joy_cmd_client_t* c,
+	const uint8_t* rid,
+	size_t rid_size
+) {
+	for(int i = 0; i < c->num_of_peers; i++){
+		joy_cmd__peer_t* p = &c->peers[i];
+		if(p->rid_size == rid_size && memcmp(p->rid, rid, rid_size) == 0){
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Node said hello. A node new here, which takes our topic, gets @a latest
+ * right away, flagged as snapshot, like a new subscriber.
+ */
+static inline void joy_cmd__on_hello(
+	joy_cmd_client_t* c,
+	void* socket,
+	const uint8_t* rid,
+	size_t rid_size,
+	const joy_cmd_hello_t* hello,
+	size_t size,
+	const joy_msg_t* latest,
+	uint64_t now_ns
+) {
+	if(
+		size < joy_cmd__hello_size(0) ||
+		hello->num_of_topics > JOY_CMD__MAX_TOPICS ||
+		size != joy_cmd__hello_size(hello->num_of_topics)
+	){
+		return;
+	}
+	joy_cmd__peer_t* p = joy_cmd__find_peer(c, rid, rid_size);
+	if(p){
+		p->seen_ns = now_ns;
+		return;
+	}
+	int takes = 0;
+	for(int i = 0; i < hello->num_of_topics; i++){
+		takes |= memcmp(hello->topics[i], c->topic, JOY_MSG__TOPIC_SIZE) == 0;
+	}
+	if(!takes || rid_size > JOY_CMD__MAX_ID || c->num_of_peers == JOY_CMD__MAX_PEERS){
+		return;
+	}
+	p = &c->peers[c->num_of_peers++];
+	memset(p, 0, sizeof(*p));
+	memcpy(p->rid, rid, rid_size);
+	p->rid_size = rid_size;
+	p->seen_ns = now_ns;
+	p->next_id = c->issued;
+	atomic_store_explicit(&c->nodes, c->num_of_peers, memory_order_relaxed);
+
+	joy_msg_t msg = *latest;
+	msg.flags |= JOY_MSG__FLAG_SNAPSHOT;
+	joy_cmd__submit_to(c, socket, p, &msg, now_ns);
+}
+
+/**
+ * Ack of command @a ack->id and of all older ones.
+ * @param rtt command to ack time, from its first send, unless a snapshot.
+ */
+static inline void joy_cmd__on_ack(
+	joy_cmd_client_t* c,
+	void* socket,
+	const uint8_t* rid,
+	size_t rid_size,
+	const joy_cmd_ack_t* ack,
+	size_t size,
+	trace_hist_t* rtt,
+	uint64_t now_ns
+) {
+	joy_cmd__peer_t* p = joy_cmd__find_peer(c, rid, rid_size);
+	if(!p || size != sizeof(*ack) || ack->session != c->session){
+		return;
+	}
+	p->seen_ns = now_ns;
+	int n = 0;
+	while(n < p->num_in_flight && (int32_t)(p->flights[n].cmd.id - ack->id) <= 0){
+		const joy_cmd__flight_t* f = &p->flights[n++];
+		if(f->cmd.id == ack->id && !(f->cmd.msg.flags & JOY_MSG__FLAG_SNAPSHOT)){
+			trace_hist__add(rtt, now_ns - f->first_ns);
+		}
+	}
+	if(n == 0){
+		return; // Duplicate, of a retry.
+	}
+	JOY_CMD__ADD(c->acked, n);
+	if(ack->status == JOY_CMD__STALE){
+		JOY_CMD__ADD(c->stale, 1);
+	}
+	p->num_in_flight -= n;
+	memmove(p->flights, p->flights + n, p->num_in_flight*sizeof(p->flights[0]));
+	joy_cmd__send_pending(c, socket, p, now_ns);
+}
+
+/**
+ * Take all hellos and acks queued on the ROUTER socket.
+ * @return 0 if Ok, -1 on error with errno set.
+ */
+static inline int joy_cmd__recv(
+	joy_cmd_client_t* c,
+	void* socket,
+	const joy_msg_t* latest,
+	trace_hist_t* rtt,
+	uint64_t now_ns
+) {
+	uint8_t rid[JOY_CMD__MAX_ID];
+	union {
+		uint8_t type;
+		joy_cmd_hello_t hello;
+		joy_cmd_ack_t ack;
+	} body;
+	while(1){
+		int rid_size = zmq_recv(socket, rid, sizeof(rid), ZMQ_DONTWAIT);
+		if(rid_size < 0){
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		}
+		int more = 0;
+		size_t more_size = sizeof(more);
+		zmq_getsockopt(socket, ZMQ_RCVMORE, &more, &more_size);
+		if(!more){
+			continue;
+		}
+		int size = zmq_recv(socket, &body, sizeof(body), ZMQ_DONTWAIT);
+		if(size < 1 || size > (int)sizeof(body) || rid_size > (int)sizeof(rid)){
+			continue;
+		}
+		if(body.type == JOY_CMD__HELLO){
+			joy_cmd__on_hello(c, socket, rid, rid_size, &body.hello, size, latest, now_ns);
+		}else if(body.type == JOY_CMD__ACK){
+			joy_cmd__on_ack(c, socket, rid, rid_size, &body.ack, size, rtt, now_ns);
+		}
+	}
+}
+
+/**
+ * Send the newest command in flight again on timeout, give up after
+ * max_retries, and forget nodes which stopped saying hello.
+ */
+static inline void joy_cmd__expire(joy_cmd_client_t* c, void* socket, uint64_t now_ns) {
+	for(int i = 0; i < c->num_of_peers; ){
+		joy_cmd__peer_t* p = &c->peers[i];
+		if(now_ns - p->seen_ns >= JOY_CMD__PEER_TIMEOUT_MS*1000000ULL){
+			joy_cmd__remove_peer(c, p);
+			continue;
+		}
+		if(p->num_in_flight){
+			joy_cmd__flight_t* f = &p->flights[p->num_in_flight - 1];
+			if(now_ns - f->sent_ns >= c->timeout_ns){
+				if(f->attempt >= c->max_retries){
+					JOY_CMD__ADD(c->lost, p->num_in_flight);
+					p->num_in_flight = 0;
+					if(joy_cmd__send_pending(c, socket, p, now_ns) != 0){
+						continue;
+					}
+				}else{
+					f->attempt++;
+					JOY_CMD__ADD(c->retries, 1);
+					if(joy_cmd__send(c, socket, p, f, now_ns) != 0){
+						continue;
+					}
+				}
+			}
+		}
+		i++;
+	}
+}
+
+/**
+ * @return ms until joy_cmd__expire() has work, -1 if never.
+ */
+static inline int joy_cmd__ms_to_next(const joy_cmd_client_t* c, uint64_t now_ns) {
+	uint64_t next_ns = UINT64_MAX;
+	for(int i = 0; i < c->num_of_peers; i++){
+		const joy_cmd__peer_t* p = &c->peers[i];
+		uint64_t t = p->seen_ns + JOY_CMD__PEER_TIMEOUT_MS*1000000ULL;
+		if(p->num_in_flight){
+			uint64_t r = p->flights[p->num_in_flight - 1].sent_ns + c->timeout_ns;
+			t = r < t ? r : t;
+		}
+		next_ns = t < next_ns ? t : next_ns;
+	}
+	if(next_ns == UINT64_MAX){
+		return -1;
+	}
+	return next_ns <= now_ns ? 0 : (next_ns - now_ns + 999999)/1000000;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // JOY_CMD_H
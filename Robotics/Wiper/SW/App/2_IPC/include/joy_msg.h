@@ -0,0 +1,178 @@
+
+#ifndef JOY_MSG_H
+#define JOY_MSG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Wire format of joystick state published by joy_node.
+
+#define JOY_MSG__VERSION 2
+#define JOY_MSG__MAX_BUTTONS 32
+#define JOY_MSG__MAX_AXES 8
+
+// joy_msg_t.flags
+#define JOY_MSG__FLAG_SNAPSHOT 0x01 // Full state sent to a new subscriber.
+
+/**
+ * Fixed layout, little-endian (Raspberry Pi and x86 hosts both are).
+ * Fields are naturally aligned, packed only so that it can be read in place
+ * from buffers without alignment guarantees, like zmq_msg_data().
+ */
+typedef struct __attribute__((packed)) {
+	uint8_t version;        // JOY_MSG__VERSION.
+	uint8_t flags;          // JOY_MSG__FLAG_*.
+	uint8_t num_of_buttons; // Valid bits in buttons.
+	uint8_t num_of_axes;    // Valid entries in axes.
+	uint32_t seq;           // +1 per published message, for gap detection.
+	uint64_t pub_time_ns;   // CLOCK_REALTIME when published [ns].
+	uint32_t js_time;       // js_event.time of the causing event [ms].
+	uint32_t buttons;       // Bit i set = button i pressed.
+	int16_t axes[JOY_MSG__MAX_AXES];
+	// Trace of the input which caused this message, for per-stage latency.
+	uint64_t read_time_ns;  // CLOCK_REALTIME when joy_node read it [ns].
+	uint32_t trace_id;      // +1 per js_event read by joy_node.
+} joy_msg_t;
+
+_Static_assert(sizeof(joy_msg_t) == 52, "joy_msg_t layout changed");
+
+static inline uint64_t joy_msg__now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static inline void joy_msg__init(
+	joy_msg_t* msg,
+	int num_of_buttons,
+	int num_of_axes
+) {
+	memset(msg, 0, sizeof(*msg));
+	msg->version = JOY_MSG__VERSION;
+	msg->num_of_buttons = num_of_buttons < JOY_MSG__MAX_BUTTONS ?
+		num_of_buttons : JOY_MSG__MAX_BUTTONS;
+	msg->num_of_axes = num_of_axes < JOY_MSG__MAX_AXES ?
+		num_of_axes : JOY_MSG__MAX_AXES;
+}
+
+/**
+ * Validate message in place, without copying.
+ * @return msg view of data, or NULL if it is not a valid message.
+ */
+static inline const joy_msg_t* joy_msg__parse(const void* data, size_t size) {
+	const joy_msg_t* msg = (const joy_msg_t*)data;
+	if(size != sizeof(joy_msg_t)){
+		return NULL;
+	}
+	if(msg->version != JOY_MSG__VERSION){
+		return NULL;
+	}
+	if(
+		msg->num_of_buttons > JOY_MSG__MAX_BUTTONS ||
+		msg->num_of_axes > JOY_MSG__MAX_AXES
+	){
+		return NULL;
+	}
+	return msg;
+}
+
+static inline int joy_msg__button(const joy_msg_t* msg, int i) {
+	return i < msg->num_of_buttons && (msg->buttons >> i & 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Addressing of wiper nodes.
+//
+// Each published frame starts with a fixed size, NUL padded topic, and
+// subscribers subscribe to whole topics, so "g/front" does not match
+// "g/front2" and the publisher drops what nobody subscribed to. Topic and
+// state are one frame, as ZMQ_CONFLATE only keeps single part messages.
+// A wiper node subscribes to:
+// - JOY_MSG__TOPIC_ALL, broadcast,
+// - JOY_MSG__TOPIC_GROUP + name, for each group it is in,
+// - JOY_MSG__TOPIC_NODE + id, itself.
+
+#define JOY_MSG__TOPIC_SIZE 16
+#define JOY_MSG__TOPIC_ALL "all"
+#define JOY_MSG__TOPIC_GROUP "g/"
+#define JOY_MSG__TOPIC_NODE "n/"
+
+typedef struct __attribute__((packed)) {
+	char topic[JOY_MSG__TOPIC_SIZE];
+	joy_msg_t msg;
+} joy_frame_t;
+
+_Static_assert(sizeof(joy_frame_t) == 68, "joy_frame_t layout changed");
+
+/**
+ * Topic @a prefix followed by @a name, NUL padded.
+ * @return 0 if Ok, -1 if too long.
+ */
+static inline int joy_msg__topic(
+	char topic[JOY_MSG__TOPIC_SIZE],
+	const char* prefix,
+	const char* name
+) {
+	memset(topic, 0, JOY_MSG__TOPIC_SIZE);
+	size_t p = strlen(prefix);
+	size_t n = strlen(name);
+	if(p + n >= JOY_MSG__TOPIC_SIZE){
+		return -1;
+	}
+	memcpy(topic, prefix, p);
+	memcpy(topic + p, name, n);
+	return 0;
+}
+
+/**
+ * Validate frame in place, like joy_msg__parse().
+ * @return msg view of data, or NULL if it is not a valid frame.
+ */
+static inline const joy_msg_t* joy_msg__parse_frame(const void* data, size_t size) {
+	if(size != sizeof(joy_frame_t)){
+		return NULL;
+	}
+	return joy_msg__parse(&((const joy_frame_t*)data)->msg, sizeof(joy_msg_t));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Subscriber side sequence tracking.
+
+typedef struct {
+	int synced;        // Got at least one message.
+	uint32_t next_seq; // Expected seq of the next message.
+	uint64_t received;
+	uint64_t lost;     // Sum of all gaps.
+	uint64_t restarts; // Seq went backwards, publisher restarted.
+} joy_msg__seq_stats_t;
+
+/**
+ * Account for message with @a seq.
+ * @return number of messages lost right before this one.
+ */
+static inline uint32_t joy_msg__seq_track(
+	joy_msg__seq_stats_t* s,
+	uint32_t seq
+) {
+	uint32_t gap = 0;
+	if(s->synced){
+		int32_t d = (int32_t)(seq - s->next_seq);
+		if(d > 0){
+			gap = d;
+			s->lost += gap;
+		}else if(d < 0){
+			s->restarts++;
+		}
+	}
+	s->synced = 1;
+	s->next_seq = seq + 1;
+	s->received++;
+	return gap;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // JOY_MSG_H
@@ -0,0 +1,122 @@
+#ifndef JOY_REC_H
+#define JOY_REC_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/joystick.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Recording of raw joystick events, as read from /dev/input/js0.
+//
+// Fixed size header followed by an array of fixed size records, so the
+// whole file can be mmap()-ed and indexed, and an interrupted recording is
+// still valid up to its last whole record. Little endian, as on the Pi.
+
+#define JOY_REC__MAGIC "JOYREC\0\0"
+#define JOY_REC__VERSION 1
+
+typedef struct __attribute__((packed)) {
+	char magic[8];
+	uint32_t version;
+	uint8_t num_of_buttons;
+	uint8_t num_of_axes;
+	uint16_t _pad;
+	uint64_t start_ns; // CLOCK_MONOTONIC at start of recording.
+} joy_rec_header_t;
+
+typedef struct __attribute__((packed)) {
+	uint64_t t_ns; // CLOCK_MONOTONIC, relative to start_ns.
+	struct js_event ev;
+} joy_rec_event_t;
+
+_Static_assert(sizeof(joy_rec_header_t) == 24, "joy_rec_header_t size");
+_Static_assert(sizeof(joy_rec_event_t) == 16, "joy_rec_event_t size");
+
+typedef struct {
+	void* map;
+	size_t map_size;
+	const joy_rec_header_t* header;
+	const joy_rec_event_t* events;
+	size_t num_of_events;
+} joy_rec_t;
+
+static inline uint64_t joy_rec__now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static inline void joy_rec__init_header(
+	joy_rec_header_t* h,
+	uint8_t num_of_buttons,
+	uint8_t num_of_axes
+) {
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, JOY_REC__MAGIC, sizeof(h->magic));
+	h->version = JOY_REC__VERSION;
+	h->num_of_buttons = num_of_buttons;
+	h->num_of_axes = num_of_axes;
+	h->start_ns = joy_rec__now_ns();
+}
+
+/**
+ * Map recording read-only.
+ * @return 0 if Ok, -1 with errno set.
+ */
+static inline int joy_rec__open(joy_rec_t* r, const char* path) {
+	memset(r, 0, sizeof(*r));
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		return -1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0){
+		close(fd);
+		return -1;
+	}
+	if((size_t)st.st_size < sizeof(joy_rec_header_t)){
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED){
+		return -1;
+	}
+	const joy_rec_header_t* h = (const joy_rec_header_t*)p;
+	if(
+		memcmp(h->magic, JOY_REC__MAGIC, sizeof(h->magic)) != 0 ||
+		h->version != JOY_REC__VERSION
+	){
+		munmap(p, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	r->map = p;
+	r->map_size = st.st_size;
+	r->header = h;
+	r->events = (const joy_rec_event_t*)(h + 1);
+	// Trailing partial record of an interrupted recording is ignored.
+	r->num_of_events =
+		(st.st_size - sizeof(joy_rec_header_t))/sizeof(joy_rec_event_t);
+	return 0;
+}
+
+static inline void joy_rec__close(joy_rec_t* r) {
+	if(r->map){
+		munmap(r->map, r->map_size);
+		r->map = NULL;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // JOY_REC_H
@@ -0,0 +1,178 @@
+
+#ifndef JOY_RING_H
+#define JOY_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+#include "joy_msg.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Bounded queue of joystick states from the reader to the sender thread of
+// joy_node, so that a stalled socket never stalls reading the joystick.
+//
+// Single producer, single consumer, no locks. The consumer sleeps on efd,
+// which the producer only signals when the ring was empty, i.e. when the
+// consumer may be about to sleep.
+//
+// Every message is a whole state, so on overflow nothing but intermediate
+// states is lost, per policy:
+// - JOY_RING__DROP_OLDEST: producer pushes the oldest out of the ring,
+// - JOY_RING__COALESCE: ring is left as is, producer keeps overwriting a
+//   single latest slot, which the consumer takes once the ring is empty.
+
+#define JOY_RING__SIZE 64 // Power of 2.
+
+typedef enum {
+	JOY_RING__DROP_OLDEST,
+	JOY_RING__COALESCE,
+} joy_ring_policy_t;
+
+typedef struct {
+	_Atomic uint32_t head; // Written by producer.
+	_Atomic uint32_t tail; // Consumer, and producer when dropping oldest.
+	joy_ring_policy_t policy;
+	int efd;
+	// Coalesced latest state, under a seqlock, odd while written.
+	_Atomic uint32_t latest_seq;
+	_Atomic uint32_t latest_taken; // latest_seq consumer took last.
+	joy_msg_t latest;
+	// Counters, each written by one side only.
+	_Atomic uint64_t pushed;
+	_Atomic uint64_t popped;
+	_Atomic uint64_t dropped;   // Pushed out by DROP_OLDEST.
+	_Atomic uint64_t coalesced; // Overwritten in latest before taken.
+	_Atomic uint32_t max_depth;
+	joy_msg_t msgs[JOY_RING__SIZE];
+} joy_ring_t;
+
+#define JOY_RING__INC(x) \
+	atomic_store_explicit(&(x), atomic_load_explicit(&(x), memory_order_relaxed) + 1, memory_order_relaxed)
+
+/**
+ * @return 0 if Ok, -1 with errno set.
+ */
+static inline int joy_ring__init(joy_ring_t* r, joy_ring_policy_t policy) {
+	memset(r, 0, sizeof(*r));
+	r->policy = policy;
+	r->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return r->efd < 0 ? -1 : 0;
+}
+
+static inline void joy_ring__close(joy_ring_t* r) {
+	if(r->efd >= 0){
+		close(r->efd);
+		r->efd = -1;
+	}
+}
+
+static inline void joy_ring__wake(joy_ring_t* r) {
+	uint64_t one = 1;
+	if(write(r->efd, &one, sizeof(one)) < 0){
+		// Counter full, consumer is woken anyway.
+	}
+}
+
+static inline int joy_ring__latest_pending(joy_ring_t* r) {
+	return atomic_load(&r->latest_seq) != atomic_load(&r->latest_taken);
+}
+
+/**
+ * Producer side, never blocks.
+ */
+static inline void joy_ring__push(joy_ring_t* r, const joy_msg_t* msg) {
+	JOY_RING__INC(r->pushed);
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t tail = atomic_load(&r->tail);
+	if(r->policy == JOY_RING__COALESCE && (head - tail == JOY_RING__SIZE || joy_ring__latest_pending(r))){
+		// Once coalescing, keep at it until consumer took it, for order.
+		uint32_t s = atomic_load_explicit(&r->latest_seq, memory_order_relaxed);
+		atomic_store_explicit(&r->latest_seq, s + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		r->latest = *msg;
+		// seq_cst store then load, pairs with joy_ring__pop(), so either the
+		// consumer sees this state or the producer sees it took the last.
+		atomic_store(&r->latest_seq, s + 2);
+		if(atomic_load(&r->latest_taken) == s){
+			joy_ring__wake(r);
+		}else{
+			JOY_RING__INC(r->coalesced);
+		}
+		return;
+	}
+	if(head - tail == JOY_RING__SIZE){
+		// DROP_OLDEST. Consumer may be copying that one, its CAS fails then.
+		if(atomic_compare_exchange_strong(&r->tail, &tail, tail + 1)){
+			JOY_RING__INC(r->dropped);
+		}
+	}
+	r->msgs[head & (JOY_RING__SIZE - 1)] = *msg;
+	// seq_cst store then load, pairs with joy_ring__pop(), so either the
+	// consumer sees this message or the producer sees it ran empty.
+	atomic_store(&r->head, head + 1);
+	tail = atomic_load(&r->tail);
+	uint32_t depth = head + 1 - tail;
+	if(depth > atomic_load_explicit(&r->max_depth, memory_order_relaxed)){
+		atomic_store_explicit(&r->max_depth, depth, memory_order_relaxed);
+	}
+	if(depth == 1){
+		joy_ring__wake(r);
+	}
+}
+
+/**
+ * Consumer side, ring first, then latest coalesced state.
+ * @return 1 if @a msg was taken, 0 if empty.
+ */
+static inline int joy_ring__pop(joy_ring_t* r, joy_msg_t* msg) {
+	while(1){
+		uint32_t tail = atomic_load(&r->tail);
+		if(tail == atomic_load(&r->head)){
+			break;
+		}
+		*msg = r->msgs[tail & (JOY_RING__SIZE - 1)];
+		// Fails if producer dropped it meanwhile, copy may be torn then.
+		if(atomic_compare_exchange_strong(&r->tail, &tail, tail + 1)){
+			JOY_RING__INC(r->popped);
+			return 1;
+		}
+	}
+	while(1){
+		uint32_t s = atomic_load_explicit(&r->latest_seq, memory_order_acquire);
+		if(s == atomic_load(&r->latest_taken)){
+			return 0;
+		}
+		if(s & 1){
+			continue; // Producer is in the middle of it.
+		}
+		*msg = r->latest;
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&r->latest_seq, memory_order_relaxed) == s){
+			atomic_store(&r->latest_taken, s);
+			JOY_RING__INC(r->popped);
+			return 1;
+		}
+	}
+}
+
+/**
+ * Consumer side, call before popping after a wakeup on efd.
+ */
+static inline void joy_ring__clear_wake(joy_ring_t* r) {
+	uint64_t n;
+	if(read(r->efd, &n, sizeof(n)) < 0){
+		// EAGAIN, woken for other reasons.
+	}
+}
+
+static inline uint32_t joy_ring__depth(joy_ring_t* r) {
+	return atomic_load(&r->head) - atomic_load(&r->tail) + joy_ring__latest_pending(r);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // JOY_RING_H
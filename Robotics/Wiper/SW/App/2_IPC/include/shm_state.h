@@ -0,0 +1,159 @@
+
+#ifndef SHM_STATE_H
+#define SHM_STATE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "joy_msg.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Latest joystick state in POSIX shared memory, for co-located nodes.
+//
+// Writer is single, joy_node. Readers take a consistent snapshot under a
+// seqlock and never block the writer. seq is odd while the writer is in the
+// middle of an update. It is also the futex word readers sleep on, and the
+// writer only issues FUTEX_WAKE if somebody actually sleeps.
+
+#define SHM_STATE__DEFAULT_NAME "/joy_state"
+#define SHM_STATE__MAGIC 0x4a53544d // "JSTM"
+// An update is a memcpy, so a seq still odd after that many tries means the
+// writer is preempted or died in the middle of one.
+#define SHM_STATE__READ_TRIES 1000
+// Odd, never seq of a snapshot.
+#define SHM_STATE__BUSY 1
+
+typedef struct {
+	uint32_t magic;
+	_Atomic uint32_t seq;
+	_Atomic uint32_t sleepers;
+	uint32_t _pad;
+	joy_msg_t msg;
+} shm_state_t;
+
+static inline int shm_state__futex(
+	_Atomic uint32_t* addr,
+	int op,
+	uint32_t val,
+	const struct timespec* timeout
+) {
+	// Not FUTEX_PRIVATE_FLAG, the word is shared between processes.
+	return syscall(SYS_futex, (uint32_t*)addr, op, val, timeout, NULL, 0);
+}
+
+/**
+ * Map state segment, create it if @a create.
+ * @return mapping or NULL with errno set.
+ */
+static inline shm_state_t* shm_state__open(const char* name, int create) {
+	int fd = shm_open(name, create ? O_RDWR | O_CREAT : O_RDWR, 0666);
+	if(fd < 0){
+		return NULL;
+	}
+	if(create && ftruncate(fd, sizeof(shm_state_t)) != 0){
+		close(fd);
+		return NULL;
+	}
+	void* p = mmap(
+		NULL,
+		sizeof(shm_state_t),
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED,
+		fd,
+		0
+	);
+	close(fd);
+	if(p == MAP_FAILED){
+		return NULL;
+	}
+	shm_state_t* shm = (shm_state_t*)p;
+	if(create){
+		shm->magic = SHM_STATE__MAGIC;
+	}else if(shm->magic != SHM_STATE__MAGIC){
+		munmap(p, sizeof(shm_state_t));
+		errno = EINVAL;
+		return NULL;
+	}
+	return shm;
+}
+
+static inline void shm_state__close(shm_state_t* shm) {
+	munmap(shm, sizeof(shm_state_t));
+}
+
+/**
+ * Writer side. A few stores, plus a syscall only when a reader sleeps.
+ */
+static inline void shm_state__publish(shm_state_t* shm, const joy_msg_t* msg) {
+	uint32_t s = atomic_load_explicit(&shm->seq, memory_order_relaxed);
+	atomic_store_explicit(&shm->seq, s + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&shm->msg, msg, sizeof(joy_msg_t));
+	atomic_store_explicit(&shm->seq, s + 2, memory_order_release);
+	// Pairs with sleepers increment in shm_state__wait(), no lost wakeups.
+	atomic_thread_fence(memory_order_seq_cst);
+	if(atomic_load_explicit(&shm->sleepers, memory_order_seq_cst)){
+		shm_state__futex(&shm->seq, FUTEX_WAKE, INT32_MAX, NULL);
+	}
+}
+
+/**
+ * Reader side, consistent snapshot of the state.
+ * @return seq of the snapshot, 0 if nothing was published yet,
+ * SHM_STATE__BUSY if there was no consistent snapshot within
+ * SHM_STATE__READ_TRIES tries, @a msg is garbage then.
+ */
+static inline uint32_t shm_state__read(const shm_state_t* shm, joy_msg_t* msg) {
+	shm_state_t* s = (shm_state_t*)shm;
+	for(int i = 0; i < SHM_STATE__READ_TRIES; i++){
+		uint32_t s0 = atomic_load_explicit(&s->seq, memory_order_acquire);
+		if(s0 & 1){
+			continue;
+		}
+		memcpy(msg, &s->msg, sizeof(joy_msg_t));
+		atomic_thread_fence(memory_order_acquire);
+		uint32_t s1 = atomic_load_explicit(&s->seq, memory_order_relaxed);
+		if(s0 == s1){
+			return s0;
+		}
+	}
+	return SHM_STATE__BUSY;
+}
+
+/**
+ * Sleep until seq differs from @a seen or @a timeout_ms passes (-1 forever).
+ * @return 1 if there is new state, 0 on timeout.
+ */
+static inline int shm_state__wait(shm_state_t* shm, uint32_t seen, int timeout_ms) {
+	struct timespec ts;
+	struct timespec* pts = NULL;
+	if(timeout_ms >= 0){
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		pts = &ts;
+	}
+	uint32_t s = atomic_load_explicit(&shm->seq, memory_order_acquire);
+	while(s == seen || (s & 1)){
+		atomic_fetch_add_explicit(&shm->sleepers, 1, memory_order_seq_cst);
+		int r = shm_state__futex(&shm->seq, FUTEX_WAIT, s, pts);
+		atomic_fetch_sub_explicit(&shm->sleepers, 1, memory_order_seq_cst);
+		if(r != 0 && errno == ETIMEDOUT){
+			return 0;
+		}
+		s = atomic_load_explicit(&shm->seq, memory_order_acquire);
+	}
+	return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // SHM_STATE_H
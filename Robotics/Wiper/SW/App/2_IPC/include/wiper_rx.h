@@ -0,0 +1,176 @@
+
+#ifndef WIPER_RX_H
+#define WIPER_RX_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <zmq.h>
+
+#include "joy_msg.h"
+#include "shm_state.h"
+#include "joy_cmd.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocation-free receive path of wiper_node.
+
+// Room for more than joy_frame_t, so that too long messages are recognized,
+// as zmq_recv() returns the untruncated size.
+#define WIPER_RX__SLOT_SIZE 96
+
+typedef struct {
+	// Double buffer: receive into back slot, flip it to front when valid.
+	union {
+		joy_frame_t frame;
+		joy_cmd_t cmd;
+		uint8_t raw[WIPER_RX__SLOT_SIZE];
+	} slot[2];
+	int front;
+	int valid; // Front slot holds a state.
+	joy_msg__seq_stats_t seq_stats;
+	uint32_t last_gap; // Messages lost right before current state.
+	uint64_t invalid;  // Ignored malformed messages.
+	uint64_t rx_time_ns; // CLOCK_REALTIME when current state was accepted.
+	// Latest command applied, of command channel.
+	int cmd_synced;
+	uint32_t cmd_session;
+	uint32_t cmd_id;
+} wiper_rx_t;
+
+/**
+ * @return current state, or NULL if nothing was received yet.
+ */
+static inline const joy_msg_t* wiper_rx__state(const wiper_rx_t* rx) {
+	return rx->valid ? &rx->slot[rx->front].frame.msg : NULL;
+}
+
+/**
+ * @param msg parsed from back slot, NULL if it was not valid.
+ */
+static inline int wiper_rx__accept(wiper_rx_t* rx, int back, const joy_msg_t* msg) {
+	if(msg == NULL){
+		rx->invalid++;
+		return 0;
+	}
+
+	rx->last_gap = joy_msg__seq_track(&rx->seq_stats, msg->seq);
+
+	rx->rx_time_ns = joy_msg__now_ns();
+
+	rx->front = back;
+	rx->valid = 1;
+	return 1;
+}
+
+/**
+ * Receive one message without blocking. ZeroMQ copies the payload once,
+ * straight into the back slot, and nothing is allocated here.
+ * @return 1 if state was updated, 0 if nothing was ready or message was
+ * ignored, -1 on error with errno set.
+ */
+static inline int wiper_rx__recv(wiper_rx_t* rx, void* socket) {
+	int back = !rx->front;
+	int bytes = zmq_recv(
+		socket,
+		rx->slot[back].raw,
+		WIPER_RX__SLOT_SIZE,
+		ZMQ_DONTWAIT
+	);
+	if(bytes < 0){
+		if(errno == EAGAIN || errno == EINTR){
+			return 0;
+		}
+		return -1;
+	}
+	if(bytes > WIPER_RX__SLOT_SIZE){
+		rx->invalid++;
+		return 0;
+	}
+	// Topic was matched by the subscription already.
+	return wiper_rx__accept(rx, back, joy_msg__parse_frame(rx->slot[back].raw, bytes));
+}
+
+/**
+ * Receive one command of joy_node, like wiper_rx__recv(). A command
+ * applied already, i.e. a retry, or one older than that is acked again
+ * but not applied.
+ * @param ack to be sent after applying a new state, or right away if
+ * nothing was updated; type is 0 if nothing is to be acked.
+ * @return 1 if state was updated, 0 if not, -1 on error with errno set.
+ */
+static inline int wiper_rx__recv_cmd(wiper_rx_t* rx, void* socket, joy_cmd_ack_t* ack) {
+	ack->type = 0;
+	int back = !rx->front;
+	int bytes = zmq_recv(
+		socket,
+		rx->slot[back].raw,
+		WIPER_RX__SLOT_SIZE,
+		ZMQ_DONTWAIT
+	);
+	if(bytes < 0){
+		if(errno == EAGAIN || errno == EINTR){
+			return 0;
+		}
+		return -1;
+	}
+	const joy_cmd_t* cmd = &rx->slot[back].cmd;
+	const joy_msg_t* msg = NULL;
+	if(bytes == sizeof(joy_cmd_t) && cmd->type == JOY_CMD__COMMAND){
+		msg = joy_msg__parse(&cmd->msg, sizeof(joy_msg_t));
+	}
+	if(msg == NULL){
+		rx->invalid++;
+		return 0;
+	}
+
+	memset(ack, 0, sizeof(*ack));
+	ack->type = JOY_CMD__ACK;
+	ack->status = JOY_CMD__APPLIED;
+	ack->attempt = cmd->attempt;
+	ack->session = cmd->session;
+	ack->id = cmd->id;
+	if(
+		rx->cmd_synced &&
+		cmd->session == rx->cmd_session &&
+		(int32_t)(cmd->id - rx->cmd_id) <= 0
+	){
+		if(cmd->id != rx->cmd_id){
+			ack->status = JOY_CMD__STALE;
+		}
+		ack->rx_time_ns = joy_msg__now_ns();
+		ack->apply_time_ns = ack->rx_time_ns;
+		return 0;
+	}
+	rx->cmd_synced = 1;
+	rx->cmd_session = cmd->session;
+	rx->cmd_id = cmd->id;
+	wiper_rx__accept(rx, back, msg);
+	ack->rx_time_ns = rx->rx_time_ns;
+	return 1;
+}
+
+/**
+ * Take the latest state from shared memory instead of from a socket.
+ * States published in between are skipped, and count as lost.
+ * @param seen seq of the last snapshot taken, updated.
+ * @return 1 if state was updated, 0 if it did not change or the writer
+ * is stuck in the middle of an update.
+ */
+static inline int wiper_rx__read_shm(
+	wiper_rx_t* rx,
+	const shm_state_t* shm,
+	uint32_t* seen
+) {
+	int back = !rx->front;
+	joy_msg_t* msg = &rx->slot[back].frame.msg;
+	uint32_t s = shm_state__read(shm, msg);
+	if(s == *seen || s == SHM_STATE__BUSY){
+		// Busy, the next wait ends on the next update or on timeout.
+		return 0;
+	}
+	*seen = s;
+	return wiper_rx__accept(rx, back, joy_msg__parse(msg, sizeof(*msg)));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // WIPER_RX_H
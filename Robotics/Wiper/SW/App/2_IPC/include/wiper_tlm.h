@@ -0,0 +1,244 @@
+
+#ifndef WIPER_TLM_H
+#define WIPER_TLM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zmq.h>
+
+#include "joy_msg.h"
+#include "../../../Common/include/lat_hist.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Telemetry published by wiper_node, the way back to the operator.
+//
+// A node collects what happened during a window, the motor state and limit
+// switch transitions with their time, plus a summary, and sends it all as
+// one message when the window ends, at a fixed rate. Nodes connect their
+// PUB socket to the monitor, which binds, so one monitor hears the whole
+// fleet and a node never waits for it: PUB drops a message that does not
+// fit into the send queue, and the monitor sees the gap by seq.
+
+#define WIPER_TLM__VERSION 1
+#define WIPER_TLM__TOPIC "tlm/" // Followed by node id.
+#define WIPER_TLM__MAX_EVENTS 32
+
+// wiper_tlm_msg_t.motor, what the last GPIO writes drive.
+enum {
+	WIPER_TLM__MOTOR_STOP, // EN = 0
+	WIPER_TLM__MOTOR_CCW,  // EN = 1, 3 = 1, 4 = 0
+	WIPER_TLM__MOTOR_CW,   // EN = 1, 3 = 0, 4 = 1
+	WIPER_TLM__MOTOR_COUNT
+};
+
+// wiper_tlm_msg_t.limit before the switch was read the first time.
+#define WIPER_TLM__LIMIT_UNKNOWN 0xff
+
+// wiper_tlm_event_t.kind
+enum {
+	WIPER_TLM__EV_MOTOR, // value: new WIPER_TLM__MOTOR_*.
+	WIPER_TLM__EV_LIMIT  // value: new level of the limit switch.
+};
+
+typedef struct __attribute__((packed)) {
+	uint32_t t_us; // Since start of window [us].
+	uint8_t kind;  // WIPER_TLM__EV_*.
+	uint8_t value;
+} wiper_tlm_event_t;
+
+_Static_assert(sizeof(wiper_tlm_event_t) == 6, "wiper_tlm_event_t layout changed");
+
+/**
+ * Fixed header, little-endian like joy_msg_t, followed by num_of_events
+ * events. Only the used events are sent, so a quiet node sends 68 bytes.
+ * Counters and times are of the window only, a monitor sums them up and
+ * sees lost windows by seq.
+ */
+typedef struct __attribute__((packed)) {
+	char topic[JOY_MSG__TOPIC_SIZE]; // WIPER_TLM__TOPIC + id, NUL padded.
+	uint8_t version;       // WIPER_TLM__VERSION.
+	uint8_t motor;         // At end of window, WIPER_TLM__MOTOR_*.
+	uint8_t limit;         // At end of window, or WIPER_TLM__LIMIT_UNKNOWN.
+	uint8_t num_of_events;
+	uint32_t seq;          // +1 per window.
+	uint64_t start_ns;     // CLOCK_REALTIME at start of window [ns].
+	uint32_t window_us;    // Length of window [us].
+	uint32_t motor_us[WIPER_TLM__MOTOR_COUNT]; // Time in each state [us].
+	uint16_t limit_rises;
+	uint16_t limit_falls;
+	uint16_t actuations;   // Motor state changes caused by commands.
+	uint16_t events_lost;  // Transitions that did not fit into events.
+	// Command to actuation: read of js_event in joy_node to the GPIO write
+	// which changed motor state. Needs synchronized clocks across hosts.
+	uint32_t latency_p50_us;
+	uint32_t latency_p99_us;
+	uint32_t latency_max_us;
+	wiper_tlm_event_t events[WIPER_TLM__MAX_EVENTS];
+} wiper_tlm_msg_t;
+
+#define WIPER_TLM__HEADER_SIZE offsetof(wiper_tlm_msg_t, events)
+
+_Static_assert(WIPER_TLM__HEADER_SIZE == 68, "wiper_tlm_msg_t layout changed");
+
+static inline size_t wiper_tlm__size(int num_of_events) {
+	return WIPER_TLM__HEADER_SIZE + num_of_events*sizeof(wiper_tlm_event_t);
+}
+
+/**
+ * Validate message in place, like joy_msg__parse().
+ * @return msg view of data, or NULL if it is not a valid message.
+ */
+static inline const wiper_tlm_msg_t* wiper_tlm__parse(const void* data, size_t size) {
+	const wiper_tlm_msg_t* msg = (const wiper_tlm_msg_t*)data;
+	if(size < WIPER_TLM__HEADER_SIZE){
+		return NULL;
+	}
+	if(msg->version != WIPER_TLM__VERSION){
+		return NULL;
+	}
+	if(
+		msg->num_of_events > WIPER_TLM__MAX_EVENTS ||
+		size != wiper_tlm__size(msg->num_of_events)
+	){
+		return NULL;
+	}
+	return msg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Node side. All times passed in are CLOCK_MONOTONIC [ns].
+
+typedef struct {
+	wiper_tlm_msg_t msg;
+	uint64_t start_ns;   // Start of window.
+	uint64_t entered_ns; // Current motor state entered, or start of window.
+	lat_hist_t latency;  // Of this window.
+	uint64_t sent;
+} wiper_tlm_t;
+
+static inline void wiper_tlm__start_window(wiper_tlm_t* t, uint64_t now_ns) {
+	wiper_tlm_msg_t* m = &t->msg;
+	m->num_of_events = 0;
+	m->start_ns = joy_msg__now_ns();
+	memset(m->motor_us, 0, sizeof(m->motor_us));
+	m->limit_rises = 0;
+	m->limit_falls = 0;
+	m->actuations = 0;
+	m->events_lost = 0;
+	t->start_ns = now_ns;
+	t->entered_ns = now_ns;
+	lat_hist__reset(&t->latency);
+}
+
+/**
+ * @return 0 if Ok, -1 if @a id is too long.
+ */
+static inline int wiper_tlm__init(wiper_tlm_t* t, const char* id, uint64_t now_ns) {
+	memset(t, 0, sizeof(*t));
+	if(joy_msg__topic(t->msg.topic, WIPER_TLM__TOPIC, id) != 0){
+		return -1;
+	}
+	t->msg.version = WIPER_TLM__VERSION;
+	t->msg.motor = WIPER_TLM__MOTOR_STOP;
+	t->msg.limit = WIPER_TLM__LIMIT_UNKNOWN;
+	wiper_tlm__start_window(t, now_ns);
+	return 0;
+}
+
+static inline uint32_t wiper_tlm__us(uint64_t ns) {
+	uint64_t us = ns/1000;
+	return us < UINT32_MAX ? us : UINT32_MAX;
+}
+
+static inline void wiper_tlm__event(
+	wiper_tlm_t* t,
+	uint8_t kind,
+	uint8_t value,
+	uint64_t now_ns
+) {
+	wiper_tlm_msg_t* m = &t->msg;
+	if(m->num_of_events == WIPER_TLM__MAX_EVENTS){
+		m->events_lost++;
+		return;
+	}
+	wiper_tlm_event_t* e = &m->events[m->num_of_events++];
+	e->t_us = wiper_tlm__us(now_ns - t->start_ns);
+	e->kind = kind;
+	e->value = value;
+}
+
+/**
+ * Motor is now driven to @a motor.
+ * @return 1 if that is a transition, 0 if not.
+ */
+static inline int wiper_tlm__motor(wiper_tlm_t* t, uint8_t motor, uint64_t now_ns) {
+	wiper_tlm_msg_t* m = &t->msg;
+	if(motor == m->motor){
+		return 0;
+	}
+	m->motor_us[m->motor] += wiper_tlm__us(now_ns - t->entered_ns);
+	t->entered_ns = now_ns;
+	m->motor = motor;
+	wiper_tlm__event(t, WIPER_TLM__EV_MOTOR, motor, now_ns);
+	return 1;
+}
+
+/**
+ * Command which caused a motor transition, read @a latency_ns before.
+ */
+static inline void wiper_tlm__actuation(wiper_tlm_t* t, uint64_t latency_ns) {
+	t->msg.actuations++;
+	if(latency_ns){
+		lat_hist__add(&t->latency, latency_ns);
+	}
+}
+
+/**
+ * Limit switch read at @a level. The first read is not an edge.
+ */
+static inline void wiper_tlm__limit(wiper_tlm_t* t, uint8_t level, uint64_t now_ns) {
+	wiper_tlm_msg_t* m = &t->msg;
+	level = level != 0;
+	if(level == m->limit){
+		return;
+	}
+	if(m->limit != WIPER_TLM__LIMIT_UNKNOWN){
+		if(level){
+			m->limit_rises++;
+		}else{
+			m->limit_falls++;
+		}
+		wiper_tlm__event(t, WIPER_TLM__EV_LIMIT, level, now_ns);
+	}
+	m->limit = level;
+}
+
+/**
+ * Close window, send it without blocking and start the next one.
+ * @return 0 if Ok, -1 on error with errno set.
+ */
+static inline int wiper_tlm__send(wiper_tlm_t* t, void* socket, uint64_t now_ns) {
+	wiper_tlm_msg_t* m = &t->msg;
+	m->motor_us[m->motor] += wiper_tlm__us(now_ns - t->entered_ns);
+	m->window_us = wiper_tlm__us(now_ns - t->start_ns);
+	m->latency_p50_us = wiper_tlm__us(lat_hist__percentile(&t->latency, 50));
+	m->latency_p99_us = wiper_tlm__us(lat_hist__percentile(&t->latency, 99));
+	m->latency_max_us = wiper_tlm__us(t->latency.max);
+
+	int r = 0;
+	if(zmq_send(socket, m, wiper_tlm__size(m->num_of_events), ZMQ_DONTWAIT) >= 0){
+		t->sent++;
+	}else if(errno != EAGAIN && errno != EINTR){
+		r = -1;
+	}
+
+	m->seq++;
+	wiper_tlm__start_window(t, now_ns);
+	return r;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // WIPER_TLM_H
@@ -1,6 +1,5 @@
 #include <linux/joystick.h>
 #include <sys/ioctl.h>
-#include <semaphore.h>
 #include <stdio.h>
 #include <zmq.h>
 #include <string.h>
@@ -9,174 +8,1031 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <pthread.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <dirent.h>
 #include "../../Driver/gpio_ctrl/include/gpio_ctrl.h"
 #include "../../Driver/gpio_ctrl/gpio.h"
+#include "include/joy_msg.h"
+#include "include/shm_state.h"
+#include "include/joy_ring.h"
+#include "include/joy_cmd.h"
+#include "include/component.h"
+#include "../../Common/include/trace_hist.h"
+#include "../../Common/include/rt_log.h"
+#include "../../Common/include/joy_input.h"
 
+// Default endpoint. For nodes on the same host, bind also e.g.
+// ipc:///tmp/joy_node.ipc, which skips the TCP loopback stack.
 #define ZMQ_ENDPOINT "tcp://0.0.0.0:5555"
+#define MAX_ENDPOINTS 4
+// Watched for joysticks coming and going. Or -j a FIFO fed by joy_replay.
+#define JS_DIR "/dev/input"
+#define JS_PREFIX "js"
+#define MAX_JOYS 4
 // #define DEV_STREAM_FN "/dev/gpio_stream"
 
 
-#define BUTTON_CW 0         // Button index for clockwise (increase angle)
-#define BUTTON_CCW 1        // Button index for counterclockwise (decrease angle)
+// Axis changes smaller than this (of 32767) are not published.
+#define DEFAULT_AXIS_DEADBAND 1000
+// Axis events coming faster than this are merged into the newest value.
+#define DEFAULT_AXIS_MAX_RATE 50 // [Hz]
 
-struct js_event js_event_data;
+// Command channel, see -a.
+#define DEFAULT_CMD_WINDOW 4
+#define DEFAULT_CMD_TIMEOUT_MS 50
+#define DEFAULT_CMD_RETRIES 3
 
-volatile uint8_t* volatile buttons;
-volatile int num_of_buttons = 0;
-pthread_mutex_t button_mtx = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t button_printf_mtx = PTHREAD_MUTEX_INITIALIZER;
-sem_t buttons_intitialized;
+// Merged state of all joysticks, as published.
+static uint8_t buttons[JOY_MSG__MAX_BUTTONS];
+static int num_of_buttons = 0;
+static int num_of_axes = 0;
+static int16_t axes[JOY_MSG__MAX_AXES];
+static uint32_t seq = 0; // Of states, as in shm
 
-void* js_reader(void* arg) {
-	void* publisher = arg;
-	int js_fd;
-	int num_of_axes = 0;
-	int num_of_buttons = 0;
+typedef struct {
+	char path[64];
+	joy_input_t* in; // NULL while unplugged
+	int num_of_buttons;
+	int num_of_axes;
+	uint8_t buttons[JOY_MSG__MAX_BUTTONS];
+	int16_t axes[JOY_MSG__MAX_AXES];
+} joy_dev_t;
 
-	// Open the joystick device file in read-only mode
-	js_fd = open("/dev/input/js0", O_RDONLY);
-	if (js_fd == -1) {
-		perror("Error opening joystick device");
-		return NULL;
-	}
+// How state of several joysticks becomes one.
+typedef enum {
+	MERGE__OR,   // Button pressed on any, axis furthest from center
+	MERGE__LAST, // Joystick with the latest event takes over
+} merge_policy_t;
+
+static joy_dev_t joys[MAX_JOYS];
+static int num_of_joys = 0;
+static int fixed_joys = 0; // Only those given by -j
+static joy_dev_t* active_joy = NULL;
+static merge_policy_t merge_policy = MERGE__OR;
+static int axis_deadband = DEFAULT_AXIS_DEADBAND;
+static int axis_max_rate = DEFAULT_AXIS_MAX_RATE; // 0 = axes ride on button changes only
+static int16_t published_axes[JOY_MSG__MAX_AXES];
+static int axes_pending = 0; // Axis moved past deadband since last publish
+static uint64_t last_pub_ns = 0; // CLOCK_MONOTONIC
+static shm_state_t* shm = NULL; // Same-host transport, if enabled
+// States from reader to sender thread, which owns the publisher socket.
+static joy_ring_t ring = { .efd = -1 };
+static joy_ring_policy_t overflow_policy = JOY_RING__COALESCE;
+static uint32_t pub_seq = 0; // Of sent messages
+// Sent states go to wiper nodes subscribed to its topic, see -t.
+static joy_frame_t frame;
+static _Atomic uint64_t send_errors = 0;
+// Same states as commands to wiper_node -a, if enabled. Sender thread only.
+static void* router = NULL;
+static joy_cmd_client_t cmd_client;
+static pthread_mutex_t button_mtx = PTHREAD_MUTEX_INITIALIZER;
+// Set up by joy_node__init(). Both threads run until joy_node__shutdown()
+// signals stop_fd, which stays readable, and return through their cleanup.
+static void* publisher = NULL;
+static int stop_fd = -1;
+
+// Stages of the pipeline that happen in joy_node. Each written by one
+// thread only, dumped by main on SIGUSR1.
+enum {
+    JOY_STAGE__DRIVER,  // js_event.time to read(), 1 ms resolution, reader
+    JOY_STAGE__PUBLISH, // read() to zmq_send() done, incl. axis coalescing
+                        // and queue to sender, sender
+    JOY_STAGE__ACK,     // First send of command to its ack, incl. retries
+                        // and GPIO writes in wiper_node, sender
+    JOY_STAGE__COUNT
+};
+static const char* const joy_stage_names[JOY_STAGE__COUNT] = {
+    "driver->read",
+    "read->publish",
+    "command->ack",
+};
+static trace_hist_t joy_stages[JOY_STAGE__COUNT];
+// Last js_event read, carried in the messages it causes.
+static uint32_t trace_id = 0;
+static uint64_t trace_read_ns = 0; // CLOCK_REALTIME
+static uint64_t trace_read_mono_ns = 0;
+static int32_t driver_offset_ms = 0;
+static int driver_synced = 0;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
 
-	ioctl(js_fd, JSIOCGAXES, &num_of_axes);
-	ioctl(js_fd, JSIOCGBUTTONS, &num_of_buttons);
+/**
+ * js_event.time is jiffies in ms, on another epoch than CLOCK_MONOTONIC.
+ * Lag is taken relative to the smallest offset seen, i.e. how much slower
+ * than at its best the path from driver to read() was.
+ */
+static void trace_driver(uint32_t js_time, uint64_t read_mono_ns) {
+    int32_t offset_ms = (int32_t)((uint32_t)(read_mono_ns / 1000000) - js_time);
+    if (!driver_synced || offset_ms < driver_offset_ms) {
+        driver_offset_ms = offset_ms;
+        driver_synced = 1;
+    }
+    trace_hist__add(
+        &joy_stages[JOY_STAGE__DRIVER],
+        (uint64_t)(offset_ms - driver_offset_ms) * 1000000
+    );
+}
 
-	//TODO Allocated buttons array
-	buttons = (volatile uint8_t*)malloc(num_of_buttons * sizeof(uint8_t));
-    if (buttons == NULL) {
-        perror("Memory allocation failed");
-        return NULL;
+/**
+ * Queue whole joystick state for the sender thread, never blocks.
+ * Call with button_mtx locked.
+ */
+static void publish_state(uint32_t js_time, uint8_t flags) {
+    joy_msg_t msg;
+    joy_msg__init(&msg, num_of_buttons, num_of_axes);
+    msg.flags = flags;
+    msg.seq = seq++;
+    msg.js_time = js_time;
+    msg.trace_id = trace_id;
+    msg.read_time_ns = trace_read_ns;
+    for (int i = 0; i < msg.num_of_buttons; i++) {
+        if (buttons[i]) {
+            msg.buttons |= 1u << i;
+        }
     }
-	// Initialize buttons to 0
-    for (int i = 0; i < num_of_buttons; i++) {
-        buttons[i] = 0;
+    memcpy(msg.axes, axes, sizeof(msg.axes));
+    memcpy(published_axes, axes, sizeof(published_axes));
+    axes_pending = 0;
+    last_pub_ns = monotonic_ns();
+    joy_ring__push(&ring, &msg);
+    if (shm) {
+        // Same host, nothing to stall on, straight from here.
+        msg.pub_time_ns = joy_msg__now_ns();
+        shm_state__publish(shm, &msg);
     }
-	printf("Joystick initialized with %d buttons\n", num_of_buttons);
+}
 
-	// Dynamically allocate buffer for number of buttons
-    int num_buf_size = snprintf(NULL, 0, "%d", num_of_buttons) + 1; // +1 for null terminator
-    char* num_buf = (char*)malloc(num_buf_size * sizeof(char));
-    if (num_buf == NULL) {
-        return NULL;
+/**
+ * Send one state, stamped with its own seq, as the ring may skip states.
+ */
+static void send_state(joy_msg_t* msg) {
+    msg->seq = pub_seq++;
+    RT_LOG__INFO("Sending button states: 0x%08x (seq %u)\n", msg->buttons, msg->seq);
+    msg->pub_time_ns = joy_msg__now_ns();
+    frame.msg = *msg;
+    if (zmq_send(publisher, &frame, sizeof(frame), 0) == -1) {
+        send_errors++;
+        RT_LOG__ERROR("Failed to send button states: %s\n", zmq_strerror(zmq_errno()));
+    } else if (!(msg->flags & JOY_MSG__FLAG_SNAPSHOT) && msg->read_time_ns) {
+        trace_hist__add(&joy_stages[JOY_STAGE__PUBLISH], joy_msg__now_ns() - msg->read_time_ns);
     }
-    snprintf(num_buf, num_buf_size, "%d", num_of_buttons);
-    if (zmq_send(publisher, num_buf, strlen(num_buf), 0) == -1) {
-        perror("Failed to send number of buttons");
+}
+
+/**
+ * @return ms until pending axes may be published, -1 if nothing pending.
+ */
+static int axes_timeout_ms(void) {
+    if (!axes_pending) {
+        return -1;
     }
-    free(num_buf); // Free the dynamic buffer after sending
+    uint64_t due_ns = last_pub_ns + 1000000000ULL / axis_max_rate;
+    uint64_t now_ns = monotonic_ns();
+    if (now_ns >= due_ns) {
+        return 0;
+    }
+    return (due_ns - now_ns + 999999) / 1000000;
+}
+
+/**
+ * The PUB side is an XPUB socket, which hands us every (re)subscription.
+ * Answer each to our topic with the full current state, so a late joiner
+ * or a reconnecting wiper_node is up to date one round-trip after
+ * connecting. Those to other topics are for other joy_nodes.
+ * @return 1 if a snapshot is needed.
+ */
+static int recv_subscriptions(void) {
+    int snapshot = 0;
+    uint8_t sub[256];
+    while (1) {
+        int n = zmq_recv(publisher, sub, sizeof(sub), ZMQ_DONTWAIT);
+        if (n < 0) {
+            break;
+        }
+        // First byte is 1 for subscribe, 0 for unsubscribe.
+        if (
+            n == 1 + JOY_MSG__TOPIC_SIZE && sub[0] == 1 &&
+            memcmp(sub + 1, frame.topic, JOY_MSG__TOPIC_SIZE) == 0
+        ) {
+            snapshot = 1;
+        }
+    }
+    return snapshot;
+}
+
+/**
+ * Merged value of button @a i over all attached joysticks.
+ */
+static uint8_t merge_button(int i) {
+	if (merge_policy == MERGE__LAST) {
+		return active_joy && active_joy->in ? active_joy->buttons[i] : 0;
+	}
+	for (int j = 0; j < num_of_joys; j++) {
+		if (joys[j].in && joys[j].buttons[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Merged value of axis @a i, the one furthest from center with MERGE__OR.
+ */
+static int16_t merge_axis(int i) {
+	if (merge_policy == MERGE__LAST) {
+		return active_joy && active_joy->in ? active_joy->axes[i] : 0;
+	}
+	int16_t v = 0;
+	for (int j = 0; j < num_of_joys; j++) {
+		if (joys[j].in && abs(joys[j].axes[i]) > abs(v)) {
+			v = joys[j].axes[i];
+		}
+	}
+	return v;
+}
+
+/**
+ * Set merged button, publishing first if it already changed since last
+ * publish, so wiper_node never misses an edge, e.g. of a short tap read
+ * late. Call with button_mtx locked.
+ */
+static void set_button(int i, uint8_t v, uint32_t js_time, uint64_t* changed) {
+	if (buttons[i] == v) {
+		return;
+	}
+	uint64_t bit = 1ULL << (i % 64);
+	if (*changed & bit) {
+		publish_state(js_time, 0);
+		*changed = 0;
+	}
+	buttons[i] = v;
+	*changed |= bit;
+}
+
+static void set_axis(int i, int16_t v) {
+	axes[i] = v;
+	if (axis_max_rate > 0 && abs(axes[i] - published_axes[i]) > axis_deadband) {
+		axes_pending = 1;
+	}
+}
+
+/**
+ * Recompute whole merged state, after a joystick came, went, or took over.
+ * Call with button_mtx locked.
+ */
+static void remerge(uint32_t js_time, uint64_t* changed) {
+	for (int i = 0; i < num_of_buttons; i++) {
+		set_button(i, merge_button(i), js_time, changed);
+	}
+	for (int i = 0; i < num_of_axes; i++) {
+		set_axis(i, merge_axis(i));
+	}
+}
+
+/**
+ * Apply one batch from joy_input__read() of @a joy and publish once for it.
+ * Call with button_mtx locked.
+ */
+static void apply_batch(joy_dev_t* joy, const struct js_event* evs, int n) {
+	uint64_t changed = 0; // Buttons changed since last publish
+	if (merge_policy == MERGE__LAST && active_joy != joy) {
+		active_joy = joy;
+		remerge(evs[0].time, &changed);
+	}
+	for (int e = 0; e < n; e++) {
+		const struct js_event* ev = &evs[e];
+		trace_driver(ev->time, trace_read_mono_ns);
+		if ((ev->type & JS_EVENT_BUTTON) && ev->number < joy->num_of_buttons) {
+			joy->buttons[ev->number] = ev->value != 0;
+			set_button(ev->number, merge_button(ev->number), ev->time, &changed);
+		} else if ((ev->type & JS_EVENT_AXIS) && ev->number < joy->num_of_axes) {
+			joy->axes[ev->number] = ev->value;
+			set_axis(ev->number, merge_axis(ev->number));
+		}
+	}
+	// Axes go now if rate allows, otherwise epoll times out when it does,
+	// with whatever is newest by then.
+	if (changed || (axes_pending && axes_timeout_ms() == 0)) {
+		publish_state(evs[n - 1].time, 0);
+	}
+}
+
+/**
+ * Open @a joy and add it to epoll. Quiet if the node is not there or not
+ * accessible yet, hotplug retries once udev is done with it.
+ * @return 0 if attached.
+ */
+static int attach_joy(int ep_fd, joy_dev_t* joy) {
+	joy_input_t* in = malloc(sizeof(*in)); // Big with evdev maps
+	if (in == NULL) {
+		perror("Memory allocation failed");
+		return -1;
+	}
+	if (joy_input__open(in, joy->path) != 0) {
+		if (errno != ENOENT && errno != EACCES) {
+			RT_LOG__WARN("Error opening %s: %s\n", joy->path, strerror(errno));
+		}
+		free(in);
+		return -1;
+	}
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = joy };
+	if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, in->fd, &ev) != 0) {
+		RT_LOG__ERROR("Failed to add %s to epoll: %s\n", joy->path, strerror(errno));
+		joy_input__close(in);
+		free(in);
+		return -1;
+	}
+	joy->in = in;
+	joy->num_of_buttons = in->num_of_buttons;
+	joy->num_of_axes = in->num_of_axes;
+	if (!in->evdev && joy->num_of_buttons == 0 && joy->num_of_axes == 0) {
+		// Not a joystick, e.g. a FIFO of joy_replay. Take all that fits.
+		RT_LOG__INFO("%s is not a joystick, assuming raw js_event stream\n", joy->path);
+		joy->num_of_buttons = JOY_MSG__MAX_BUTTONS;
+		joy->num_of_axes = JOY_MSG__MAX_AXES;
+	}
+	if (joy->num_of_buttons > JOY_MSG__MAX_BUTTONS) {
+		RT_LOG__INFO("Only first %d buttons are published\n", JOY_MSG__MAX_BUTTONS);
+		joy->num_of_buttons = JOY_MSG__MAX_BUTTONS;
+	}
+	if (joy->num_of_axes > JOY_MSG__MAX_AXES) {
+		joy->num_of_axes = JOY_MSG__MAX_AXES;
+	}
+	memset(joy->buttons, 0, sizeof(joy->buttons));
+	memset(joy->axes, 0, sizeof(joy->axes));
+	// Published counts only grow, so a replug does not shrink messages.
+	if (joy->num_of_buttons > num_of_buttons) {
+		num_of_buttons = joy->num_of_buttons;
+	}
+	if (joy->num_of_axes > num_of_axes) {
+		num_of_axes = joy->num_of_axes;
+	}
+	RT_LOG__INFO("Joystick %s attached, %d buttons, %d axes%s\n",
+		joy->path, joy->num_of_buttons, joy->num_of_axes, in->evdev ? " (evdev)" : "");
+	return 0;
+}
 
-	sem_post(&buttons_intitialized);
+/**
+ * Close @a joy, its buttons count as released. Slot stays for a replug.
+ * Call with button_mtx locked.
+ */
+static void detach_joy(joy_dev_t* joy, uint32_t js_time) {
+	if (!joy->in) {
+		return;
+	}
+	// Closing removes it from epoll too.
+	joy_input__close(joy->in);
+	free(joy->in);
+	joy->in = NULL;
+	RT_LOG__WARN("Joystick %s detached\n", joy->path);
+	// Unplug is an input of its own for the trace.
+	trace_read_mono_ns = monotonic_ns();
+	trace_read_ns = joy_msg__now_ns();
+	trace_id++;
+	uint64_t changed = 0;
+	remerge(js_time, &changed);
+	if (changed || axes_pending) {
+		publish_state(js_time, 0);
+	}
+}
+
+/**
+ * Slot for /dev/input/@a name, new one if it is a joystick not seen yet.
+ * @return NULL if not ours.
+ */
+static joy_dev_t* find_joy(const char* name) {
+	char path[sizeof(joys[0].path)];
+	snprintf(path, sizeof(path), "%s/%s", JS_DIR, name);
+	for (int j = 0; j < num_of_joys; j++) {
+		if (strcmp(joys[j].path, path) == 0) {
+			return &joys[j];
+		}
+	}
+	if (fixed_joys || strncmp(name, JS_PREFIX, strlen(JS_PREFIX)) != 0) {
+		return NULL;
+	}
+	if (num_of_joys == MAX_JOYS) {
+		RT_LOG__WARN("At most %d joysticks, ignoring %s\n", MAX_JOYS, path);
+		return NULL;
+	}
+	joy_dev_t* joy = &joys[num_of_joys++];
+	strcpy(joy->path, path);
+	return joy;
+}
+
+/**
+ * Attach and detach joysticks on inotify events of /dev/input.
+ * Call with button_mtx locked.
+ */
+static void handle_hotplug(int ep_fd, int in_fd, uint32_t js_time) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(in_fd, buf, sizeof(buf))) > 0) {
+		for (char* p = buf; p < buf + len; ) {
+			struct inotify_event* ie = (struct inotify_event*)p;
+			p += sizeof(*ie) + ie->len;
+			if (ie->len == 0) {
+				continue;
+			}
+			joy_dev_t* joy = find_joy(ie->name);
+			if (!joy) {
+				continue;
+			}
+			if (ie->mask & IN_DELETE) {
+				detach_joy(joy, js_time);
+			} else if (!joy->in) {
+				// IN_CREATE, or IN_ATTRIB once udev set permissions.
+				attach_joy(ep_fd, joy);
+			}
+		}
+	}
+}
+
+static void* js_reader(void* arg) {
+	(void)arg;
+	int ep_fd = -1;
+	int in_fd = -1;
+	static struct js_event evs[JOY_INPUT__MAX_EVENTS];
+
+	// Sleep until next event of any joystick, hotplug, or until coalesced
+	// axes are due, all in this one thread. Never on the network, states
+	// go to the sender thread through the ring.
+	ep_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (ep_fd < 0) {
+		perror("Failed to create epoll");
+		return NULL;
+	}
+	struct epoll_event ev = { .events = EPOLLIN };
+	ev.data.ptr = &stop_fd;
+	if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, stop_fd, &ev) != 0) {
+		perror("Failed to add stop to epoll");
+		goto exit;
+	}
+
+	// Watch before scanning, not to miss a joystick plugged in between.
+	in_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (
+		in_fd < 0 ||
+		inotify_add_watch(in_fd, JS_DIR, IN_CREATE | IN_ATTRIB | IN_DELETE) < 0
+	) {
+		perror("No hotplug, failed to watch " JS_DIR);
+		if (in_fd >= 0) {
+			close(in_fd);
+			in_fd = -1;
+		}
+	} else {
+		ev.data.ptr = &in_fd;
+		if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, in_fd, &ev) != 0) {
+			perror("Failed to add inotify to epoll");
+			goto exit;
+		}
+	}
+
+	rt_log__thread_init();
+
+	pthread_mutex_lock(&button_mtx);
+	if (!fixed_joys) {
+		DIR* dir = opendir(JS_DIR);
+		struct dirent* de;
+		while (dir && (de = readdir(dir)) != NULL) {
+			find_joy(de->d_name);
+		}
+		if (dir) {
+			closedir(dir);
+		}
+	}
+	int attached = 0;
+	for (int j = 0; j < num_of_joys; j++) {
+		attached += attach_joy(ep_fd, &joys[j]) == 0;
+	}
+	// Subscribers get a state even before any event.
+	publish_state(0, 0);
+	pthread_mutex_unlock(&button_mtx);
+	if (!attached) {
+		printf("Waiting for a joystick in %s\n", JS_DIR);
+	}
+
+	uint32_t last_js_time = 0;
+	int running = 1;
+	while (running) {
+		struct epoll_event ready[MAX_JOYS + 3];
+		int n = epoll_wait(ep_fd, ready, MAX_JOYS + 3, axes_timeout_ms());
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Error polling joystick device");
+			break;
+		}
+
+		pthread_mutex_lock(&button_mtx);
+		for (int i = 0; i < n; i++) {
+			if (ready[i].data.ptr == &in_fd) {
+				handle_hotplug(ep_fd, in_fd, last_js_time);
+			} else if (ready[i].data.ptr == &stop_fd) {
+				running = 0;
+			}
+		}
+		for (int i = 0; i < n; i++) {
+			joy_dev_t* joy = ready[i].data.ptr;
+			if (
+				ready[i].data.ptr == &in_fd ||
+				ready[i].data.ptr == &stop_fd ||
+				!joy->in
+			) {
+				continue;
+			}
+			// Whatever is queued, one read() per batch.
+			int r;
+			while ((r = joy_input__read(joy->in, evs)) > 0) {
+				trace_read_mono_ns = monotonic_ns();
+				trace_read_ns = joy_msg__now_ns();
+				trace_id++;
+				last_js_time = evs[r - 1].time;
+				apply_batch(joy, evs, r);
+			}
+			if (r < 0) {
+				if (errno != ENODEV) {
+					RT_LOG__ERROR("Error reading %s: %s\n", joy->path, strerror(errno));
+				}
+				// Unplugged, or end of FIFO. Hotplug brings it back.
+				detach_joy(joy, last_js_time);
+			}
+		}
+		if (axes_pending && axes_timeout_ms() == 0) {
+			publish_state(last_js_time, 0);
+		}
+		pthread_mutex_unlock(&button_mtx);
+	}
+
+exit:
+	for (int j = 0; j < num_of_joys; j++) {
+		if (joys[j].in) {
+			joy_input__close(joys[j].in);
+			free(joys[j].in);
+			joys[j].in = NULL;
+		}
+	}
+	if (in_fd >= 0) {
+		close(in_fd);
+	}
+	close(ep_fd);
+	return NULL;
+}
+
+/**
+ * Take hellos and acks, whatever the sends in between left pending.
+ */
+static void recv_commands(const joy_msg_t* last) {
+	if (joy_cmd__recv(
+		&cmd_client,
+		router,
+		last,
+		&joy_stages[JOY_STAGE__ACK],
+		monotonic_ns()
+	) != 0) {
+		RT_LOG__ERROR("Failed to receive acks: %s\n", zmq_strerror(zmq_errno()));
+	}
+}
+
+static void* js_sender(void* arg) {
+	(void)arg;
+	int ep_fd = -1;
+	// Last state sent, answer to new subscriptions.
+	joy_msg_t last;
+	joy_msg__init(&last, 0, 0);
+
+	// Sleep until the reader queued a state, or a subscription came. ZMQ_FD
+	// is edge triggered, so subscriptions are drained on every wakeup and
+	// after each send. Publisher socket is used only from this thread.
+	int zmq_fd;
+	size_t zmq_fd_size = sizeof(zmq_fd);
+	ep_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (ep_fd < 0 || zmq_getsockopt(publisher, ZMQ_FD, &zmq_fd, &zmq_fd_size) != 0) {
+		perror("Failed to set up epoll");
+		goto exit;
+	}
+	struct epoll_event ev = { .events = EPOLLIN };
+	ev.data.fd = zmq_fd;
+	if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, zmq_fd, &ev) != 0) {
+		perror("Failed to add publisher to epoll");
+		goto exit;
+	}
+	ev.data.fd = ring.efd;
+	if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, ring.efd, &ev) != 0) {
+		perror("Failed to add ring to epoll");
+		goto exit;
+	}
+	ev.data.fd = stop_fd;
+	if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, stop_fd, &ev) != 0) {
+		perror("Failed to add stop to epoll");
+		goto exit;
+	}
+	// Hellos and acks of wiper nodes, same edge triggered ZMQ_FD.
+	if (router) {
+		if (zmq_getsockopt(router, ZMQ_FD, &zmq_fd, &zmq_fd_size) != 0) {
+			perror("Failed to get ZMQ_FD of command socket");
+			goto exit;
+		}
+		ev.data.fd = zmq_fd;
+		if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, zmq_fd, &ev) != 0) {
+			perror("Failed to add command socket to epoll");
+			goto exit;
+		}
+	}
+
+	rt_log__thread_init();
 
 	while (1) {
-		if (read(js_fd, &js_event_data, sizeof(struct js_event)) != sizeof(struct js_event)) {
-			perror("Error reading joystick event");
+		struct epoll_event ready[4];
+		// Until the next retry or node timeout, if commands are on.
+		int timeout = router ? joy_cmd__ms_to_next(&cmd_client, monotonic_ns()) : -1;
+		int n = epoll_wait(ep_fd, ready, 4, timeout);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("Error polling publisher");
+			break;
+		}
+		int stop = 0;
+		for (int i = 0; i < n; i++) {
+			stop |= ready[i].data.fd == stop_fd;
+		}
+		if (stop) {
 			break;
 		}
+		joy_ring__clear_wake(&ring);
+		int snapshot = recv_subscriptions();
+		if (router) {
+			recv_commands(&last);
+		}
+		while (joy_ring__pop(&ring, &last)) {
+			send_state(&last);
+			if (router) {
+				joy_cmd__submit(&cmd_client, router, &last, monotonic_ns());
+			}
+			// Sends may have consumed the edge of a pending subscription.
+			snapshot |= recv_subscriptions();
+		}
+		if (router) {
+			joy_cmd__expire(&cmd_client, router, monotonic_ns());
+			recv_commands(&last);
+		}
+		if (snapshot) {
+			joy_msg_t msg = last;
+			msg.flags |= JOY_MSG__FLAG_SNAPSHOT;
+			send_state(&msg);
+			recv_subscriptions();
+		}
+	}
 
-		if (js_event_data.type & JS_EVENT_BUTTON) {
-            pthread_mutex_lock(&button_mtx);
-			if (buttons[js_event_data.number] != js_event_data.value) {
-                buttons[js_event_data.number] = js_event_data.value;
-                // Create string of button states
-                char state_buf[2 * num_of_buttons + 1]; // "0" or "1" per button + null terminator
-                for (int i = 0; i < num_of_buttons; i++) {
-                    state_buf[i] = buttons[i] ? '1' : '0';
-                }
-                state_buf[num_of_buttons] = '\0';
-                printf("Sending button states: %s\n", state_buf);
-                if (zmq_send(publisher, state_buf, num_of_buttons, 0) == -1) {
-                    perror("Failed to send button states");
-                }
-            }
-            pthread_mutex_unlock(&button_mtx);
-         } 
-		// else if (js_event_data.type & JS_EVENT_AXIS) {
-		//  	printf("Axis %d moved (value: %d)\n",
-		//  		js_event_data.number,
-		//  		js_event_data.value
-		// 	);
-	    // }
-	}
-
-	close(js_fd);
+exit:
+	if (ep_fd >= 0) {
+		close(ep_fd);
+	}
 	return NULL;
 }
 
-int main() {
-    // Initialize ZeroMQ context and PUSH socket
-    void* context = zmq_ctx_new(); 
-    if (!context) {
-        perror("Failed to create ZeroMQ context");
-        return EXIT_FAILURE;
-    }
-    void* publisher = zmq_socket(context, ZMQ_PUB);
-    if (!publisher) {
-        perror("Failed to create ZeroMQ PUB socket");
-        zmq_ctx_destroy(context);
-        return EXIT_FAILURE;
+static void print_stats(FILE* f) {
+	fprintf(f,
+		"queue: pushed %llu sent %llu dropped %llu coalesced %llu"
+		" depth %u max %u send errors %llu\n",
+		(unsigned long long)atomic_load(&ring.pushed),
+		(unsigned long long)atomic_load(&ring.popped),
+		(unsigned long long)atomic_load(&ring.dropped),
+		(unsigned long long)atomic_load(&ring.coalesced),
+		joy_ring__depth(&ring),
+		atomic_load(&ring.max_depth),
+		(unsigned long long)atomic_load(&send_errors)
+	);
+	if (router) {
+		fprintf(f,
+			"commands: nodes %d sent %llu acked %llu stale %llu retries %llu"
+			" lost %llu coalesced %llu send errors %llu\n",
+			atomic_load(&cmd_client.nodes),
+			(unsigned long long)atomic_load(&cmd_client.sent),
+			(unsigned long long)atomic_load(&cmd_client.acked),
+			(unsigned long long)atomic_load(&cmd_client.stale),
+			(unsigned long long)atomic_load(&cmd_client.retries),
+			(unsigned long long)atomic_load(&cmd_client.lost),
+			(unsigned long long)atomic_load(&cmd_client.coalesced),
+			(unsigned long long)atomic_load(&cmd_client.send_errors)
+		);
+	}
+	trace_hist__print(f, joy_stage_names, joy_stages, JOY_STAGE__COUNT);
+}
+
+/**
+ * Release whatever joy_node__init() set up.
+ */
+static void cleanup(void) {
+    rt_log__stop();
+    joy_ring__close(&ring);
+    if (router) {
+        zmq_close(router);
+        router = NULL;
     }
-    if (zmq_bind(publisher, ZMQ_ENDPOINT) != 0) {
-        perror("Failed to bind ZeroMQ PUB socket");
+    if (publisher) {
         zmq_close(publisher);
-        zmq_ctx_destroy(context);
-        return EXIT_FAILURE;
+        publisher = NULL;
+    }
+    if (shm) {
+        shm_state__close(shm);
+        shm = NULL;
     }
+    if (stop_fd >= 0) {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+}
 
-    sem_init(&buttons_intitialized, 0, 0);
+static void usage(FILE* f) {
+    fprintf(f,
+"\nUsage: "\
+"\n	joy_node [-e <endpoint>]... [-s <shm_name>] [-d <deadband>] [-r <max_rate>]"\
+"\n		[-j <device>]... [-m or|last] [-o coalesce|drop] [-t <topic>]"\
+"\n		[-a <endpoint> [-w <window>] [-k <ms>] [-x <retries>]]"\
+"\n	-e	endpoint to bind, tcp://, ipc:// or inproc://, can be repeated"\
+"\n		(default %s)"\
+"\n	-s	also publish to shared memory, for wiper_node on same host"\
+"\n		(e.g. %s)"\
+"\n	-d	axis deadband, of 32767 (default %d)"\
+"\n	-r	max axis publish rate in Hz, 0 to not stream axes (default %d)"\
+"\n	-j	joystick device, evdev device, or FIFO of joy_replay, can be"\
+"\n		repeated (default any %s/%s*, attached as they come and go)"\
+"\n	-m	merge of several joysticks: or - button pressed on any, axis"\
+"\n		furthest from center, last - the one moved last (default or)"\
+"\n	-o	when %d states wait for the network: coalesce - keep only the"\
+"\n		latest of further ones, drop - drop the oldest (default coalesce)"\
+"\n	-t	wiper nodes to control: %s - all, %s<group> - those of wiper_node"\
+"\n		-g <group>, %s<id> - the one of wiper_node -n <id> (default %s)"\
+"\n	-a	also bind command endpoint, for wiper_node -a: each state is a"\
+"\n		command with an id, acked once applied to the GPIO"\
+"\n	-w	commands in flight per node, without waiting for acks (default %d)"\
+"\n	-k	ack timeout, newest command is sent again then (default %d ms)"\
+"\n	-x	retries before a command is given up (default %d)"\
+"\n"\
+"\nSend SIGUSR1 to print queue and command counters and per-stage latency.\n",
+        ZMQ_ENDPOINT,
+        SHM_STATE__DEFAULT_NAME,
+        DEFAULT_AXIS_DEADBAND,
+        DEFAULT_AXIS_MAX_RATE,
+        JS_DIR,
+        JS_PREFIX,
+        JOY_RING__SIZE,
+        JOY_MSG__TOPIC_ALL,
+        JOY_MSG__TOPIC_GROUP,
+        JOY_MSG__TOPIC_NODE,
+        JOY_MSG__TOPIC_ALL,
+        DEFAULT_CMD_WINDOW,
+        DEFAULT_CMD_TIMEOUT_MS,
+        DEFAULT_CMD_RETRIES
+    );
+}
 
-    pthread_t reader;
-    if (pthread_create(&reader, NULL, js_reader, publisher) != 0) {
-        perror("Failed to create reader thread");
-        zmq_close(publisher);
-        zmq_ctx_destroy(context);
-        sem_destroy(&buttons_intitialized);
-        return EXIT_FAILURE;
+static int joy_node__init(int argc, char** argv, void* context) {
+    const char* endpoints[MAX_ENDPOINTS];
+    int num_of_endpoints = 0;
+    const char* shm_name = NULL;
+    const char* cmd_endpoint = NULL;
+    int cmd_window = DEFAULT_CMD_WINDOW;
+    int cmd_timeout_ms = DEFAULT_CMD_TIMEOUT_MS;
+    int cmd_retries = DEFAULT_CMD_RETRIES;
+    joy_msg__topic(frame.topic, JOY_MSG__TOPIC_ALL, "");
+    int opt;
+    while ((opt = getopt(argc, argv, "e:s:d:r:j:m:o:t:a:w:k:x:h")) != -1) {
+        switch (opt) {
+            case 'e':
+                if (num_of_endpoints == MAX_ENDPOINTS) {
+                    fprintf(stderr, "ERROR: At most %d endpoints!\n", MAX_ENDPOINTS);
+                    return -1;
+                }
+                endpoints[num_of_endpoints++] = optarg;
+                break;
+            case 's':
+                shm_name = optarg;
+                break;
+            case 'd':
+                axis_deadband = atoi(optarg);
+                break;
+            case 'r':
+                axis_max_rate = atoi(optarg);
+                break;
+            case 'j':
+                if (num_of_joys == MAX_JOYS) {
+                    fprintf(stderr, "ERROR: At most %d joysticks!\n", MAX_JOYS);
+                    return -1;
+                }
+                if (strlen(optarg) >= sizeof(joys[0].path)) {
+                    fprintf(stderr, "ERROR: Too long path \"%s\"!\n", optarg);
+                    return -1;
+                }
+                strcpy(joys[num_of_joys++].path, optarg);
+                fixed_joys = 1;
+                break;
+            case 'm':
+                if (strcmp(optarg, "or") == 0) {
+                    merge_policy = MERGE__OR;
+                } else if (strcmp(optarg, "last") == 0) {
+                    merge_policy = MERGE__LAST;
+                } else {
+                    fprintf(stderr, "ERROR: Unknown merge \"%s\"!\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'o':
+                if (strcmp(optarg, "coalesce") == 0) {
+                    overflow_policy = JOY_RING__COALESCE;
+                } else if (strcmp(optarg, "drop") == 0) {
+                    overflow_policy = JOY_RING__DROP_OLDEST;
+                } else {
+                    fprintf(stderr, "ERROR: Unknown overflow policy \"%s\"!\n", optarg);
+                    return -1;
+                }
+                break;
+            case 't':
+                if (joy_msg__topic(frame.topic, optarg, "") != 0) {
+                    fprintf(stderr, "ERROR: Too long topic \"%s\"!\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'a':
+                cmd_endpoint = optarg;
+                break;
+            case 'w':
+                cmd_window = atoi(optarg);
+                break;
+            case 'k':
+                cmd_timeout_ms = atoi(optarg);
+                break;
+            case 'x':
+                cmd_retries = atoi(optarg);
+                break;
+            case 'h':
+                usage(stdout);
+                return 1;
+            default:
+                usage(stderr);
+                return -1;
+        }
+    }
+    if (axis_deadband < 0 || axis_max_rate < 0) {
+        fprintf(stderr, "ERROR: deadband and rate must not be negative!\n");
+        return -1;
+    }
+    if (
+        cmd_window < 1 || cmd_window > JOY_CMD__MAX_WINDOW ||
+        cmd_timeout_ms < 1 || cmd_retries < 0 || cmd_retries > UINT8_MAX
+    ) {
+        fprintf(stderr, "ERROR: Window must be 1 to %d, timeout positive!\n", JOY_CMD__MAX_WINDOW);
+        return -1;
+    }
+    if (num_of_endpoints == 0) {
+        endpoints[num_of_endpoints++] = ZMQ_ENDPOINT;
     }
 
-    sem_wait(&buttons_intitialized);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd < 0) {
+        perror("Failed to create stop eventfd");
+        goto fail;
+    }
 
-    uint8_t* prev_buttons = (uint8_t*)malloc(num_of_buttons * sizeof(uint8_t));
-    if (prev_buttons == NULL) {
-        perror("Memory allocation failed for prev_buttons");
-        zmq_close(publisher);
-        zmq_ctx_destroy(context);
-        sem_destroy(&buttons_intitialized);
-        return EXIT_FAILURE;
+    if (shm_name) {
+        shm = shm_state__open(shm_name, 1);
+        if (!shm) {
+            perror("Failed to open shared memory state");
+            goto fail;
+        }
+        printf("Publishing on shm %s\n", shm_name);
     }
 
-    // Initialize prev_buttons to 0
-    for (int i = 0; i < num_of_buttons; i++) {
-        prev_buttons[i] = 0;
+    publisher = zmq_socket(context, ZMQ_XPUB);
+    if (!publisher) {
+        perror("Failed to create ZeroMQ PUB socket");
+        goto fail;
+    }
+    // Pass duplicate subscriptions too, every one of them gets a snapshot.
+    int verbose = 1;
+    if (zmq_setsockopt(publisher, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose)) != 0) {
+        perror("Failed to set ZMQ_XPUB_VERBOSE");
+        goto fail;
+    }
+    for (int i = 0; i < num_of_endpoints; i++) {
+        if (zmq_bind(publisher, endpoints[i]) != 0) {
+            fprintf(stderr, "Failed to bind ZeroMQ PUB socket to %s: %s\n",
+                    endpoints[i], zmq_strerror(zmq_errno()));
+            goto fail;
+        }
+        printf("Publishing %s on %s\n", frame.topic, endpoints[i]);
     }
 
-    volatile int running = 1;
-    while (running) {
-        pthread_mutex_lock(&button_mtx);
-        for (int i = 0; i < num_of_buttons; i++) {
-            if (buttons && buttons[i] != prev_buttons[i]) {
-                prev_buttons[i] = buttons[i];
-            }
+    if (cmd_endpoint) {
+        router = zmq_socket(context, ZMQ_ROUTER);
+        // Sends to a node which went away fail instead of being dropped, and
+        // a node reconnecting under its id takes over the old connection.
+        int on = 1;
+        if (
+            !router ||
+            zmq_setsockopt(router, ZMQ_ROUTER_MANDATORY, &on, sizeof(on)) != 0 ||
+            zmq_setsockopt(router, ZMQ_ROUTER_HANDOVER, &on, sizeof(on)) != 0 ||
+            zmq_bind(router, cmd_endpoint) != 0
+        ) {
+            fprintf(stderr, "Failed to bind ZeroMQ ROUTER socket to %s: %s\n",
+                    cmd_endpoint, zmq_strerror(zmq_errno()));
+            goto fail;
         }
-        pthread_mutex_unlock(&button_mtx);
-        usleep(10000);
+        // Ids of an earlier run are not taken for acks of this one.
+        joy_cmd__init(
+            &cmd_client,
+            frame.topic,
+            (uint32_t)(joy_msg__now_ns()/1000),
+            cmd_window,
+            cmd_timeout_ms,
+            cmd_retries
+        );
+        printf(
+            "Commands %s on %s, window %d, timeout %d ms, %d retries\n",
+            frame.topic, cmd_endpoint, cmd_window, cmd_timeout_ms, cmd_retries
+        );
     }
 
-    // Cleanup
-    pthread_join(reader, NULL);
-    if (buttons != NULL) {
-        free((void*)buttons);
-        buttons = NULL;
+    for (int i = 0; i < JOY_STAGE__COUNT; i++) {
+        trace_hist__reset(&joy_stages[i]);
     }
-    if (prev_buttons != NULL) {
-        free(prev_buttons);
-        prev_buttons = NULL;
+
+    int e = rt_log__start(stdout);
+    if (e != 0) {
+        fprintf(stderr, "Failed to start logger: %s\n", strerror(e));
+        goto fail;
     }
-    zmq_close(publisher);
-    zmq_ctx_destroy(context);
-    sem_destroy(&buttons_intitialized);
-    pthread_mutex_destroy(&button_mtx);
 
+    if (joy_ring__init(&ring, overflow_policy) != 0) {
+        perror("Failed to create queue");
+        goto fail;
+    }
     return 0;
-}
\ No newline at end of file
+
+fail:
+    cleanup();
+    return -1;
+}
+
+static void joy_node__shutdown(void) {
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) < 0) {
+        // Counter full, already stopping.
+    }
+}
+
+static int joy_node__run(void) {
+    int r = EXIT_FAILURE;
+    pthread_t sender;
+    if (pthread_create(&sender, NULL, js_sender, NULL) != 0) {
+        perror("Failed to create sender thread");
+        goto exit;
+    }
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, js_reader, NULL) != 0) {
+        perror("Failed to create reader thread");
+        joy_node__shutdown();
+        pthread_join(sender, NULL);
+        goto exit;
+    }
+
+    // Both wake up on stop_fd in their epoll_wait() and clean up after
+    // themselves, so the sockets are idle once they are joined.
+    pthread_join(reader, NULL);
+    pthread_join(sender, NULL);
+    print_stats(stdout);
+    r = EXIT_SUCCESS;
+
+exit:
+    cleanup();
+    return r;
+}
+
+static void joy_node__print_stats(void) {
+    print_stats(stdout);
+}
+
+const component_t joy_node__component = {
+    .name = "joy_node",
+    .init = joy_node__init,
+    .run = joy_node__run,
+    .shutdown = joy_node__shutdown,
+    .print_stats = joy_node__print_stats,
+};
+
+#ifndef COMPONENT__NO_MAIN
+int main(int argc, char** argv) {
+    return component__main(&joy_node__component, argc, argv);
+}
+#endif
@@ -0,0 +1,130 @@
+#include <linux/joystick.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include "include/joy_rec.h"
+
+// Records raw joystick events to a file, for joy_replay.
+
+#define JS_DEV_FN "/dev/input/js0"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void usage(FILE* f) {
+    fprintf(f,
+"\nUsage: "\
+"\n	joy_rec [-j <device>] <file>"\
+"\n	-j	joystick device (default %s)"\
+"\n"\
+"\nRecords until SIGINT/SIGTERM.\n",
+        JS_DEV_FN
+    );
+}
+
+int main(int argc, char** argv) {
+    const char* js_path = JS_DEV_FN;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:h")) != -1) {
+        switch (opt) {
+            case 'j':
+                js_path = optarg;
+                break;
+            case 'h':
+                usage(stdout);
+                return 0;
+            default:
+                usage(stderr);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(stderr);
+        return EXIT_FAILURE;
+    }
+    const char* rec_path = argv[optind];
+
+    int r = EXIT_FAILURE;
+    int js_fd = -1;
+    FILE* rec = NULL;
+    unsigned long long num_of_events = 0;
+
+    // No SA_RESTART, so a blocked read() returns on signal.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    js_fd = open(js_path, O_RDONLY);
+    if (js_fd < 0) {
+        perror("Error opening joystick device");
+        goto exit;
+    }
+    uint8_t num_of_axes = 0;
+    uint8_t num_of_buttons = 0;
+    ioctl(js_fd, JSIOCGAXES, &num_of_axes);
+    ioctl(js_fd, JSIOCGBUTTONS, &num_of_buttons);
+
+    rec = fopen(rec_path, "wb");
+    if (!rec) {
+        perror("Failed to create recording");
+        goto exit;
+    }
+    joy_rec_header_t header;
+    joy_rec__init_header(&header, num_of_buttons, num_of_axes);
+    if (fwrite(&header, sizeof(header), 1, rec) != 1) {
+        perror("Failed to write recording");
+        goto exit;
+    }
+    printf(
+        "Recording %s (%d buttons, %d axes) to %s, Ctrl+C to stop...\n",
+        js_path,
+        num_of_buttons,
+        num_of_axes,
+        rec_path
+    );
+
+    while (!stop_requested) {
+        joy_rec_event_t e;
+        ssize_t n = read(js_fd, &e.ev, sizeof(e.ev));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n != sizeof(e.ev)) {
+            perror("Error reading joystick event");
+            break;
+        }
+        e.t_ns = joy_rec__now_ns() - header.start_ns;
+        if (fwrite(&e, sizeof(e), 1, rec) != 1) {
+            perror("Failed to write recording");
+            goto exit;
+        }
+        num_of_events++;
+    }
+
+    r = EXIT_SUCCESS;
+
+exit:
+    if (rec) {
+        if (fclose(rec) != 0) {
+            perror("Failed to write recording");
+            r = EXIT_FAILURE;
+        }
+    }
+    if (js_fd >= 0) {
+        close(js_fd);
+    }
+    printf("Recorded %llu events\n", num_of_events);
+
+    return r;
+}
@@ -0,0 +1,286 @@
+#include <linux/joystick.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <glob.h>
+#include "include/joy_rec.h"
+#include "../../Common/include/lat_hist.h"
+
+// Replays a joy_rec recording into joy_node, without a joystick:
+// - to a FIFO, read by joy_node -j <fifo> as if it were js0,
+// - or to a virtual joystick over uinput, which the kernel turns into a
+//   real /dev/input/jsN.
+
+#define DEFAULT_FIFO_FN "/tmp/joy_replay"
+#define UINPUT_FN "/dev/uinput"
+// Time for joy_node to open a fresh uinput joystick.
+#define DEFAULT_UINPUT_WAIT_S 2
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/**
+ * Key code which joydev reports as button @a i. joydev numbers buttons in
+ * order of key code, starting from BTN_MISC.
+ */
+static int uinput_key(int i) {
+    if (i < BTN_DEAD - BTN_JOYSTICK + 1) {
+        return BTN_JOYSTICK + i;
+    }
+    return BTN_TRIGGER_HAPPY + i - (BTN_DEAD - BTN_JOYSTICK + 1);
+}
+
+/**
+ * Create virtual joystick with the buttons and axes of the recording.
+ * @return uinput fd or -1.
+ */
+static int uinput_create(const joy_rec_header_t* h) {
+    int fd = open(UINPUT_FN, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Failed to open " UINPUT_FN);
+        return -1;
+    }
+    // joydev only takes devices with a joystick axis.
+    int num_of_axes = h->num_of_axes ? h->num_of_axes : 1;
+    int ok =
+        ioctl(fd, UI_SET_EVBIT, EV_KEY) == 0 &&
+        ioctl(fd, UI_SET_EVBIT, EV_ABS) == 0 &&
+        ioctl(fd, UI_SET_EVBIT, EV_SYN) == 0;
+    for (int i = 0; ok && i < h->num_of_buttons; i++) {
+        ok = ioctl(fd, UI_SET_KEYBIT, uinput_key(i)) == 0;
+    }
+    for (int i = 0; ok && i < num_of_axes; i++) {
+        struct uinput_abs_setup abs;
+        memset(&abs, 0, sizeof(abs));
+        abs.code = ABS_X + i;
+        // Same range as js_event, so joydev passes values through.
+        abs.absinfo.minimum = -32767;
+        abs.absinfo.maximum = 32767;
+        ok =
+            ioctl(fd, UI_SET_ABSBIT, abs.code) == 0 &&
+            ioctl(fd, UI_ABS_SETUP, &abs) == 0;
+    }
+    struct uinput_setup setup;
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    strncpy(setup.name, "joy_replay", UINPUT_MAX_NAME_SIZE - 1);
+    ok = ok &&
+        ioctl(fd, UI_DEV_SETUP, &setup) == 0 &&
+        ioctl(fd, UI_DEV_CREATE) == 0;
+    if (!ok) {
+        perror("Failed to create uinput joystick");
+        close(fd);
+        return -1;
+    }
+
+    char sysname[64];
+    if (ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) >= 0) {
+        char pattern[128];
+        snprintf(pattern, sizeof(pattern), "/sys/devices/virtual/input/%s/js*", sysname);
+        glob_t g;
+        if (glob(pattern, 0, NULL, &g) == 0) {
+            printf("Virtual joystick is /dev/input/%s\n", strrchr(g.gl_pathv[0], '/') + 1);
+            globfree(&g);
+        }
+    }
+    return fd;
+}
+
+static int uinput_emit(int fd, const struct js_event* js) {
+    struct input_event ev[2];
+    memset(ev, 0, sizeof(ev));
+    if (js->type & JS_EVENT_BUTTON) {
+        ev[0].type = EV_KEY;
+        ev[0].code = uinput_key(js->number);
+    } else {
+        ev[0].type = EV_ABS;
+        ev[0].code = ABS_X + js->number;
+    }
+    ev[0].value = js->value;
+    ev[1].type = EV_SYN;
+    ev[1].code = SYN_REPORT;
+    return write(fd, ev, sizeof(ev)) == sizeof(ev) ? 0 : -1;
+}
+
+static void usage(FILE* f) {
+    fprintf(f,
+"\nUsage: "\
+"\n	joy_replay [-o <fifo> | -u] [-x <speed>] [-n <loops>] <file>"\
+"\n	-o	write js_events to FIFO, created if missing, for joy_node -j"\
+"\n		(default %s)"\
+"\n	-u	drive a virtual joystick over %s instead"\
+"\n	-x	speed factor, 2 is twice real time, 0 as fast as possible"\
+"\n		(default 1)"\
+"\n	-n	replay that many times, 0 forever (default 1)"\
+"\n",
+        DEFAULT_FIFO_FN,
+        UINPUT_FN
+    );
+}
+
+int main(int argc, char** argv) {
+    const char* fifo_path = DEFAULT_FIFO_FN;
+    int use_uinput = 0;
+    double speed = 1;
+    int loops = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:ux:n:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                fifo_path = optarg;
+                break;
+            case 'u':
+                use_uinput = 1;
+                break;
+            case 'x':
+                speed = atof(optarg);
+                break;
+            case 'n':
+                loops = atoi(optarg);
+                break;
+            case 'h':
+                usage(stdout);
+                return 0;
+            default:
+                usage(stderr);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || speed < 0 || loops < 0) {
+        usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    int r = EXIT_FAILURE;
+    int out_fd = -1;
+    joy_rec_t rec;
+    static lat_hist_t lag;
+    lat_hist__reset(&lag);
+    unsigned long long num_of_sent = 0;
+
+    if (joy_rec__open(&rec, argv[optind]) != 0) {
+        perror("Failed to open recording");
+        return EXIT_FAILURE;
+    }
+    printf(
+        "Recording of %zu events, %d buttons, %d axes\n",
+        rec.num_of_events,
+        rec.header->num_of_buttons,
+        rec.header->num_of_axes
+    );
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    // Reader going away ends the replay, it does not kill it.
+    signal(SIGPIPE, SIG_IGN);
+
+    if (use_uinput) {
+        out_fd = uinput_create(rec.header);
+        if (out_fd < 0) {
+            goto exit;
+        }
+        printf("Waiting %d s for joy_node to open it...\n", DEFAULT_UINPUT_WAIT_S);
+        sleep(DEFAULT_UINPUT_WAIT_S);
+    } else {
+        if (mkfifo(fifo_path, 0666) != 0 && errno != EEXIST) {
+            perror("Failed to create FIFO");
+            goto exit;
+        }
+        printf("Waiting for reader on %s...\n", fifo_path);
+        // Blocks until joy_node opens the other end.
+        out_fd = open(fifo_path, O_WRONLY | O_CLOEXEC);
+        if (out_fd < 0) {
+            perror("Failed to open FIFO");
+            goto exit;
+        }
+    }
+
+    uint64_t start_ns = joy_rec__now_ns();
+    // Schedule is absolute, so lag does not accumulate over events.
+    uint64_t loop_ns = start_ns;
+    for (int loop = 0; !stop_requested && (loops == 0 || loop < loops); loop++) {
+        for (size_t i = 0; !stop_requested && i < rec.num_of_events; i++) {
+            struct js_event ev = rec.events[i].ev;
+            if (ev.type & JS_EVENT_INIT) {
+                // Kernel makes its own for uinput, and joy_node needs them
+                // only once.
+                if (use_uinput || loop > 0) {
+                    continue;
+                }
+            }
+            uint64_t due_ns = loop_ns;
+            if (speed > 0) {
+                due_ns += (uint64_t)(rec.events[i].t_ns / speed);
+                struct timespec ts = {
+                    .tv_sec = due_ns / 1000000000ULL,
+                    .tv_nsec = due_ns % 1000000000ULL
+                };
+                while (
+                    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR &&
+                    !stop_requested
+                ) {
+                }
+            }
+            uint64_t now_ns = joy_rec__now_ns();
+            // Timestamp as the kernel would, in ms.
+            ev.time = (uint32_t)(now_ns / 1000000);
+            int ok = use_uinput ?
+                uinput_emit(out_fd, &ev) == 0 :
+                write(out_fd, &ev, sizeof(ev)) == sizeof(ev);
+            if (!ok) {
+                if (errno == EPIPE) {
+                    printf("Reader closed %s\n", fifo_path);
+                    stop_requested = 1;
+                    break;
+                }
+                perror("Failed to write event");
+                goto exit;
+            }
+            if (speed > 0) {
+                lat_hist__add(&lag, now_ns - due_ns);
+            }
+            num_of_sent++;
+        }
+        if (speed > 0 && rec.num_of_events) {
+            // Next pass starts at time of the last event.
+            loop_ns += rec.events[rec.num_of_events - 1].t_ns / speed;
+        }
+    }
+    double dur_s = (joy_rec__now_ns() - start_ns) / 1e9;
+    printf(
+        "Sent %llu events in %.3f s, %.0f events/s\n",
+        num_of_sent,
+        dur_s,
+        dur_s > 0 ? num_of_sent / dur_s : 0
+    );
+    if (lag.count) {
+        lat_hist__print(stdout, "schedule lag", &lag, 1000, "us");
+    }
+
+    r = EXIT_SUCCESS;
+
+exit:
+    if (out_fd >= 0) {
+        if (use_uinput) {
+            ioctl(out_fd, UI_DEV_DESTROY);
+        }
+        close(out_fd);
+    }
+    joy_rec__close(&rec);
+
+    return r;
+}
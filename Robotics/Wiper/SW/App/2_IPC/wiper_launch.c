@@ -0,0 +1,105 @@
+#define _GNU_SOURCE // rt_profile.h
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "include/component.h"
+#include "../../Common/include/rt_profile.h"
+
+// Hosts several nodes in one process, e.g. joy_node and wiper_node on the
+// same board, connected over inproc:// instead of ipc:// or tcp://.
+
+#define MAX_INSTANCES 8
+
+static const component_t* const components[] = {
+    &joy_node__component,
+    &wiper_node__component,
+};
+
+static const component_t* find_component(const char* name) {
+    for (size_t i = 0; i < sizeof(components)/sizeof(components[0]); i++) {
+        if (strcmp(components[i]->name, name) == 0) {
+            return components[i];
+        }
+    }
+    return NULL;
+}
+
+static void usage(FILE* f) {
+    fprintf(f,
+"\nUsage: "\
+"\n	wiper_launch [-q <prio>[@<cpu>]] <node> [<args>] [-- <node> [<args>]]..."\
+"\n	-q	SCHED_FIFO priority and CPU of the shared ZeroMQ I/O thread, the"\
+"\n		reader of all nodes; set before any node creates a socket, so"\
+"\n		this replaces wiper_node -q (default as started)"\
+"\n	<node>	joy_node or wiper_node, with the arguments of its own binary,"\
+"\n		see <node> -h; each is run in a thread of its own, once at most"\
+"\n"\
+"\nNodes of one launcher share a ZeroMQ context, so they connect over"\
+"\ninproc://, e.g.:"\
+"\n	wiper_launch joy_node -e inproc://joy -- wiper_node -e inproc://joy"\
+"\n"\
+"\nSend SIGUSR1 to print statistics of all nodes.\n"
+    );
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0) {
+        usage(argc < 2 ? stderr : stdout);
+        return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    // Own options before the first node, the rest is argv of the nodes.
+    rt_profile__thread_t io_thread = { 0, -1 };
+    int first = 1;
+    if (strcmp(argv[first], "-q") == 0) {
+        if (
+            first + 1 >= argc ||
+            rt_profile__parse_thread(argv[first + 1], &io_thread) != 0
+        ) {
+            fprintf(stderr, "ERROR: Invalid priority!\n");
+            return EXIT_FAILURE;
+        }
+        first += 2;
+    }
+
+    // Split argv in place at "--", each part is argv of a node, with the
+    // node name as argv[0] and NULL terminated, as getopt() expects.
+    component__instance_t insts[MAX_INSTANCES];
+    int num_of_insts = 0;
+    for (int i = first; i <= argc; i++) {
+        if (i < argc && strcmp(argv[i], "--") != 0) {
+            continue;
+        }
+        if (i == first) {
+            fprintf(stderr, "ERROR: Missing node!\n");
+            return EXIT_FAILURE;
+        }
+        if (num_of_insts == MAX_INSTANCES) {
+            fprintf(stderr, "ERROR: At most %d nodes!\n", MAX_INSTANCES);
+            return EXIT_FAILURE;
+        }
+        const component_t* c = find_component(argv[first]);
+        if (!c) {
+            fprintf(stderr, "ERROR: Unknown node \"%s\"!\n", argv[first]);
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+        // A node keeps its state in file scope, so it runs once at most.
+        for (int j = 0; j < num_of_insts; j++) {
+            if (insts[j].c == c) {
+                fprintf(stderr, "ERROR: %s given twice!\n", c->name);
+                return EXIT_FAILURE;
+            }
+        }
+        component__instance_t* inst = &insts[num_of_insts++];
+        memset(inst, 0, sizeof(*inst));
+        inst->c = c;
+        inst->argc = i - first;
+        inst->argv = &argv[first];
+        argv[i] = NULL;
+        first = i + 1;
+    }
+
+    return component__host(insts, num_of_insts, io_thread.prio, io_thread.cpu);
+}
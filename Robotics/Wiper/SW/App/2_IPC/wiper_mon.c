@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <zmq.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include "include/joy_msg.h"
+#include "include/wiper_tlm.h"
+
+// Operator side of wiper_node -T: one socket the whole fleet connects to.
+// Prints transitions as they come and a table of all nodes periodically.
+
+#define DEFAULT_ENDPOINT "tcp://*:5556"
+#define DEFAULT_INTERVAL_S 5
+#define MAX_NODES 64
+#define MAX_FILTERS 16
+
+static const char* const motor_names[WIPER_TLM__MOTOR_COUNT] = {
+    "STOP",
+    "CCW",
+    "CW",
+};
+
+typedef struct {
+    char topic[JOY_MSG__TOPIC_SIZE + 1];
+    joy_msg__seq_stats_t seq_stats;
+    uint8_t motor;
+    uint8_t limit;
+    uint64_t last_ns; // CLOCK_REALTIME of end of last window.
+    uint64_t motor_us[WIPER_TLM__MOTOR_COUNT];
+    uint64_t limit_rises;
+    uint64_t limit_falls;
+    uint64_t actuations;
+    uint64_t events_lost;
+    uint32_t latency_max_us;
+} node_t;
+
+static node_t nodes[MAX_NODES];
+static int num_of_nodes = 0;
+static uint64_t invalid = 0;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/**
+ * @return node of @a topic, added if new, or NULL if there is no room.
+ */
+static node_t* find_node(const char* topic) {
+    for (int i = 0; i < num_of_nodes; i++) {
+        if (strncmp(nodes[i].topic, topic, JOY_MSG__TOPIC_SIZE) == 0) {
+            return &nodes[i];
+        }
+    }
+    if (num_of_nodes == MAX_NODES) {
+        return NULL;
+    }
+    node_t* n = &nodes[num_of_nodes++];
+    memset(n, 0, sizeof(*n));
+    memcpy(n->topic, topic, JOY_MSG__TOPIC_SIZE);
+    n->limit = WIPER_TLM__LIMIT_UNKNOWN;
+    return n;
+}
+
+static const char* motor_name(uint8_t motor) {
+    return motor < WIPER_TLM__MOTOR_COUNT ? motor_names[motor] : "?";
+}
+
+static const char* limit_name(uint8_t limit) {
+    return limit == WIPER_TLM__LIMIT_UNKNOWN ? "?" : limit ? "1" : "0";
+}
+
+/**
+ * Local wall clock time of @a ns, CLOCK_REALTIME.
+ */
+static void print_time(uint64_t ns) {
+    time_t s = ns/1000000000ULL;
+    struct tm tm;
+    localtime_r(&s, &tm);
+    printf("%02d:%02d:%02d.%03d", tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(ns/1000000ULL%1000));
+}
+
+static void handle(const wiper_tlm_msg_t* msg, int verbose) {
+    node_t* n = find_node(msg->topic);
+    if (!n) {
+        invalid++;
+        return;
+    }
+    uint32_t gap = joy_msg__seq_track(&n->seq_stats, msg->seq);
+    const char* id = n->topic + strlen(WIPER_TLM__TOPIC);
+    if (verbose && gap) {
+        printf("%-12s lost %u windows\n", id, gap);
+    }
+    for (int i = 0; verbose && i < msg->num_of_events; i++) {
+        const wiper_tlm_event_t* e = &msg->events[i];
+        print_time(msg->start_ns + e->t_us*1000ULL);
+        if (e->kind == WIPER_TLM__EV_MOTOR) {
+            printf(" %-12s motor %s\n", id, motor_name(e->value));
+        } else {
+            printf(" %-12s limit %s\n", id, e->value ? "tripped" : "released");
+        }
+    }
+    if (verbose && msg->events_lost) {
+        printf("%-12s %u transitions not reported\n", id, msg->events_lost);
+    }
+
+    n->motor = msg->motor;
+    n->limit = msg->limit;
+    n->last_ns = msg->start_ns + msg->window_us*1000ULL;
+    for (int i = 0; i < WIPER_TLM__MOTOR_COUNT; i++) {
+        n->motor_us[i] += msg->motor_us[i];
+    }
+    n->limit_rises += msg->limit_rises;
+    n->limit_falls += msg->limit_falls;
+    n->actuations += msg->actuations;
+    n->events_lost += msg->events_lost;
+    if (msg->latency_max_us > n->latency_max_us) {
+        n->latency_max_us = msg->latency_max_us;
+    }
+}
+
+static void print_table(void) {
+    uint64_t now_ns = joy_msg__now_ns();
+    printf(
+        "\n%-12s %5s %5s %7s %6s %6s %8s %8s %8s %6s %9s %7s\n",
+        "node", "motor", "limit", "age[s]", "rises", "falls",
+        "stop[%]", "ccw[%]", "cw[%]", "acts", "lat[ms]", "lost"
+    );
+    for (int i = 0; i < num_of_nodes; i++) {
+        const node_t* n = &nodes[i];
+        uint64_t total_us = 0;
+        for (int s = 0; s < WIPER_TLM__MOTOR_COUNT; s++) {
+            total_us += n->motor_us[s];
+        }
+        double pct = total_us ? 100.0/total_us : 0;
+        printf(
+            "%-12s %5s %5s %7.1f %6llu %6llu %8.1f %8.1f %8.1f %6llu %9.1f %7llu\n",
+            n->topic + strlen(WIPER_TLM__TOPIC),
+            motor_name(n->motor),
+            limit_name(n->limit),
+            now_ns > n->last_ns ? (now_ns - n->last_ns)/1e9 : 0.0,
+            (unsigned long long)n->limit_rises,
+            (unsigned long long)n->limit_falls,
+            n->motor_us[WIPER_TLM__MOTOR_STOP]*pct,
+            n->motor_us[WIPER_TLM__MOTOR_CCW]*pct,
+            n->motor_us[WIPER_TLM__MOTOR_CW]*pct,
+            (unsigned long long)n->actuations,
+            n->latency_max_us/1e3,
+            (unsigned long long)n->seq_stats.lost
+        );
+    }
+    if (invalid) {
+        printf("Ignored %llu invalid messages\n", (unsigned long long)invalid);
+    }
+    fflush(stdout);
+}
+
+static void usage(FILE* f) {
+    fprintf(f,
+"\nUsage: "\
+"\n	wiper_mon [-e <endpoint>] [-n <id>]... [-i <s>] [-q]"\
+"\n	-e	endpoint to bind, wiper_node -T connects to it (default %s)"\
+"\n	-n	only node id, can be repeated (default all nodes)"\
+"\n	-i	seconds between tables of all nodes (default %d)"\
+"\n	-q	quiet, tables only, no transitions"\
+"\n"\
+"\nTable: latest motor state and limit switch level, age of latest window,"\
+"\nlimit switch edges, time in each state, actuations by commands, max"\
+"\ncommand to actuation latency and lost windows, all since start.\n",
+        DEFAULT_ENDPOINT,
+        DEFAULT_INTERVAL_S
+    );
+}
+
+int main(int argc, char** argv) {
+    const char* endpoint = DEFAULT_ENDPOINT;
+    char filters[MAX_FILTERS][JOY_MSG__TOPIC_SIZE];
+    int num_of_filters = 0;
+    int interval_s = DEFAULT_INTERVAL_S;
+    int verbose = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:n:i:qh")) != -1) {
+        switch (opt) {
+            case 'e':
+                endpoint = optarg;
+                break;
+            case 'n':
+                if (num_of_filters == MAX_FILTERS) {
+                    fprintf(stderr, "ERROR: At most %d nodes!\n", MAX_FILTERS);
+                    return EXIT_FAILURE;
+                }
+                if (joy_msg__topic(filters[num_of_filters++], WIPER_TLM__TOPIC, optarg) != 0) {
+                    fprintf(stderr, "ERROR: Too long name \"%s\"!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'i':
+                interval_s = atoi(optarg);
+                if (interval_s <= 0) {
+                    fprintf(stderr, "ERROR: Invalid interval \"%s\"!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'q':
+                verbose = 0;
+                break;
+            case 'h':
+                usage(stdout);
+                return 0;
+            default:
+                usage(stderr);
+                return EXIT_FAILURE;
+        }
+    }
+
+    int r = EXIT_FAILURE;
+    void* context = NULL;
+    void* subscriber = NULL;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    context = zmq_ctx_new();
+    if (!context) {
+        perror("Failed to create ZeroMQ context");
+        goto exit;
+    }
+    subscriber = zmq_socket(context, ZMQ_SUB);
+    if (!subscriber) {
+        perror("Failed to create ZeroMQ socket");
+        goto exit;
+    }
+    if (zmq_bind(subscriber, endpoint) != 0) {
+        fprintf(stderr, "Failed to bind ZeroMQ socket to %s: %s\n",
+                endpoint, zmq_strerror(zmq_errno()));
+        goto exit;
+    }
+    // Whole topics of given nodes, or the prefix for all of them.
+    for (int i = 0; i < num_of_filters; i++) {
+        if (zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, filters[i], JOY_MSG__TOPIC_SIZE) != 0) {
+            perror("Failed to set ZMQ_SUBSCRIBE");
+            goto exit;
+        }
+    }
+    if (num_of_filters == 0 &&
+        zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, WIPER_TLM__TOPIC, strlen(WIPER_TLM__TOPIC)) != 0) {
+        perror("Failed to set ZMQ_SUBSCRIBE");
+        goto exit;
+    }
+    printf("Monitoring wiper nodes on %s...\n", endpoint);
+
+    wiper_tlm_msg_t msg;
+    uint64_t next_table_ns = joy_msg__now_ns() + interval_s*1000000000ULL;
+    while (!stop_requested) {
+        uint64_t now_ns = joy_msg__now_ns();
+        if (now_ns >= next_table_ns) {
+            print_table();
+            next_table_ns += interval_s*1000000000ULL;
+            continue;
+        }
+        zmq_pollitem_t item = { subscriber, 0, ZMQ_POLLIN, 0 };
+        int n = zmq_poll(&item, 1, (next_table_ns - now_ns)/1000000ULL + 1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("zmq_poll failed");
+            goto exit;
+        }
+        while (n > 0) {
+            int bytes = zmq_recv(subscriber, &msg, sizeof(msg), ZMQ_DONTWAIT);
+            if (bytes < 0) {
+                if (errno != EAGAIN && errno != EINTR) {
+                    perror("Failed to receive ZeroMQ message");
+                    goto exit;
+                }
+                break;
+            }
+            // Too long ones are truncated by ZeroMQ, and fail on size here.
+            const wiper_tlm_msg_t* m = wiper_tlm__parse(&msg, bytes);
+            if (m) {
+                handle(m, verbose);
+            } else {
+                invalid++;
+            }
+        }
+        fflush(stdout);
+    }
+
+    print_table();
+    r = EXIT_SUCCESS;
+
+exit:
+    if (subscriber) {
+        zmq_close(subscriber);
+    }
+    if (context) {
+        zmq_ctx_destroy(context);
+    }
+
+    return r;
+}
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE // rt_profile.h
+
 #include <stdio.h>
 #include <zmq.h>
 #include <string.h>
@@ -5,186 +7,814 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include "../../Driver/gpio_ctrl/include/gpio_ctrl.h"
 #include "../../Driver/gpio_ctrl/gpio.h"
+#include "include/joy_msg.h"
+#include "include/wiper_rx.h"
+#include "include/wiper_tlm.h"
+#include "include/component.h"
+#include "../../Common/include/rt_profile.h"
+#include "../../Common/include/periodic.h"
+#include "../../Common/include/trace_hist.h"
+#include "../../Common/include/rt_log.h"
 
+// Default endpoint, joy_node on another host. Co-located nodes should
+// use ipc:// instead, see joy_node -e.
 #define ZMQ_ENDPOINT "tcp://10.1.207.139:5555"
-#define DEV_STREAM_FN "/dev/gpio_stream"
 
-int gpio_write(int fd, uint8_t pin, uint8_t value) {
+// Default rate of the refresh loop, that of the original usleep(10000)
+// loop. The held command is re-asserted on every tick, so a GPIO write
+// lost on the driver side heals itself.
+#define DEFAULT_RATE_HZ 100
+
+// Default rate of telemetry windows, see -T.
+#define DEFAULT_TLM_RATE_HZ 1
+// Park/limit switch, shorted to 3V3 when tripped, see 3_Limit_SW.
+#define LIMIT_PIN 22
+
+#define MAX_EVENTS 8
+// Topics subscribed to: broadcast, own node, groups.
+#define MAX_GROUPS 4
+#define MAX_TOPICS (2 + MAX_GROUPS)
+_Static_assert(MAX_TOPICS <= JOY_CMD__MAX_TOPICS, "topics do not fit into hello");
+
+static int gpio_write(int fd, uint8_t pin, uint8_t value) {
     uint8_t pkg[3];
     pkg[0] = GPIO_CTRL__WRITE;
     pkg[1] = pin;
     pkg[2] = value;
 
     if (write(fd, &pkg, 3) != 3) {
-        perror("Failed to write to GPIO");
+        RT_LOG__ERROR("Failed to write pin %d to GPIO, errno %d\n", pin, errno);
         return -1;
     }
     return 0;
 }
 
-volatile int num_of_buttons = 0; // Received from joypad_node
-volatile char* button_states = NULL;
-pthread_mutex_t cmd_mtx = PTHREAD_MUTEX_INITIALIZER;
+/**
+ * Read @a pin with pull-down, as wiper_limit_switch_node does.
+ */
+static int gpio_read(int fd, uint8_t pin, uint8_t* value) {
+    uint8_t pkg[2];
+    pkg[0] = 'd';
+    pkg[1] = pin;
 
-void* zmq_subscriber(void* arg) {
-    void* context = zmq_ctx_new();
-    if (!context) {
-        perror("Failed to create ZeroMQ context");
-        return NULL;
+    if (write(fd, &pkg, 2) != 2 || read(fd, value, 1) != 1) {
+        RT_LOG__ERROR("Failed to read pin %d from GPIO, errno %d\n", pin, errno);
+        return -1;
+    }
+    return 0;
+}
+
+// Only touched from the epoll loop, so no locking is needed.
+// Preallocated, so the steady state does no heap allocation.
+static wiper_rx_t rx;
+static periodic_t loop = { .fd = -1 };
+// Motor state is tracked always, limit switch only read with telemetry on.
+static wiper_tlm_t tlm;
+static void* tlm_socket = NULL;
+static periodic_t tlm_loop = { .fd = -1 };
+
+// Stages of the pipeline that happen after joy_node, per message that
+// changed a GPIO. Cross-host stages need synchronized clocks.
+enum {
+    WIPER_STAGE__TRANSPORT, // zmq_send() in joy_node to receive here
+    WIPER_STAGE__APPLY,     // Receive to gpio_write() done
+    WIPER_STAGE__TOTAL,     // read() of js_event in joy_node to gpio_write() done
+    WIPER_STAGE__COUNT
+};
+static const char* const wiper_stage_names[WIPER_STAGE__COUNT] = {
+    "publish->receive",
+    "receive->gpio",
+    "read->gpio",
+};
+static trace_hist_t wiper_stages[WIPER_STAGE__COUNT];
+
+/**
+ * @return number of GPIO writes.
+ */
+static int apply_buttons(int gpio_fd) {
+    int writes = 0;
+    uint8_t motor = tlm.msg.motor;
+    const joy_msg_t* state = wiper_rx__state(&rx);
+    if (state == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < 3; i++) { // Limit to 3 buttons
+        if (!joy_msg__button(state, i)) {
+            continue;
+        }
+        switch (i) {
+            case 0: // BUTTON_CCW
+                gpio_write(gpio_fd, 3, 1); // CCW
+                gpio_write(gpio_fd, 4, 0); // CCW
+                gpio_write(gpio_fd, 2, 1); // EN = 1
+                writes += 3;
+                motor = WIPER_TLM__MOTOR_CCW;
+                break;
+            case 1: // BUTTON_CW
+                gpio_write(gpio_fd, 3, 0); // CW
+                gpio_write(gpio_fd, 4, 1); // CW
+                gpio_write(gpio_fd, 2, 1); // EN = 1
+                writes += 3;
+                motor = WIPER_TLM__MOTOR_CW;
+                break;
+            case 2: // BUTTON_STOP
+                gpio_write(gpio_fd, 2, 0); // EN = 0
+                writes++;
+                motor = WIPER_TLM__MOTOR_STOP;
+                break;
+        }
+    }
+    if (writes > 0) {
+        wiper_tlm__motor(&tlm, motor, periodic__now_ns());
+    }
+    return writes;
+}
+
+static void trace_stage(int stage, uint64_t from_ns, uint64_t to_ns) {
+    if (from_ns && to_ns > from_ns) {
+        trace_hist__add(&wiper_stages[stage], to_ns - from_ns);
+    }
+}
+
+/**
+ * Apply state just received, and trace it if it reached the GPIO.
+ */
+static void apply_received(int gpio_fd) {
+    const joy_msg_t* state = wiper_rx__state(&rx);
+    uint8_t motor = tlm.msg.motor;
+    trace_stage(WIPER_STAGE__TRANSPORT, state->pub_time_ns, rx.rx_time_ns);
+    if (apply_buttons(gpio_fd) > 0 && !(state->flags & JOY_MSG__FLAG_SNAPSHOT)) {
+        uint64_t now_ns = joy_msg__now_ns();
+        trace_stage(WIPER_STAGE__APPLY, rx.rx_time_ns, now_ns);
+        trace_stage(WIPER_STAGE__TOTAL, state->read_time_ns, now_ns);
+        if (tlm.msg.motor != motor) {
+            wiper_tlm__actuation(
+                &tlm,
+                state->read_time_ns && now_ns > state->read_time_ns ?
+                    now_ns - state->read_time_ns : 0
+            );
+        }
+    }
+}
+
+static void print_stats(void) {
+    if (loop.fd >= 0) {
+        periodic__print(stdout, "Refresh loop", &loop);
+    }
+    printf(
+        "Received %llu, lost %llu, publisher restarts %llu\n",
+        (unsigned long long)rx.seq_stats.received,
+        (unsigned long long)rx.seq_stats.lost,
+        (unsigned long long)rx.seq_stats.restarts
+    );
+    if (rx.invalid) {
+        printf("Ignored %llu invalid messages\n", (unsigned long long)rx.invalid);
+    }
+    trace_hist__print(stdout, wiper_stage_names, wiper_stages, WIPER_STAGE__COUNT);
+    if (tlm_socket) {
+        printf("Telemetry %s: sent %llu windows\n", tlm.msg.topic, (unsigned long long)tlm.sent);
     }
-    void* subscriber = zmq_socket(context, ZMQ_SUB);
-    if (!subscriber) {
-        perror("Failed to create ZeroMQ socket");
-        zmq_ctx_destroy(context);
+}
+
+/**
+ * Poll limit switch, at the rate of the refresh loop, as gpio_stream
+ * does not signal edges yet. Shorter pulses than a period are missed.
+ */
+static void read_limit(int gpio_fd) {
+    uint8_t level;
+    if (gpio_read(gpio_fd, LIMIT_PIN, &level) == 0) {
+        wiper_tlm__limit(&tlm, level, periodic__now_ns());
+    }
+}
+
+/**
+ * Connect to monitor, which binds. Connecting never fails on a monitor
+ * that is not up yet, ZeroMQ retries in the background.
+ * @return socket, or NULL on error.
+ */
+static void* tlm_open(void* context, const char* endpoint) {
+    void* socket = zmq_socket(context, ZMQ_PUB);
+    if (!socket) {
+        perror("Failed to create telemetry socket");
         return NULL;
     }
-    if (zmq_connect(subscriber, ZMQ_ENDPOINT) != 0) {
-        perror("Failed to connect ZeroMQ socket");
-        zmq_close(subscriber);
-        zmq_ctx_destroy(context);
+    // Few windows queued while monitor is away, older ones are of no use.
+    int hwm = 16;
+    // Let the last window out on exit, but do not hang on a dead monitor.
+    int linger = 100;
+    if (
+        zmq_setsockopt(socket, ZMQ_SNDHWM, &hwm, sizeof(hwm)) != 0 ||
+        zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger)) != 0 ||
+        zmq_connect(socket, endpoint) != 0
+    ) {
+        fprintf(stderr, "Failed to connect telemetry to %s: %s\n",
+                endpoint, zmq_strerror(zmq_errno()));
+        zmq_close(socket);
         return NULL;
     }
+    return socket;
+}
 
-    if (zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, "", 0) != 0) {
-        perror("Failed to set ZMQ_SUBSCRIBE");
-        zmq_close(subscriber);
-        zmq_ctx_destroy(context);
-        return NULL;
+/**
+ * ZMQ_FD is edge-triggered: it only signals that the socket state changed,
+ * so every wakeup has to drain the socket until ZMQ_EVENTS has no POLLIN.
+ * @return 1 if a message is ready, 0 if not, -1 on fatal error.
+ */
+static int zmq_readable(void* socket) {
+    int events;
+    size_t events_size = sizeof(events);
+    if (zmq_getsockopt(socket, ZMQ_EVENTS, &events, &events_size) != 0) {
+        perror("Failed to get ZMQ_EVENTS");
+        return -1;
     }
+    return (events & ZMQ_POLLIN) != 0;
+}
 
-    printf("Connected and listening on %s...\n", ZMQ_ENDPOINT);
+/**
+ * @return 0 if Ok, -1 on fatal error.
+ */
+static int drain_subscriber(void* subscriber, int gpio_fd) {
+    while (1) {
+        int readable = zmq_readable(subscriber);
+        if (readable <= 0) {
+            return readable;
+        }
 
+        int r = wiper_rx__recv(&rx, subscriber);
+        if (r < 0) {
+            perror("Failed to receive ZeroMQ message");
+            return -1;
+        }
+        if (r > 0) {
+            const joy_msg_t* state = wiper_rx__state(&rx);
+            if (rx.last_gap) {
+                RT_LOG__WARN("Lost %u messages before seq %u\n", rx.last_gap, state->seq);
+            }
+            RT_LOG__INFO(
+                "Received %s: 0x%08x (seq %u)\n",
+                state->flags & JOY_MSG__FLAG_SNAPSHOT ? "snapshot" : "button states",
+                state->buttons,
+                state->seq
+            );
+            // Apply immediately instead of waiting for the next tick.
+            apply_received(gpio_fd);
+        }
+    }
+}
 
+/**
+ * Apply commands of joy_node -a, and ack each once its GPIO writes are done.
+ * @return 0 if Ok, -1 on fatal error.
+ */
+static int drain_commands(void* dealer, int gpio_fd) {
     while (1) {
-        zmq_msg_t msg;
-        zmq_msg_init(&msg);
-        int bytes = zmq_msg_recv(&msg, subscriber, 0); // Blocking receive
-        if (bytes > 0) {
-            char* buffer = (char*)malloc((bytes + 1) * sizeof(char));
-            if (buffer == NULL) {
-                perror("Memory allocation failed for buffer");
-                zmq_msg_close(&msg);
-                zmq_close(subscriber);
-                zmq_ctx_destroy(context);
-                return NULL;
+        int readable = zmq_readable(dealer);
+        if (readable <= 0) {
+            return readable;
+        }
+
+        joy_cmd_ack_t ack;
+        int r = wiper_rx__recv_cmd(&rx, dealer, &ack);
+        if (r < 0) {
+            perror("Failed to receive ZeroMQ message");
+            return -1;
+        }
+        if (r > 0) {
+            const joy_msg_t* state = wiper_rx__state(&rx);
+            if (rx.last_gap) {
+                RT_LOG__WARN("Lost %u commands before id %u\n", rx.last_gap, state->seq);
             }
-            memcpy(buffer, zmq_msg_data(&msg), bytes);
-            buffer[bytes] = '\0';
-
-            pthread_mutex_lock(&cmd_mtx);
-            if (num_of_buttons == 0) { // First message is number of buttons
-                num_of_buttons = atoi(buffer);
-                if (num_of_buttons <= 0) {
-                    perror("Invalid number of buttons (non-positive)");
-                    free(buffer);
-                    pthread_mutex_unlock(&cmd_mtx);
-                    zmq_msg_close(&msg);
-                    zmq_close(subscriber);
-                    zmq_ctx_destroy(context);
-                    return NULL;
+            RT_LOG__INFO("Received command: 0x%08x (id %u)\n", state->buttons, state->seq);
+            apply_received(gpio_fd);
+            ack.apply_time_ns = joy_msg__now_ns();
+        }
+        // Lost acks are made up for by retries of joy_node.
+        if (ack.type && zmq_send(dealer, &ack, sizeof(ack), ZMQ_DONTWAIT) < 0) {
+            RT_LOG__WARN("Failed to ack command %u: %s\n", ack.id, zmq_strerror(zmq_errno()));
+        }
+    }
+}
+
+/**
+ * Tell joy_node which topics this node takes. Also a heartbeat, as
+ * joy_node forgets nodes which stop saying it.
+ */
+static void say_hello(void* dealer, char topics[][JOY_MSG__TOPIC_SIZE], int num_of_topics) {
+    joy_cmd_hello_t hello;
+    hello.type = JOY_CMD__HELLO;
+    hello.num_of_topics = num_of_topics;
+    memcpy(hello.topics, topics, num_of_topics*JOY_MSG__TOPIC_SIZE);
+    // Not connected yet, the next one gets through.
+    zmq_send(dealer, &hello, joy_cmd__hello_size(num_of_topics), ZMQ_DONTWAIT);
+}
+
+static void drain_shm(shm_state_t* shm, uint32_t* seen, int gpio_fd) {
+    if (wiper_rx__read_shm(&rx, shm, seen)) {
+        const joy_msg_t* state = wiper_rx__state(&rx);
+        RT_LOG__INFO("Received button states: 0x%08x (seq %u)\n", state->buttons, state->seq);
+        apply_received(gpio_fd);
+    }
+}
+
+static int epoll_add(int epoll_fd, int fd) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Set up by wiper_node__init(), the rest of the loop's state.
+static char topics[MAX_TOPICS][JOY_MSG__TOPIC_SIZE];
+static int num_of_topics = 0;
+static char host[HOST_NAME_MAX + 1];
+static const char* node_id = NULL;
+static int rt = 0;
+static rt_profile__thread_t actuator_thread = { RT_PROFILE__ACTUATOR_PRIO, -1 };
+static int gpio_fd = -1;
+static int gpio_polled = 0;
+static int epoll_fd = -1;
+static void* subscriber = NULL;
+static void* dealer = NULL;
+static uint64_t hello_ns = 0;
+static int zmq_fd = -1;
+static shm_state_t* shm = NULL;
+static uint32_t shm_seen = 0;
+// Shutdown and statistics are asked for from other threads, which wake
+// the loop through wake_fd, so that only the loop touches its state.
+static int wake_fd = -1;
+static _Atomic int stop_requested = 0;
+static _Atomic int stats_requested = 0;
+
+/**
+ * Release whatever wiper_node__init() set up.
+ */
+static void cleanup(void) {
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    gpio_polled = 0;
+    if (wake_fd >= 0) {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+    if (subscriber) {
+        zmq_close(subscriber);
+        subscriber = NULL;
+    }
+    if (dealer) {
+        zmq_close(dealer);
+        dealer = NULL;
+    }
+    if (tlm_socket) {
+        zmq_close(tlm_socket);
+        tlm_socket = NULL;
+    }
+    if (shm) {
+        shm_state__close(shm);
+        shm = NULL;
+    }
+    rt_log__stop();
+    periodic__close(&loop);
+    periodic__close(&tlm_loop);
+    if (gpio_fd >= 0) {
+        close(gpio_fd);
+        gpio_fd = -1;
+    }
+}
+
+static void wake(void) {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        // Counter full, the loop is woken anyway.
+    }
+}
+
+static void usage(FILE* f) {
+    fprintf(f,
+"\nUsage: "\
+"\n	wiper_node [-e <endpoint> | -s <shm_name> | -a <endpoint>] [-n <id>] [-g <group>]... [-c]"\
+"\n		[-f <Hz>] [-T <endpoint> [-F <Hz>]] [-R] [-p <prio>[@<cpu>]] [-q <prio>[@<cpu>]]"\
+"\n	-e	joy_node endpoint to connect to, tcp:// or ipc://"\
+"\n		(default %s)"\
+"\n	-s	take latest state from shared memory of joy_node -s instead,"\
+"\n		when both run on the same host"\
+"\n	-a	take commands of joy_node -a at endpoint instead, and ack each"\
+"\n		once applied to the GPIO; joy_node retries those not acked"\
+"\n	-n	node id, also take states joy_node -t %s<id> sends;"\
+"\n		telemetry topic is %s<id>, host name without -n"\
+"\n	-g	group, also take states joy_node -t %s<group> sends,"\
+"\n		can be repeated; %s ones are always taken"\
+"\n	-c	conflate, keep only the newest message in receive queue;"\
+"\n		a slow wiper_node then never works through stale axis"\
+"\n		positions, but lost counts include the dropped messages"\
+"\n	-f	refresh loop rate (default %d Hz), also of limit switch reads"\
+"\n	-T	send telemetry to wiper_mon at endpoint: motor and limit switch"\
+"\n		transitions, time in each state, command to actuation latency"\
+"\n	-F	telemetry rate, windows per second (default %d Hz)"\
+"\n	-R	real-time profile: SCHED_FIFO, mlockall and prefault"\
+"\n	-p	actuator (epoll loop) priority and CPU (default %d, any CPU)"\
+"\n	-q	reader (ZeroMQ I/O thread) priority and CPU (default %d, any CPU),"\
+"\n		in wiper_launch set by wiper_launch -q instead"\
+"\n"\
+"\nSend SIGUSR1 to print receive, per-stage latency and loop jitter statistics.\n",
+        ZMQ_ENDPOINT,
+        JOY_MSG__TOPIC_NODE,
+        WIPER_TLM__TOPIC,
+        JOY_MSG__TOPIC_GROUP,
+        JOY_MSG__TOPIC_ALL,
+        DEFAULT_RATE_HZ,
+        DEFAULT_TLM_RATE_HZ,
+        RT_PROFILE__ACTUATOR_PRIO,
+        RT_PROFILE__READER_PRIO
+    );
+}
+
+static int wiper_node__init(int argc, char** argv, void* context) {
+    const char* endpoint = ZMQ_ENDPOINT;
+    const char* shm_name = NULL;
+    const char* cmd_endpoint = NULL;
+    int conflate = 0;
+    num_of_topics = 0;
+    joy_msg__topic(topics[num_of_topics++], JOY_MSG__TOPIC_ALL, "");
+    int rate_hz = DEFAULT_RATE_HZ;
+    const char* tlm_endpoint = NULL;
+    int tlm_rate_hz = DEFAULT_TLM_RATE_HZ;
+    rt_profile__thread_t reader_thread = { RT_PROFILE__READER_PRIO, -1 };
+    int reader_set = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:s:a:n:g:cf:T:F:Rp:q:h")) != -1) {
+        switch (opt) {
+            case 'e':
+                endpoint = optarg;
+                break;
+            case 's':
+                shm_name = optarg;
+                break;
+            case 'a':
+                cmd_endpoint = optarg;
+                break;
+            case 'n':
+            case 'g':
+                if (num_of_topics == MAX_TOPICS) {
+                    fprintf(stderr, "ERROR: At most %d groups!\n", MAX_GROUPS);
+                    return -1;
                 }
-                // printf("Received number of buttons: %d\n", num_of_buttons);
-                // printf("Allocating button_states for %d bytes at %p\n", num_of_buttons, (void*)button_states);
-                button_states = (char*)malloc((num_of_buttons+1) * sizeof(char));
-                if (button_states == NULL) {
-                    perror("Memory allocation failed for button_states");
-                    free(buffer);
-                    pthread_mutex_unlock(&cmd_mtx);
-                    zmq_msg_close(&msg);
-                    zmq_close(subscriber);
-                    zmq_ctx_destroy(context);
-                    return NULL;
+                if (joy_msg__topic(
+                    topics[num_of_topics++],
+                    opt == 'n' ? JOY_MSG__TOPIC_NODE : JOY_MSG__TOPIC_GROUP,
+                    optarg
+                ) != 0) {
+                    fprintf(stderr, "ERROR: Too long name \"%s\"!\n", optarg);
+                    return -1;
                 }
-                // printf("Allocated button_states at %p\n", (void*)button_states);
-            } else { // Subsequent messages are button states
-                if (bytes != num_of_buttons) {
-                    printf("Reallocating button_states: current size %d, new size %d, old pointer %p\n",
-                           num_of_buttons, bytes, (void*)button_states);
-                    free(button_states);
-                    button_states = NULL; // Prevent invalid pointer
-                    num_of_buttons = bytes;
-                    button_states = (char*)malloc((num_of_buttons+1) * sizeof(char));
-                    if (button_states == NULL) {
-                        perror("Memory reallocation failed for button_states");
-                        free(buffer);
-                        pthread_mutex_unlock(&cmd_mtx);
-                        zmq_msg_close(&msg);
-                        zmq_close(subscriber);
-                        zmq_ctx_destroy(context);
-                        return NULL;
-                    }
-                    printf("Reallocated button_states at %p\n", (void*)button_states);
+                if (opt == 'n') {
+                    node_id = optarg;
                 }
-                memcpy(button_states, zmq_msg_data(&msg), num_of_buttons);
-                button_states[num_of_buttons] = '\0'; // Ensure null termination
-                printf("Received button states: %s\n", button_states);
-            }
-            pthread_mutex_unlock(&cmd_mtx);
-            free(buffer); // Free the dynamic buffer
+                break;
+            case 'c':
+                conflate = 1;
+                break;
+            case 'f':
+                rate_hz = atoi(optarg);
+                if (rate_hz <= 0) {
+                    fprintf(stderr, "ERROR: Invalid rate \"%s\"!\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'T':
+                tlm_endpoint = optarg;
+                break;
+            case 'F':
+                tlm_rate_hz = atoi(optarg);
+                if (tlm_rate_hz <= 0) {
+                    fprintf(stderr, "ERROR: Invalid rate \"%s\"!\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'R':
+                rt = 1;
+                break;
+            case 'p':
+            case 'q':
+                if (rt_profile__parse_thread(optarg, opt == 'p' ? &actuator_thread : &reader_thread)) {
+                    fprintf(stderr, "ERROR: Invalid priority \"%s\"!\n", optarg);
+                    return -1;
+                }
+                reader_set |= opt == 'q';
+                break;
+            case 'h':
+                usage(stdout);
+                return 1;
+            default:
+                usage(stderr);
+                return -1;
         }
-        zmq_msg_close(&msg);
     }
 
-    zmq_close(subscriber);
-    zmq_ctx_destroy(context);
-    return NULL;
-}
+    for (int i = 0; i < WIPER_STAGE__COUNT; i++) {
+        trace_hist__reset(&wiper_stages[i]);
+    }
+
+    if (!node_id) {
+        // Node ids are short, so a long host name is cut to fit the topic.
+        if (gethostname(host, sizeof(host)) != 0) {
+            strcpy(host, "wiper");
+        }
+        host[JOY_MSG__TOPIC_SIZE - sizeof(WIPER_TLM__TOPIC)] = '\0';
+        node_id = host;
+    }
+    if (wiper_tlm__init(&tlm, node_id, periodic__now_ns()) != 0) {
+        fprintf(stderr, "ERROR: Too long name \"%s\"!\n", node_id);
+        return -1;
+    }
+    atomic_store(&stop_requested, 0);
+    atomic_store(&stats_requested, 0);
+
+    // Before the loop's thread exists, so that its stack gets locked too.
+    if (rt && rt_profile__lock_memory() != 0) {
+        perror("Failed to lock memory");
+    }
+    // Formatter on any CPU, started from here, not from the pinned loop.
+    int e = rt_log__start(stdout);
+    if (e != 0) {
+        fprintf(stderr, "Failed to start logger: %s\n", strerror(e));
+        return -1;
+    }
 
-int main() {
-    int gpio_fd = open(DEV_STREAM_FN, O_RDWR);
+    gpio_fd = open(DEV_STREAM_FN, O_RDWR);
     if (gpio_fd < 0) {
         perror("Failed to open /dev/gpio_stream");
-        return EXIT_FAILURE;
+        goto fail;
     }
 
-    pthread_t subscriber;
-    if (pthread_create(&subscriber, NULL, zmq_subscriber, NULL) != 0) {
-        perror("Failed to create subscriber thread");
-        close(gpio_fd);
-        return EXIT_FAILURE;
+    // ZeroMQ's I/O thread is the reader here. Its scheduling is set on the
+    // context, before the first socket starts the thread. Sockets of other
+    // components in wiper_launch may have, so there it is up to the host.
+#ifndef COMPONENT__NO_MAIN
+    if (rt && (!shm_name || tlm_endpoint)) {
+        component__io_rt(context, reader_thread.prio, reader_thread.cpu);
+    }
+#else
+    if (reader_set) {
+        printf("-q has no effect in wiper_launch, see wiper_launch -q\n");
+    }
+#endif
+
+    if (shm_name) {
+        shm = shm_state__open(shm_name, 0);
+        if (!shm) {
+            perror("Failed to open shared memory state, is joy_node -s running?");
+            goto fail;
+        }
+        printf("Reading state from shm %s...\n", shm_name);
+    } else if (cmd_endpoint) {
+        dealer = zmq_socket(context, ZMQ_DEALER);
+        if (!dealer) {
+            perror("Failed to create ZeroMQ socket");
+            goto fail;
+        }
+        // joy_node tells nodes apart by routing id, must be set before
+        // connecting. Acks left unsent on exit are of no use.
+        int linger = 0;
+        if (
+            zmq_setsockopt(dealer, ZMQ_ROUTING_ID, node_id, strlen(node_id)) != 0 ||
+            zmq_setsockopt(dealer, ZMQ_LINGER, &linger, sizeof(linger)) != 0
+        ) {
+            perror("Failed to set up ZeroMQ socket");
+            goto fail;
+        }
+        if (zmq_connect(dealer, cmd_endpoint) != 0) {
+            fprintf(stderr, "Failed to connect ZeroMQ socket to %s: %s\n",
+                    cmd_endpoint, zmq_strerror(zmq_errno()));
+            goto fail;
+        }
+        size_t zmq_fd_size = sizeof(zmq_fd);
+        if (zmq_getsockopt(dealer, ZMQ_FD, &zmq_fd, &zmq_fd_size) != 0) {
+            perror("Failed to get ZMQ_FD");
+            goto fail;
+        }
+        say_hello(dealer, topics, num_of_topics);
+        hello_ns = periodic__now_ns();
+        printf("Taking commands from %s as %s...\n", cmd_endpoint, node_id);
+    } else {
+        subscriber = zmq_socket(context, ZMQ_SUB);
+        if (!subscriber) {
+            perror("Failed to create ZeroMQ socket");
+            goto fail;
+        }
+        // Must be set before connecting.
+        if (conflate && zmq_setsockopt(subscriber, ZMQ_CONFLATE, &conflate, sizeof(conflate)) != 0) {
+            perror("Failed to set ZMQ_CONFLATE");
+            goto fail;
+        }
+        if (zmq_connect(subscriber, endpoint) != 0) {
+            fprintf(stderr, "Failed to connect ZeroMQ socket to %s: %s\n",
+                    endpoint, zmq_strerror(zmq_errno()));
+            goto fail;
+        }
+        // Whole topics, filtered at the publisher.
+        for (int i = 0; i < num_of_topics; i++) {
+            if (zmq_setsockopt(subscriber, ZMQ_SUBSCRIBE, topics[i], JOY_MSG__TOPIC_SIZE) != 0) {
+                perror("Failed to set ZMQ_SUBSCRIBE");
+                goto fail;
+            }
+            printf("Subscribed to %s\n", topics[i]);
+        }
+        size_t zmq_fd_size = sizeof(zmq_fd);
+        if (zmq_getsockopt(subscriber, ZMQ_FD, &zmq_fd, &zmq_fd_size) != 0) {
+            perror("Failed to get ZMQ_FD");
+            goto fail;
+        }
+
+        printf("Connected and listening on %s...\n", endpoint);
+    }
+
+    if (tlm_endpoint) {
+        tlm_socket = tlm_open(context, tlm_endpoint);
+        if (!tlm_socket) {
+            goto fail;
+        }
+        if (periodic__init(&tlm_loop, tlm_rate_hz, 1) != 0) {
+            perror("Failed to create telemetry timer");
+            goto fail;
+        }
+        printf("Telemetry %s to %s at %d Hz\n", tlm.msg.topic, tlm_endpoint, tlm_rate_hz);
+    }
+
+    // Absolute deadlines, so the period does not stretch by the loop body.
+    if (periodic__init(&loop, rate_hz, 1) != 0) {
+        perror("Failed to create loop timer");
+        goto fail;
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        perror("Failed to create eventfd");
+        goto fail;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("Failed to create epoll");
+        goto fail;
+    }
+    if (
+        (zmq_fd >= 0 && epoll_add(epoll_fd, zmq_fd) != 0) ||
+        epoll_add(epoll_fd, loop.fd) != 0 ||
+        (tlm_socket && epoll_add(epoll_fd, tlm_loop.fd) != 0) ||
+        epoll_add(epoll_fd, wake_fd) != 0
+    ) {
+        perror("Failed to add fd to epoll");
+        goto fail;
+    }
+    // gpio_stream has no poll() yet, so the kernel refuses it with EPERM.
+    gpio_polled = epoll_add(epoll_fd, gpio_fd) == 0;
+    if (!gpio_polled) {
+        printf("%s is not pollable, GPIO events disabled\n", DEV_STREAM_FN);
+    }
+
+    return 0;
+
+fail:
+    cleanup();
+    return -1;
+}
+
+static int wiper_node__run(void) {
+    int r = EXIT_FAILURE;
+    rt_log__thread_init();
+    if (rt) {
+        int e = rt_profile__set_thread(pthread_self(), &actuator_thread);
+        if (e != 0) {
+            fprintf(stderr, "Failed to set real-time scheduling: %s\n", strerror(e));
+        }
+        rt_profile__log(stdout);
+    }
+
+    // Messages may already be queued before the first edge on ZMQ_FD.
+    if (subscriber && drain_subscriber(subscriber, gpio_fd) != 0) {
+        goto exit;
+    }
+    if (dealer && drain_commands(dealer, gpio_fd) != 0) {
+        goto exit;
     }
 
-    volatile int running = 1;
+    int running = 1;
     while (running) {
-        pthread_mutex_lock(&cmd_mtx);
-        if (num_of_buttons > 0 && button_states != NULL) {
-            for (int i = 0; i < num_of_buttons && i < 3; i++) { // Limit to 3 buttons
-                if (button_states[i] == '1' && (i == 0 || i == 1 || i == 2)) {
-                    printf("Button %d pressed\n", i);
-                    switch (i) {
-                        case 0: // BUTTON_CCW
-                            gpio_write(gpio_fd, 3, 1); // CCW
-                            gpio_write(gpio_fd, 4, 0); // CCW
-                            gpio_write(gpio_fd, 2, 1); // EN = 1
-                            break;
-                        case 1: // BUTTON_CW
-                            gpio_write(gpio_fd, 3, 0); // CW
-                            gpio_write(gpio_fd, 4, 1); // CW
-                            gpio_write(gpio_fd, 2, 1); // EN = 1
-                            break;
-                        case 2: // BUTTON_STOP
-                            gpio_write(gpio_fd, 2, 0); // EN = 0
-                            break;
+        int timeout = -1;
+        if (shm) {
+            // Shared memory has no fd to epoll on. Sleep on its futex, at
+            // most until the next deadline, then only peek at the other fds.
+            shm_state__wait(shm, shm_seen, periodic__ms_to_next(&loop));
+            drain_shm(shm, &shm_seen, gpio_fd);
+            timeout = 0;
+        }
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            goto exit;
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (subscriber && fd == zmq_fd) {
+                if (drain_subscriber(subscriber, gpio_fd) != 0) {
+                    goto exit;
+                }
+            } else if (dealer && fd == zmq_fd) {
+                if (drain_commands(dealer, gpio_fd) != 0) {
+                    goto exit;
+                }
+            } else if (fd == loop.fd) {
+                if (periodic__tick(&loop) > 0) {
+                    apply_buttons(gpio_fd);
+                    if (tlm_socket) {
+                        read_limit(gpio_fd);
                     }
+                    uint64_t now_ns = periodic__now_ns();
+                    if (dealer && now_ns - hello_ns >= JOY_CMD__HELLO_PERIOD_MS*1000000ULL) {
+                        say_hello(dealer, topics, num_of_topics);
+                        hello_ns = now_ns;
+                        // Sending may have consumed the edge of a command.
+                        if (drain_commands(dealer, gpio_fd) != 0) {
+                            goto exit;
+                        }
+                    }
+                }
+            } else if (tlm_socket && fd == tlm_loop.fd) {
+                if (
+                    periodic__tick(&tlm_loop) > 0 &&
+                    wiper_tlm__send(&tlm, tlm_socket, periodic__now_ns()) != 0
+                ) {
+                    RT_LOG__ERROR("Failed to send telemetry, errno %d\n", errno);
+                }
+            } else if (fd == wake_fd) {
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) != sizeof(count)) {
+                    continue;
+                }
+                if (atomic_exchange(&stats_requested, 0)) {
+                    print_stats();
+                }
+                if (atomic_load(&stop_requested)) {
+                    running = 0;
+                }
+            } else if (gpio_polled && fd == gpio_fd) {
+                uint8_t rd_val;
+                if (read(gpio_fd, &rd_val, sizeof(rd_val)) == sizeof(rd_val)) {
+                    RT_LOG__INFO("GPIO event, rd_val = %d\n", rd_val);
                 }
             }
         }
-        pthread_mutex_unlock(&cmd_mtx);
-        usleep(10000);
     }
 
-    pthread_join(subscriber, NULL);
-    if (button_states != NULL) {
-        printf("Freeing button_states at %p\n", (void*)button_states);
-        free(button_states);
-        button_states = NULL;
+    r = EXIT_SUCCESS;
+    if (tlm_socket) {
+        // Last, partial window, so that the monitor gets its transitions.
+        wiper_tlm__send(&tlm, tlm_socket, periodic__now_ns());
     }
-    close(gpio_fd);
-    pthread_mutex_destroy(&cmd_mtx);
 
-    return 0;
+exit:
+    // Log flushed before, loop and telemetry closed after the statistics.
+    rt_log__stop();
+    print_stats();
+    cleanup();
+
+    return r;
+}
+
+static void wiper_node__shutdown(void) {
+    atomic_store(&stop_requested, 1);
+    wake();
 }
 
+static void wiper_node__print_stats(void) {
+    atomic_store(&stats_requested, 1);
+    wake();
+}
+
+const component_t wiper_node__component = {
+    .name = "wiper_node",
+    .init = wiper_node__init,
+    .run = wiper_node__run,
+    .shutdown = wiper_node__shutdown,
+    .print_stats = wiper_node__print_stats,
+};
+
+#ifndef COMPONENT__NO_MAIN
+int main(int argc, char** argv) {
+    return component__main(&wiper_node__component, argc, argv);
+}
+#endif
@@ -0,0 +1,188 @@
+
+#ifndef SWITCH_SAMPLER_H
+#define SWITCH_SAMPLER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include "../../../Driver/gpio_ctrl/include/gpio_ctrl.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Waits for a switch on /dev/gpio_stream to reach a level.
+//
+// If the driver can poll(), the sampler sleeps in epoll_wait() until the
+// driver signals an edge, and only then reads the level. gpio_stream has
+// no poll() yet, so otherwise it polls: a read per period, which is the
+// shortest one while nothing is known, and backs off while the switch is
+// expected far away, up to the longest one, tightening as the expected
+// time of the edge comes near.
+
+// Switches short to 3V3, so they are read with pull-down, see 3_Limit_SW.
+#define SWITCH_SAMPLER__READ_OP 'd'
+// Expected edges are polled at the shortest period from this long before,
+// or from an eighth of the expected time before, whichever is longer, as
+// strokes vary with load and where the wiper came to rest.
+#define SWITCH_SAMPLER__GUARD_NS 20000000ULL
+#define SWITCH_SAMPLER__GUARD_DIV 8
+
+typedef struct {
+	int fd;       // /dev/gpio_stream.
+	int epoll_fd; // Waits for edges, -1 if the driver cannot poll().
+	uint64_t min_period_ns;
+	uint64_t max_period_ns;
+	uint64_t samples;  // Reads of a level.
+	uint64_t wakeups;  // Edges signalled by the driver.
+	uint64_t max_gap_ns; // Longest period polled, bound on detection lag.
+} switch_sampler_t;
+
+static inline uint64_t switch_sampler__now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static inline void switch_sampler__sleep_until(uint64_t t_ns) {
+	struct timespec ts = {
+		.tv_sec = t_ns/1000000000ULL,
+		.tv_nsec = t_ns%1000000000ULL
+	};
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR){
+	}
+}
+
+/**
+ * @return 0 if Ok, -1 with errno set.
+ */
+static inline int switch_sampler__init(
+	switch_sampler_t* s,
+	int fd,
+	uint64_t min_period_ns,
+	uint64_t max_period_ns
+) {
+	memset(s, 0, sizeof(*s));
+	s->fd = fd;
+	s->min_period_ns = min_period_ns;
+	s->max_period_ns = max_period_ns > min_period_ns ? max_period_ns : min_period_ns;
+	s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(s->epoll_fd < 0){
+		return -1;
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if(epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0){
+		// EPERM: no poll() in the driver, so poll here instead.
+		close(s->epoll_fd);
+		s->epoll_fd = -1;
+	}
+	return 0;
+}
+
+static inline void switch_sampler__close(switch_sampler_t* s) {
+	if(s->epoll_fd >= 0){
+		close(s->epoll_fd);
+		s->epoll_fd = -1;
+	}
+}
+
+/**
+ * @return 0 if Ok, -1 on error.
+ */
+static inline int switch_sampler__read(switch_sampler_t* s, uint8_t pin, uint8_t* level) {
+	uint8_t pkg[2] = { SWITCH_SAMPLER__READ_OP, pin };
+	if(write(s->fd, pkg, sizeof(pkg)) != sizeof(pkg)){
+		return -1;
+	}
+	if(read(s->fd, level, 1) != 1){
+		return -1;
+	}
+	s->samples++;
+	*level = *level != 0;
+	return 0;
+}
+
+/**
+ * Period to poll at, @a elapsed_ns after start, with the edge expected
+ * @a expect_ns after start, or 0 if not known.
+ */
+static inline uint64_t switch_sampler__period(
+	const switch_sampler_t* s,
+	uint64_t elapsed_ns,
+	uint64_t expect_ns
+) {
+	uint64_t guard_ns = expect_ns/SWITCH_SAMPLER__GUARD_DIV;
+	if(guard_ns < SWITCH_SAMPLER__GUARD_NS){
+		guard_ns = SWITCH_SAMPLER__GUARD_NS;
+	}
+	if(!expect_ns || elapsed_ns + guard_ns >= expect_ns){
+		return s->min_period_ns;
+	}
+	// A quarter of what is left, so a few reads land before the guard.
+	uint64_t period_ns = (expect_ns - guard_ns - elapsed_ns)/4;
+	if(period_ns < s->min_period_ns){
+		return s->min_period_ns;
+	}
+	return period_ns < s->max_period_ns ? period_ns : s->max_period_ns;
+}
+
+/**
+ * Wait until @a pin reads @a level, from @a start_ns on, the edge expected
+ * @a expect_ns after it, or 0 if not known.
+ * @return 1 and when it was seen in @a t_ns, 0 if not in @a timeout_ns,
+ * -1 on error.
+ */
+static inline int switch_sampler__wait(
+	switch_sampler_t* s,
+	uint8_t pin,
+	uint8_t level,
+	uint64_t start_ns,
+	uint64_t expect_ns,
+	uint64_t timeout_ns,
+	uint64_t* t_ns
+) {
+	uint64_t deadline_ns = start_ns + timeout_ns;
+	while(1){
+		uint8_t v;
+		if(switch_sampler__read(s, pin, &v) != 0){
+			return -1;
+		}
+		uint64_t now_ns = switch_sampler__now_ns();
+		if(v == level){
+			*t_ns = now_ns;
+			return 1;
+		}
+		if(now_ns >= deadline_ns){
+			return 0;
+		}
+
+		if(s->epoll_fd >= 0){
+			// Level read above, so an edge after it wakes this up.
+			struct epoll_event ev;
+			int ms = (deadline_ns - now_ns + 999999)/1000000;
+			int n = epoll_wait(s->epoll_fd, &ev, 1, ms);
+			if(n < 0 && errno != EINTR){
+				return -1;
+			}
+			if(n > 0){
+				s->wakeups++;
+			}
+			continue;
+		}
+
+		uint64_t period_ns = switch_sampler__period(s, now_ns - start_ns, expect_ns);
+		if(period_ns > s->max_gap_ns){
+			s->max_gap_ns = period_ns;
+		}
+		uint64_t next_ns = now_ns + period_ns;
+		switch_sampler__sleep_until(next_ns < deadline_ns ? next_ns : deadline_ns);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // SWITCH_SAMPLER_H
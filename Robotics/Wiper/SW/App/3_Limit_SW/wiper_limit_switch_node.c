@@ -1,96 +1,346 @@
 
 #include <stdint.h> // uint16_t and family
 #include <stdio.h> // printf and family
+#include <stdlib.h> // atoi()
 #include <unistd.h> // file ops
 #include <fcntl.h> // open() flags
 #include <string.h> // strerror()
 #include <errno.h> // errno
 
+#include "switch_sampler.h"
 
-#define DEV_STREAM_FN "/dev/gpio_stream"
+#define PIN_EN 2
+#define PIN_CCW 3
+#define PIN_CW 4
+#define DEFAULT_PIN_LIMIT 22
+// Park switch is not wired to the Pi yet, this is where it would go.
+#define DEFAULT_PIN_PARK 23
 
-int main()
+#define DEFAULT_CAL_FN "wiper_limit_switch.cal"
+#define DEFAULT_STROKES 3
+#define DEFAULT_TIMEOUT_MS 5000
+#define DEFAULT_MIN_PERIOD_US 100
+#define DEFAULT_MAX_PERIOD_US 20000
+
+// Wiper comes to rest after a stop within this.
+#define SETTLE_US 200000
+
+// Full strokes, timed from start at rest until the switch at the other end.
+typedef struct {
+    uint64_t stroke_cw_ns;  // Park to limit.
+    uint64_t stroke_ccw_ns; // Limit to park.
+} calibration_t;
+
+static int fd = -1;
+static switch_sampler_t sampler;
+static uint8_t pin_limit = DEFAULT_PIN_LIMIT;
+static uint8_t pin_park = DEFAULT_PIN_PARK;
+static uint64_t timeout_ns = DEFAULT_TIMEOUT_MS*1000000ULL;
+
+static int gpio_write(uint8_t pin, uint8_t value) {
+    uint8_t pkg[3] = {GPIO_CTRL__WRITE, pin, value};
+    if(write(fd, pkg, sizeof(pkg)) != sizeof(pkg)){
+        fprintf(stderr, "ERROR: write went wrong!\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Direction first, then enable, so the bridge never drives the other way.
+ * @return 0 if Ok, -1 on error.
+ */
+static int motor__cw(void) {
+    if(gpio_write(PIN_CCW, 0) || gpio_write(PIN_CW, 1) || gpio_write(PIN_EN, 1)){
+        return -1;
+    }
+    return 0;
+}
+
+static int motor__ccw(void) {
+    if(gpio_write(PIN_CW, 0) || gpio_write(PIN_CCW, 1) || gpio_write(PIN_EN, 1)){
+        return -1;
+    }
+    return 0;
+}
+
+static int motor__stop(void) {
+    return gpio_write(PIN_EN, 0);
+}
+
+/**
+ * Drive until @a pin is shorted, then stop.
+ * @return 1 and the stroke time in @a stroke_ns, 0 on timeout, -1 on error.
+ */
+static int stroke(int cw, uint8_t pin, uint64_t expect_ns, uint64_t* stroke_ns) {
+    uint64_t start_ns = switch_sampler__now_ns();
+    if(cw ? motor__cw() : motor__ccw()){
+        return -1;
+    }
+    uint64_t t_ns = 0;
+    int r = switch_sampler__wait(&sampler, pin, 1, start_ns, expect_ns, timeout_ns, &t_ns);
+    // Stop on timeout and error too.
+    if(motor__stop() != 0){
+        return -1;
+    }
+    if(r == 1){
+        *stroke_ns = t_ns - start_ns;
+    }else if(r == 0){
+        fprintf(stderr, "ERROR: no %s switch within %llu ms!\n",
+            pin == pin_park ? "park" : "limit",
+            (unsigned long long)(timeout_ns/1000000));
+    }else{
+        fprintf(stderr, "ERROR: read went wrong!\n");
+    }
+    return r;
+}
+
+/**
+ * @return 0 if Ok, -1 if missing or invalid.
+ */
+static int calibration__load(const char* fn, calibration_t* cal) {
+    FILE* f = fopen(fn, "r");
+    if(!f){
+        return -1;
+    }
+    memset(cal, 0, sizeof(*cal));
+    char line[128];
+    unsigned long long v;
+    while(fgets(line, sizeof(line), f)){
+        if(sscanf(line, "stroke_cw_ns=%llu", &v) == 1){
+            cal->stroke_cw_ns = v;
+        }else if(sscanf(line, "stroke_ccw_ns=%llu", &v) == 1){
+            cal->stroke_ccw_ns = v;
+        }
+    }
+    fclose(f);
+    return cal->stroke_cw_ns && cal->stroke_ccw_ns ? 0 : -1;
+}
+
+static int calibration__save(const char* fn, const calibration_t* cal) {
+    FILE* f = fopen(fn, "w");
+    if(!f){
+        fprintf(stderr, "ERROR: \"%s\" not saved: %s\n", fn, strerror(errno));
+        return -1;
+    }
+    fprintf(f, "stroke_cw_ns=%llu\n", (unsigned long long)cal->stroke_cw_ns);
+    fprintf(f, "stroke_ccw_ns=%llu\n", (unsigned long long)cal->stroke_ccw_ns);
+    if(fclose(f) != 0){
+        fprintf(stderr, "ERROR: \"%s\" not saved: %s\n", fn, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Back to park, then @a strokes times to limit and back, each timed by
+ * the switches. The first stroke each way is polled at the shortest
+ * period, the rest back off on the average so far.
+ * @return 0 if Ok, -1 on error.
+ */
+static int home(int strokes, calibration_t* cal) {
+    uint64_t stroke_ns;
+    printf("Homing: back to park\n");
+    if(stroke(0, pin_park, 0, &stroke_ns) != 1){
+        return -1;
+    }
+    usleep(SETTLE_US);
+
+    uint64_t sum_cw_ns = 0;
+    uint64_t sum_ccw_ns = 0;
+    for(int i = 0; i < strokes; i++){
+        uint64_t expect_ns = i ? sum_cw_ns/i : 0;
+        if(stroke(1, pin_limit, expect_ns, &stroke_ns) != 1){
+            return -1;
+        }
+        sum_cw_ns += stroke_ns;
+        printf("Stroke %d to limit: %.1f ms\n", i, stroke_ns/1e6);
+        usleep(SETTLE_US);
+
+        expect_ns = i ? sum_ccw_ns/i : 0;
+        if(stroke(0, pin_park, expect_ns, &stroke_ns) != 1){
+            return -1;
+        }
+        sum_ccw_ns += stroke_ns;
+        printf("Stroke %d to park: %.1f ms\n", i, stroke_ns/1e6);
+        usleep(SETTLE_US);
+    }
+    cal->stroke_cw_ns = sum_cw_ns/strokes;
+    cal->stroke_ccw_ns = sum_ccw_ns/strokes;
+    return 0;
+}
+
+/**
+ * Open loop, from park: CW for @a percent of the stroke time, no sampling.
+ * @return 0 if Ok, -1 on error.
+ */
+static int go_to(double percent, const calibration_t* cal) {
+    uint8_t at_park;
+    if(switch_sampler__read(&sampler, pin_park, &at_park) != 0){
+        fprintf(stderr, "ERROR: read went wrong!\n");
+        return -1;
+    }
+    if(!at_park){
+        fprintf(stderr, "ERROR: not at park, home first!\n");
+        return -1;
+    }
+    uint64_t start_ns = switch_sampler__now_ns();
+    if(motor__cw() != 0){
+        return -1;
+    }
+    switch_sampler__sleep_until(start_ns + (uint64_t)(cal->stroke_cw_ns*percent/100));
+    return motor__stop();
+}
+
+static void usage(FILE* f) {
+    fprintf(f,
+"\nUsage: "\
+"\n	wiper_limit_switch_node [-H] [-n <strokes>] [-g <percent>] [-c <file>]"\
+"\n		[-l <pin>] [-p <pin>] [-t <ms>] [-m <us>] [-M <us>]"\
+"\n	-H	home: time full strokes between park and limit, save calibration"\
+"\n	-n	strokes to average when homing (default %d)"\
+"\n	-g	open loop move from park, percent of the stroke, no sampling"\
+"\n	-c	calibration file (default %s)"\
+"\n	-l	limit switch pin (default %d)"\
+"\n	-p	park switch pin (default %d)"\
+"\n	-t	time limit of a stroke (default %d ms)"\
+"\n	-m	shortest poll period (default %d us)"\
+"\n	-M	longest poll period, while the switch is far (default %d us)"\
+"\n"\
+"\nWithout -H and -g, drives CW until the limit switch, then stops. With a"\
+"\ncalibration, starting at park, polls back off until near the limit.\n",
+        DEFAULT_STROKES,
+        DEFAULT_CAL_FN,
+        DEFAULT_PIN_LIMIT,
+        DEFAULT_PIN_PARK,
+        DEFAULT_TIMEOUT_MS,
+        DEFAULT_MIN_PERIOD_US,
+        DEFAULT_MAX_PERIOD_US
+    );
+}
+
+int main(int argc, char** argv)
 {
-    int fd,r;
-	fd = open(DEV_STREAM_FN, O_RDWR);
-	if(fd < 0){
-		fprintf(stderr, "ERROR: \"%s\" not opened!\n", DEV_STREAM_FN);
-		fprintf(stderr, "fd = %d %s\n", fd, strerror(-fd));
-		return 4;
-	}
-
-    uint8_t first_command[3] = {'w', 4, 1}; 
-    uint8_t second_command[3] = {'w', 3, 0}; 
-    uint8_t third_command[3] = {'w', 2, 1};
-    uint8_t fourth_command[2] = {'d', 22};
-    uint8_t fifth_command[3] = {'w', 2, 0};
-
-
-	r = write(fd, first_command, sizeof(first_command));
-	if(r != sizeof(first_command)){
-		fprintf(stderr, "ERROR: write went wrong!\n");
-		return 4;
-	}
-    usleep(100000);
-
-    printf("Stigli smo do ovde : 1\n");
-
-    r = write(fd, second_command, sizeof(second_command));
-	if(r != sizeof(second_command)){
-		fprintf(stderr, "ERROR: write went wrong!\n");
-		return 4;
-	}
-    usleep(100000);
-
-    printf("Stigli smo do ovde: 2\n");
-
-    r = write(fd, third_command, sizeof(third_command));
-	if(r != sizeof(third_command)){
-		fprintf(stderr, "ERROR: write went wrong!\n");
-		return 4;
-	}
-    usleep(100000); 
-
-
-    printf("Stigli smo do ovde : 3\n");
-
-    uint8_t rd_val=0;
-
-    while(1)
-    {
-        r = write(fd, fourth_command, sizeof(fourth_command));
-	    if(r != sizeof(fourth_command)){
-		    fprintf(stderr, "ERROR: write went wrong!\n");
-		    return 4;
-	    }
-        usleep(100); 
-
-		r = read(fd, (char*)&rd_val, sizeof(rd_val));
-        if(r != sizeof(rd_val)){
-			fprintf(stderr, "ERROR: read went wrong!\n");
-			return 5;
-		}
-
-
-        if(rd_val)
-        {
-            printf("Doslo je do stanja 1\n");
-            break;
+    int homing = 0;
+    int strokes = DEFAULT_STROKES;
+    double go_percent = -1;
+    const char* cal_fn = DEFAULT_CAL_FN;
+    uint64_t min_period_ns = DEFAULT_MIN_PERIOD_US*1000ULL;
+    uint64_t max_period_ns = DEFAULT_MAX_PERIOD_US*1000ULL;
+    int opt;
+    while((opt = getopt(argc, argv, "Hn:g:c:l:p:t:m:M:h")) != -1){
+        switch(opt){
+            case 'H':
+                homing = 1;
+                break;
+            case 'n':
+                strokes = atoi(optarg);
+                break;
+            case 'g':
+                go_percent = atof(optarg);
+                break;
+            case 'c':
+                cal_fn = optarg;
+                break;
+            case 'l':
+                pin_limit = atoi(optarg);
+                break;
+            case 'p':
+                pin_park = atoi(optarg);
+                break;
+            case 't':
+                timeout_ns = atoi(optarg)*1000000ULL;
+                break;
+            case 'm':
+                min_period_ns = atoi(optarg)*1000ULL;
+                break;
+            case 'M':
+                max_period_ns = atoi(optarg)*1000ULL;
+                break;
+            case 'h':
+                usage(stdout);
+                return 0;
+            default:
+                usage(stderr);
+                return 1;
         }
+    }
+    if(strokes <= 0 || timeout_ns == 0 || min_period_ns == 0 || (go_percent >= 0 && homing)){
+        usage(stderr);
+        return 1;
+    }
+    if(go_percent > 100){
+        go_percent = 100;
+    }
 
-        printf("Trenutna vrednost je nula\n");
+    int ret = 0;
+    calibration_t cal;
+    int calibrated = calibration__load(cal_fn, &cal) == 0;
+    if(!homing && go_percent >= 0 && !calibrated){
+        fprintf(stderr, "ERROR: no calibration in \"%s\", home first!\n", cal_fn);
+        return 1;
+    }
 
+    fd = open(DEV_STREAM_FN, O_RDWR);
+    if(fd < 0){
+        fprintf(stderr, "ERROR: \"%s\" not opened!\n", DEV_STREAM_FN);
+        fprintf(stderr, "fd = %d %s\n", fd, strerror(errno));
+        return 4;
     }
+    if(switch_sampler__init(&sampler, fd, min_period_ns, max_period_ns) != 0){
+        perror("epoll_create1() failed");
+        close(fd);
+        return 4;
+    }
+    printf(
+        "Switches: %s\n",
+        sampler.epoll_fd >= 0 ? "edge events" : "polled, driver has no poll()"
+    );
 
-    r = write(fd, fifth_command, sizeof(fifth_command));
-	if(r != sizeof(fifth_command)){
-	    fprintf(stderr, "ERROR: write went wrong!\n");
-	    return 4;
+    if(homing){
+        if(home(strokes, &cal) != 0 || calibration__save(cal_fn, &cal) != 0){
+            ret = 4;
+            goto cleanup;
+        }
+        printf(
+            "Calibration saved to \"%s\": to limit %.1f ms, to park %.1f ms\n",
+            cal_fn,
+            cal.stroke_cw_ns/1e6,
+            cal.stroke_ccw_ns/1e6
+        );
+    }else if(go_percent >= 0){
+        if(go_to(go_percent, &cal) != 0){
+            ret = 4;
+            goto cleanup;
+        }
+        printf("Moved open loop to %.0f%% of the stroke\n", go_percent);
+    }else{
+        // Calibration holds from park only.
+        uint8_t at_park = 0;
+        if(calibrated && switch_sampler__read(&sampler, pin_park, &at_park) != 0){
+            fprintf(stderr, "ERROR: read went wrong!\n");
+            ret = 5;
+            goto cleanup;
+        }
+        uint64_t expect_ns = at_park ? cal.stroke_cw_ns : 0;
+        uint64_t stroke_ns;
+        if(stroke(1, pin_limit, expect_ns, &stroke_ns) != 1){
+            ret = 5;
+            goto cleanup;
+        }
+        printf("Limit reached in %.1f ms\n", stroke_ns/1e6);
     }
 
+    printf(
+        "Switch samples: %llu, edge events: %llu, longest poll period: %.1f ms\n",
+        (unsigned long long)sampler.samples,
+        (unsigned long long)sampler.wakeups,
+        sampler.max_gap_ns/1e6
+    );
 
-    printf("Zavrsili smo sa rotiranjem\n");
+cleanup:
+    switch_sampler__close(&sampler);
     close(fd);
 
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
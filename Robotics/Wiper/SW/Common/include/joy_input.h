@@ -0,0 +1,291 @@
+
+#ifndef JOY_INPUT_H
+#define JOY_INPUT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/joystick.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Joystick source, joydev (/dev/input/jsX) or evdev (/dev/input/eventX).
+//
+// Both come out as batches of js_event. The fd is non-blocking, so on each
+// wakeup call joy_input__read() until it returns 0, and act once per batch
+// instead of once per event:
+// - joydev: whatever is queued comes in one read(), so the JS_EVENT_INIT
+//   burst at open is one syscall and one batch,
+// - evdev: a batch ends at SYN_REPORT, so a physical report that moved
+//   several buttons and axes at once is one state update. The state at
+//   open comes as a JS_EVENT_INIT batch, like from joydev.
+// Buttons and axes of evdev are numbered in key and axis code order, and
+// axes scaled to +-32767, like joydev does.
+
+#define JOY_INPUT__MAX_BUTTONS 64
+#define JOY_INPUT__MAX_AXES 16
+// Room in batch passed to joy_input__read().
+#define JOY_INPUT__MAX_EVENTS 128
+
+typedef struct {
+	int fd;
+	int evdev;
+	int num_of_buttons;
+	int num_of_axes;
+	// evdev only.
+	int16_t key_to_button[KEY_CNT]; // -1 if not a button.
+	int8_t abs_to_axis[ABS_CNT];    // -1 if not an axis.
+	uint16_t button_to_key[JOY_INPUT__MAX_BUTTONS];
+	uint16_t axis_to_abs[JOY_INPUT__MAX_AXES];
+	int32_t abs_min[JOY_INPUT__MAX_AXES];
+	int32_t abs_max[JOY_INPUT__MAX_AXES];
+	int need_sync; // Next batch is full state, after open or SYN_DROPPED.
+	int dropping;  // Events lost, ignore rest of frame.
+	struct js_event staged[JOY_INPUT__MAX_EVENTS]; // Frame without SYN yet.
+	int num_of_staged;
+} joy_input_t;
+
+#define JOY_INPUT__TEST_BIT(bits, b) \
+	((bits)[(b)/(8*sizeof(long))] >> ((b)%(8*sizeof(long))) & 1)
+
+static inline int16_t joy_input__scale(const joy_input_t* in, int axis, int32_t v) {
+	int64_t min = in->abs_min[axis];
+	int64_t max = in->abs_max[axis];
+	if(max <= min){
+		return 0;
+	}
+	int64_t s = (v - min)*65534/(max - min) - 32767;
+	return s < -32767 ? -32767 : s > 32767 ? 32767 : (int16_t)s;
+}
+
+static inline uint32_t joy_input__time_ms(const struct input_event* ev) {
+	return (uint32_t)(ev->input_event_sec*1000 + ev->input_event_usec/1000);
+}
+
+static inline int joy_input__open_evdev(joy_input_t* in) {
+	unsigned long key_bits[KEY_CNT/(8*sizeof(long)) + 1];
+	unsigned long abs_bits[ABS_CNT/(8*sizeof(long)) + 1];
+	memset(key_bits, 0, sizeof(key_bits));
+	memset(abs_bits, 0, sizeof(abs_bits));
+	if(
+		ioctl(in->fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits) < 0 ||
+		ioctl(in->fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits) < 0
+	){
+		return -1;
+	}
+	// Same numbering as joydev: keys from BTN_MISC up, then those below.
+	memset(in->key_to_button, -1, sizeof(in->key_to_button));
+	for(int pass = 0; pass < 2; pass++){
+		int from = pass == 0 ? BTN_MISC : 0;
+		int to = pass == 0 ? KEY_MAX : BTN_MISC - 1;
+		for(int k = from; k <= to; k++){
+			if(
+				JOY_INPUT__TEST_BIT(key_bits, k) &&
+				in->num_of_buttons < JOY_INPUT__MAX_BUTTONS
+			){
+				in->key_to_button[k] = in->num_of_buttons;
+				in->button_to_key[in->num_of_buttons++] = k;
+			}
+		}
+	}
+	memset(in->abs_to_axis, -1, sizeof(in->abs_to_axis));
+	for(int a = 0; a <= ABS_MAX; a++){
+		struct input_absinfo info;
+		if(
+			!JOY_INPUT__TEST_BIT(abs_bits, a) ||
+			in->num_of_axes == JOY_INPUT__MAX_AXES ||
+			ioctl(in->fd, EVIOCGABS(a), &info) < 0
+		){
+			continue;
+		}
+		in->abs_to_axis[a] = in->num_of_axes;
+		in->axis_to_abs[in->num_of_axes] = a;
+		in->abs_min[in->num_of_axes] = info.minimum;
+		in->abs_max[in->num_of_axes] = info.maximum;
+		in->num_of_axes++;
+	}
+	// Event times comparable with CLOCK_MONOTONIC, not wall clock.
+	int clk = CLOCK_MONOTONIC;
+	ioctl(in->fd, EVIOCSCLOCKID, &clk);
+	in->need_sync = 1;
+	return 0;
+}
+
+/**
+ * Open joystick device, non-blocking. evdev is recognized by its ioctl.
+ * @return 0 if Ok, -1 with errno set.
+ */
+static inline int joy_input__open(joy_input_t* in, const char* path) {
+	memset(in, 0, sizeof(*in));
+	// Blocking open, so a FIFO waits for its writer, as before.
+	in->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(in->fd < 0){
+		return -1;
+	}
+	fcntl(in->fd, F_SETFL, fcntl(in->fd, F_GETFL) | O_NONBLOCK);
+	int version;
+	if(ioctl(in->fd, EVIOCGVERSION, &version) == 0){
+		in->evdev = 1;
+		if(joy_input__open_evdev(in) != 0){
+			int e = errno;
+			close(in->fd);
+			in->fd = -1;
+			errno = e;
+			return -1;
+		}
+		return 0;
+	}
+	uint8_t n;
+	if(ioctl(in->fd, JSIOCGAXES, &n) == 0){
+		in->num_of_axes = n;
+	}
+	if(ioctl(in->fd, JSIOCGBUTTONS, &n) == 0){
+		in->num_of_buttons = n;
+	}
+	return 0;
+}
+
+static inline void joy_input__close(joy_input_t* in) {
+	if(in->fd >= 0){
+		close(in->fd);
+		in->fd = -1;
+	}
+}
+
+/**
+ * Whole current state of evdev device as a JS_EVENT_INIT batch.
+ */
+static inline int joy_input__sync(joy_input_t* in, struct js_event* evs) {
+	unsigned long key_state[KEY_CNT/(8*sizeof(long)) + 1];
+	memset(key_state, 0, sizeof(key_state));
+	if(ioctl(in->fd, EVIOCGKEY(sizeof(key_state)), key_state) < 0){
+		return -1;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint32_t t = (uint32_t)(ts.tv_sec*1000 + ts.tv_nsec/1000000);
+	int n = 0;
+	for(int i = 0; i < in->num_of_buttons; i++){
+		evs[n].time = t;
+		evs[n].type = JS_EVENT_BUTTON | JS_EVENT_INIT;
+		evs[n].number = i;
+		evs[n].value = JOY_INPUT__TEST_BIT(key_state, in->button_to_key[i]);
+		n++;
+	}
+	for(int i = 0; i < in->num_of_axes; i++){
+		struct input_absinfo info;
+		if(ioctl(in->fd, EVIOCGABS(in->axis_to_abs[i]), &info) < 0){
+			continue;
+		}
+		evs[n].time = t;
+		evs[n].type = JS_EVENT_AXIS | JS_EVENT_INIT;
+		evs[n].number = i;
+		evs[n].value = joy_input__scale(in, i, info.value);
+		n++;
+	}
+	in->need_sync = 0;
+	in->num_of_staged = 0;
+	return n;
+}
+
+static inline int joy_input__read_evdev(joy_input_t* in, struct js_event* evs) {
+	if(in->need_sync){
+		return joy_input__sync(in, evs);
+	}
+	struct input_event raw[JOY_INPUT__MAX_EVENTS];
+	// Never more js_events than fit staged.
+	size_t room = JOY_INPUT__MAX_EVENTS - in->num_of_staged;
+	ssize_t r = read(in->fd, raw, room*sizeof(raw[0]));
+	if(r < 0){
+		return errno == EAGAIN ? 0 : -1;
+	}
+	int committed = 0;
+	for(int i = 0; i < r/(ssize_t)sizeof(raw[0]); i++){
+		const struct input_event* ev = &raw[i];
+		if(ev->type == EV_SYN){
+			if(ev->code == SYN_DROPPED){
+				// Kernel buffer overflowed, state is only known again after
+				// the next SYN_REPORT, then read it whole. Frames committed
+				// before are dropped too, the whole state replaces them.
+				in->dropping = 1;
+				in->num_of_staged = 0;
+				committed = 0;
+			}else if(ev->code == SYN_REPORT){
+				if(in->dropping){
+					in->dropping = 0;
+					in->need_sync = 1;
+				}else{
+					committed = in->num_of_staged;
+				}
+			}
+			continue;
+		}
+		if(in->dropping){
+			continue;
+		}
+		struct js_event* js = &in->staged[in->num_of_staged];
+		if(ev->type == EV_KEY && ev->code < KEY_CNT && in->key_to_button[ev->code] >= 0){
+			if(ev->value == 2){
+				continue; // Autorepeat.
+			}
+			js->type = JS_EVENT_BUTTON;
+			js->number = in->key_to_button[ev->code];
+			js->value = ev->value;
+		}else if(ev->type == EV_ABS && ev->code < ABS_CNT && in->abs_to_axis[ev->code] >= 0){
+			js->type = JS_EVENT_AXIS;
+			js->number = in->abs_to_axis[ev->code];
+			js->value = joy_input__scale(in, js->number, ev->value);
+		}else{
+			continue;
+		}
+		js->time = joy_input__time_ms(ev);
+		in->num_of_staged++;
+	}
+	if(in->need_sync && committed == 0){
+		return joy_input__sync(in, evs);
+	}
+	memcpy(evs, in->staged, committed*sizeof(evs[0]));
+	memmove(
+		in->staged,
+		in->staged + committed,
+		(in->num_of_staged - committed)*sizeof(in->staged[0])
+	);
+	in->num_of_staged -= committed;
+	if(in->num_of_staged == JOY_INPUT__MAX_EVENTS){
+		// Frame bigger than a batch, let it through in parts.
+		memcpy(evs, in->staged, sizeof(in->staged));
+		in->num_of_staged = 0;
+		return JOY_INPUT__MAX_EVENTS;
+	}
+	return committed;
+}
+
+/**
+ * Read next batch of events without blocking.
+ * @param evs room for JOY_INPUT__MAX_EVENTS.
+ * @return number of events, 0 if nothing is ready, -1 on error with errno
+ * set, ENODEV also when the device is gone or a FIFO writer closed.
+ */
+static inline int joy_input__read(joy_input_t* in, struct js_event* evs) {
+	if(in->evdev){
+		return joy_input__read_evdev(in, evs);
+	}
+	ssize_t r = read(in->fd, evs, JOY_INPUT__MAX_EVENTS*sizeof(evs[0]));
+	if(r < 0){
+		return errno == EAGAIN ? 0 : -1;
+	}
+	if(r == 0){
+		errno = ENODEV;
+		return -1;
+	}
+	// A FIFO may split an event, it is lost then.
+	return r/sizeof(evs[0]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // JOY_INPUT_H
@@ -0,0 +1,136 @@
+
+#ifndef LAT_HIST_H
+#define LAT_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Latency histogram, from ns to minutes in fixed memory.
+//
+// Log-linear buckets: each power of two is split into 8 linear buckets,
+// so any percentile is within 12.5% of the true value. Adding a sample is
+// a few instructions and never allocates.
+
+#define LAT_HIST__SUB_BITS 3
+#define LAT_HIST__SUB (1 << LAT_HIST__SUB_BITS)
+#define LAT_HIST__BUCKETS ((64 - LAT_HIST__SUB_BITS + 1) * LAT_HIST__SUB)
+
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[LAT_HIST__BUCKETS];
+} lat_hist_t;
+
+static inline void lat_hist__reset(lat_hist_t* h) {
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+static inline int lat_hist__bucket(uint64_t v) {
+	if(v < LAT_HIST__SUB){
+		return (int)v;
+	}
+	int msb = 63 - __builtin_clzll(v);
+	int sub = (int)(v >> (msb - LAT_HIST__SUB_BITS)) & (LAT_HIST__SUB - 1);
+	return (msb - LAT_HIST__SUB_BITS + 1) * LAT_HIST__SUB + sub;
+}
+
+/**
+ * @return smallest value that falls into bucket @a b.
+ */
+static inline uint64_t lat_hist__bucket_low(int b) {
+	if(b < LAT_HIST__SUB){
+		return b;
+	}
+	int msb = b / LAT_HIST__SUB + LAT_HIST__SUB_BITS - 1;
+	uint64_t sub = b % LAT_HIST__SUB;
+	return (1ULL << msb) | sub << (msb - LAT_HIST__SUB_BITS);
+}
+
+static inline void lat_hist__add(lat_hist_t* h, uint64_t v) {
+	h->count++;
+	h->sum += v;
+	if(v < h->min){
+		h->min = v;
+	}
+	if(v > h->max){
+		h->max = v;
+	}
+	h->buckets[lat_hist__bucket(v)]++;
+}
+
+/**
+ * Add all samples of @a src to @a dst.
+ */
+static inline void lat_hist__merge(lat_hist_t* dst, const lat_hist_t* src) {
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if(src->min < dst->min){
+		dst->min = src->min;
+	}
+	if(src->max > dst->max){
+		dst->max = src->max;
+	}
+	for(int b = 0; b < LAT_HIST__BUCKETS; b++){
+		dst->buckets[b] += src->buckets[b];
+	}
+}
+
+/**
+ * @param p percentile [0, 100].
+ * @return upper edge of the bucket holding the percentile, clamped to max.
+ */
+static inline uint64_t lat_hist__percentile(const lat_hist_t* h, double p) {
+	if(h->count == 0){
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(p / 100.0 * (h->count - 1)) + 1;
+	uint64_t seen = 0;
+	for(int b = 0; b < LAT_HIST__BUCKETS; b++){
+		seen += h->buckets[b];
+		if(seen >= rank){
+			uint64_t high = b + 1 < LAT_HIST__BUCKETS ?
+				lat_hist__bucket_low(b + 1) - 1 : UINT64_MAX;
+			return high < h->max ? high : h->max;
+		}
+	}
+	return h->max;
+}
+
+/**
+ * One line summary, values divided by @a unit_ns, e.g. 1000 for us.
+ */
+static inline void lat_hist__print(
+	FILE* f,
+	const char* name,
+	const lat_hist_t* h,
+	uint64_t unit_ns,
+	const char* unit
+) {
+	if(h->count == 0){
+		fprintf(f, "%-20s n=0\n", name);
+		return;
+	}
+	double u = (double)unit_ns;
+	fprintf(
+		f,
+		"%-20s n=%-9llu min=%.1f avg=%.1f p50=%.1f p99=%.1f p99.9=%.1f max=%.1f [%s]\n",
+		name,
+		(unsigned long long)h->count,
+		h->min / u,
+		(double)h->sum / h->count / u,
+		lat_hist__percentile(h, 50) / u,
+		lat_hist__percentile(h, 99) / u,
+		lat_hist__percentile(h, 99.9) / u,
+		h->max / u,
+		unit
+	);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // LAT_HIST_H
@@ -0,0 +1,132 @@
+
+#ifndef PERIODIC_H
+#define PERIODIC_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "lat_hist.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Fixed-rate loop on absolute deadlines.
+//
+// timerfd armed with TFD_TIMER_ABSTIME fires on a fixed grid, so the period
+// does not drift with the cost of the loop body. Every tick records how
+// late it woke up after its deadline, and deadlines that passed without a
+// tick of their own are counted as missed.
+
+typedef struct {
+	int fd;
+	uint64_t period_ns;
+	uint64_t next_ns; // Deadline of the next tick, CLOCK_MONOTONIC.
+	uint64_t ticks;
+	uint64_t missed;
+	lat_hist_t wakeup; // Wakeup latency after deadline [ns].
+} periodic_t;
+
+static inline uint64_t periodic__now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static inline struct timespec periodic__ts(uint64_t ns) {
+	struct timespec ts = {
+		.tv_sec = ns/1000000000ULL,
+		.tv_nsec = ns%1000000000ULL
+	};
+	return ts;
+}
+
+/**
+ * @param rate_hz loop rate.
+ * @param nonblock for use with epoll, else periodic__tick() blocks.
+ * @return 0 if Ok, -1 with errno set.
+ */
+static inline int periodic__init(periodic_t* p, int rate_hz, int nonblock) {
+	if(rate_hz <= 0){
+		errno = EINVAL;
+		return -1;
+	}
+	p->period_ns = 1000000000ULL/rate_hz;
+	p->ticks = 0;
+	p->missed = 0;
+	lat_hist__reset(&p->wakeup);
+
+	p->fd = timerfd_create(
+		CLOCK_MONOTONIC,
+		TFD_CLOEXEC | (nonblock ? TFD_NONBLOCK : 0)
+	);
+	if(p->fd < 0){
+		return -1;
+	}
+	p->next_ns = periodic__now_ns() + p->period_ns;
+	struct itimerspec its = {
+		.it_interval = periodic__ts(p->period_ns),
+		.it_value = periodic__ts(p->next_ns),
+	};
+	if(timerfd_settime(p->fd, TFD_TIMER_ABSTIME, &its, NULL) != 0){
+		close(p->fd);
+		p->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static inline void periodic__close(periodic_t* p) {
+	if(p->fd >= 0){
+		close(p->fd);
+		p->fd = -1;
+	}
+}
+
+/**
+ * Consume expirations of the timer and account for them.
+ * @return expirations since last call, 0 if none yet, -1 on error.
+ */
+static inline int periodic__tick(periodic_t* p) {
+	uint64_t exp;
+	ssize_t r = read(p->fd, &exp, sizeof(exp));
+	uint64_t now_ns = periodic__now_ns();
+	if(r != sizeof(exp)){
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	}
+	// Latest deadline that passed is the one this wakeup serves.
+	uint64_t deadline_ns = p->next_ns + (exp - 1)*p->period_ns;
+	lat_hist__add(&p->wakeup, now_ns > deadline_ns ? now_ns - deadline_ns : 0);
+	p->ticks += exp;
+	p->missed += exp - 1;
+	p->next_ns = deadline_ns + p->period_ns;
+	return (int)exp;
+}
+
+/**
+ * @return ms until the next deadline, rounded up.
+ */
+static inline int periodic__ms_to_next(const periodic_t* p) {
+	uint64_t now_ns = periodic__now_ns();
+	if(now_ns >= p->next_ns){
+		return 0;
+	}
+	return (int)((p->next_ns - now_ns + 999999)/1000000);
+}
+
+static inline void periodic__print(FILE* f, const char* name, const periodic_t* p) {
+	fprintf(
+		f,
+		"%s: period %.3f ms, %llu ticks, %llu missed deadlines\n",
+		name,
+		p->period_ns/1e6,
+		(unsigned long long)p->ticks,
+		(unsigned long long)p->missed
+	);
+	lat_hist__print(f, "  wakeup latency", &p->wakeup, 1000, "us");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // PERIODIC_H
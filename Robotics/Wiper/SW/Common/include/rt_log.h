@@ -0,0 +1,441 @@
+
+#ifndef RT_LOG_H
+#define RT_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Asynchronous logger for hot paths.
+//
+// A log call stores the format pointer and raw argument values into a
+// lock-free ring of the calling thread and returns. It never formats,
+// never blocks on stdout and never takes a lock. A background thread
+// merges the rings in time order, formats and writes. If a ring is full,
+// the record is dropped and counted.
+//
+// Formatting happens later, so %s arguments must outlive the call, e.g.
+// string literals. Supported are the usual conversions of d i u x X o c s
+// p f e g a, with flags, width and precision, but not *.
+//
+// Levels below RT_LOG__LEVEL compile to nothing, e.g. build with
+// -DRT_LOG__LEVEL=RT_LOG__LEVEL_WARN to drop per-event logs altogether.
+
+#define RT_LOG__LEVEL_DEBUG 0
+#define RT_LOG__LEVEL_INFO 1
+#define RT_LOG__LEVEL_WARN 2
+#define RT_LOG__LEVEL_ERROR 3
+
+#ifndef RT_LOG__LEVEL
+#define RT_LOG__LEVEL RT_LOG__LEVEL_INFO
+#endif
+
+#define RT_LOG__MAX_ARGS 6
+#define RT_LOG__MAX_THREADS 8
+#define RT_LOG__RING_SIZE 1024 // Records per thread, power of 2.
+#define RT_LOG__IDLE_NS 5000000 // Sleep of formatter when all rings are empty.
+#define RT_LOG__LINE_SIZE 512
+
+// Kind of argument.
+enum {
+	RT_LOG__ARG_INT,
+	RT_LOG__ARG_DOUBLE,
+	RT_LOG__ARG_STR,
+	RT_LOG__ARG_PTR
+};
+
+typedef struct {
+	uint8_t tag;
+	union {
+		uint64_t u;
+		double d;
+		const void* p;
+	} v;
+} rt_log_arg_t;
+
+typedef struct {
+	uint64_t t_ns; // CLOCK_MONOTONIC
+	const char* fmt;
+	uint8_t level;
+	uint8_t nargs;
+	uint8_t tags[RT_LOG__MAX_ARGS];
+	uint64_t vals[RT_LOG__MAX_ARGS];
+} rt_log_rec_t;
+
+// Single producer, the owning thread, single consumer, the formatter.
+typedef struct {
+	_Atomic uint32_t head; // Written by producer.
+	_Atomic uint32_t tail; // Written by consumer.
+	_Atomic uint64_t dropped;
+	rt_log_rec_t recs[RT_LOG__RING_SIZE];
+} rt_log_ring_t;
+
+static rt_log_ring_t* _Atomic rt_log__rings[RT_LOG__MAX_THREADS];
+static _Atomic int rt_log__num_of_rings;
+static _Atomic uint64_t rt_log__unregistered_dropped;
+static __thread rt_log_ring_t* rt_log__ring;
+static pthread_t rt_log__thread;
+static _Atomic int rt_log__running;
+static FILE* rt_log__out;
+
+static inline uint64_t rt_log__now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Allocate ring of calling thread. Done on first log call otherwise; call
+ * it at start of real-time threads, so that their loop never allocates.
+ * @return ring or NULL if there are too many threads.
+ */
+static inline rt_log_ring_t* rt_log__thread_init(void) {
+	if(rt_log__ring){
+		return rt_log__ring;
+	}
+	int i = atomic_fetch_add(&rt_log__num_of_rings, 1);
+	if(i >= RT_LOG__MAX_THREADS){
+		return NULL;
+	}
+	rt_log_ring_t* r = calloc(1, sizeof(rt_log_ring_t));
+	if(!r){
+		return NULL;
+	}
+	atomic_store_explicit(&rt_log__rings[i], r, memory_order_release);
+	rt_log__ring = r;
+	return r;
+}
+
+static inline void rt_log__write(
+	int level,
+	const char* fmt,
+	int nargs,
+	const rt_log_arg_t* args
+) {
+	rt_log_ring_t* r = rt_log__ring ? rt_log__ring : rt_log__thread_init();
+	if(!r){
+		atomic_fetch_add_explicit(&rt_log__unregistered_dropped, 1, memory_order_relaxed);
+		return;
+	}
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	if(head - tail == RT_LOG__RING_SIZE){
+		atomic_store_explicit(
+			&r->dropped,
+			atomic_load_explicit(&r->dropped, memory_order_relaxed) + 1,
+			memory_order_relaxed
+		);
+		return;
+	}
+	rt_log_rec_t* rec = &r->recs[head & (RT_LOG__RING_SIZE - 1)];
+	rec->t_ns = rt_log__now_ns();
+	rec->fmt = fmt;
+	rec->level = level;
+	rec->nargs = nargs;
+	for(int i = 0; i < nargs; i++){
+		rec->tags[i] = args[i].tag;
+		rec->vals[i] = args[i].v.u;
+	}
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+static inline rt_log_arg_t rt_log__arg_int(uint64_t v) {
+	rt_log_arg_t a = { .tag = RT_LOG__ARG_INT };
+	a.v.u = v;
+	return a;
+}
+static inline rt_log_arg_t rt_log__arg_double(double v) {
+	rt_log_arg_t a = { .tag = RT_LOG__ARG_DOUBLE };
+	a.v.d = v;
+	return a;
+}
+static inline rt_log_arg_t rt_log__arg_str(const char* v) {
+	rt_log_arg_t a = { .tag = RT_LOG__ARG_STR };
+	a.v.p = v;
+	return a;
+}
+static inline rt_log_arg_t rt_log__arg_ptr(const void* v) {
+	rt_log_arg_t a = { .tag = RT_LOG__ARG_PTR };
+	a.v.p = v;
+	return a;
+}
+
+#define RT_LOG__ARG(x) _Generic((x), \
+		float: rt_log__arg_double, \
+		double: rt_log__arg_double, \
+		char*: rt_log__arg_str, \
+		const char*: rt_log__arg_str, \
+		void*: rt_log__arg_ptr, \
+		const void*: rt_log__arg_ptr, \
+		default: rt_log__arg_int \
+	)(x)
+
+#define RT_LOG__NARGS(...) RT_LOG__NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define RT_LOG__NARGS_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define RT_LOG__CAT(a, b) RT_LOG__CAT_(a, b)
+#define RT_LOG__CAT_(a, b) a##b
+#define RT_LOG__ARGS_0()
+#define RT_LOG__ARGS_1(a) , RT_LOG__ARG(a)
+#define RT_LOG__ARGS_2(a, ...) , RT_LOG__ARG(a) RT_LOG__ARGS_1(__VA_ARGS__)
+#define RT_LOG__ARGS_3(a, ...) , RT_LOG__ARG(a) RT_LOG__ARGS_2(__VA_ARGS__)
+#define RT_LOG__ARGS_4(a, ...) , RT_LOG__ARG(a) RT_LOG__ARGS_3(__VA_ARGS__)
+#define RT_LOG__ARGS_5(a, ...) , RT_LOG__ARG(a) RT_LOG__ARGS_4(__VA_ARGS__)
+#define RT_LOG__ARGS_6(a, ...) , RT_LOG__ARG(a) RT_LOG__ARGS_5(__VA_ARGS__)
+
+#define RT_LOG__LOG(level, fmt, ...) \
+	do{ \
+		/* First element is a dummy, so that the array is never empty. */ \
+		const rt_log_arg_t rt_log__args_[] = { \
+			{ 0 } RT_LOG__CAT(RT_LOG__ARGS_, RT_LOG__NARGS(__VA_ARGS__))(__VA_ARGS__) \
+		}; \
+		rt_log__write(level, fmt, RT_LOG__NARGS(__VA_ARGS__), rt_log__args_ + 1); \
+	}while(0)
+
+#if RT_LOG__LEVEL <= RT_LOG__LEVEL_DEBUG
+#define RT_LOG__DEBUG(...) RT_LOG__LOG(RT_LOG__LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define RT_LOG__DEBUG(...) do{}while(0)
+#endif
+#if RT_LOG__LEVEL <= RT_LOG__LEVEL_INFO
+#define RT_LOG__INFO(...) RT_LOG__LOG(RT_LOG__LEVEL_INFO, __VA_ARGS__)
+#else
+#define RT_LOG__INFO(...) do{}while(0)
+#endif
+#if RT_LOG__LEVEL <= RT_LOG__LEVEL_WARN
+#define RT_LOG__WARN(...) RT_LOG__LOG(RT_LOG__LEVEL_WARN, __VA_ARGS__)
+#else
+#define RT_LOG__WARN(...) do{}while(0)
+#endif
+#define RT_LOG__ERROR(...) RT_LOG__LOG(RT_LOG__LEVEL_ERROR, __VA_ARGS__)
+
+///////////////////////////////////////////////////////////////////////////////
+// Formatter side.
+
+/**
+ * printf() of a stored record, each argument converted back to the type
+ * the conversion expects.
+ * @return length of line in @a buf.
+ */
+static inline int rt_log__format(char* buf, int size, const rt_log_rec_t* rec) {
+	int len = 0;
+	int a = 0;
+	const char* f = rec->fmt;
+	while(*f && len < size - 1){
+		if(*f != '%'){
+			buf[len++] = *f++;
+			continue;
+		}
+		if(f[1] == '%'){
+			buf[len++] = '%';
+			f += 2;
+			continue;
+		}
+		// Keep flags, width and precision. Length modifiers are replaced
+		// by what the stored value needs.
+		char spec[32];
+		int n = 0;
+		spec[n++] = *f++;
+		while(*f && strchr("-+ #0123456789.", *f) && n < 24){
+			spec[n++] = *f++;
+		}
+		// Value is converted to the type of the length modifier, as
+		// printf() does with the promoted argument.
+		int bits = 32;
+		if(f[0] == 'h'){
+			bits = f[1] == 'h' ? 8 : 16;
+		}else if(f[0] == 'l' && f[1] != 'l'){
+			bits = sizeof(long)*8;
+		}else if(*f && strchr("lLqjzt", *f)){
+			bits = 64;
+		}
+		while(*f && strchr("hlLqjzt", *f)){
+			f++;
+		}
+		char conv = *f;
+		if(!conv){
+			break;
+		}
+		f++;
+		if(a >= rec->nargs){
+			continue;
+		}
+		uint64_t v = rec->vals[a];
+		double d;
+		memcpy(&d, &rec->vals[a], sizeof(d));
+		a++;
+		uint64_t mask = bits == 64 ? UINT64_MAX : (1ULL << bits) - 1;
+		int w = 0;
+		switch(conv){
+			case 'd':
+			case 'i': {
+				int shift = 64 - bits;
+				long long s = (long long)(v << shift) >> shift;
+				spec[n++] = 'l';
+				spec[n++] = 'l';
+				spec[n++] = conv;
+				spec[n] = 0;
+				w = snprintf(buf + len, size - len, spec, s);
+				break;
+			}
+			case 'u':
+			case 'x':
+			case 'X':
+			case 'o':
+				spec[n++] = 'l';
+				spec[n++] = 'l';
+				spec[n++] = conv;
+				spec[n] = 0;
+				w = snprintf(buf + len, size - len, spec, (unsigned long long)(v & mask));
+				break;
+			case 'c':
+				spec[n++] = conv;
+				spec[n] = 0;
+				w = snprintf(buf + len, size - len, spec, (int)v);
+				break;
+			case 's':
+				spec[n++] = conv;
+				spec[n] = 0;
+				w = snprintf(buf + len, size - len, spec, (const char*)(uintptr_t)v);
+				break;
+			case 'p':
+				spec[n++] = conv;
+				spec[n] = 0;
+				w = snprintf(buf + len, size - len, spec, (const void*)(uintptr_t)v);
+				break;
+			case 'f': case 'F': case 'e': case 'E':
+			case 'g': case 'G': case 'a': case 'A':
+				spec[n++] = conv;
+				spec[n] = 0;
+				w = snprintf(buf + len, size - len, spec, d);
+				break;
+			default:
+				break;
+		}
+		if(w > 0){
+			len += w < size - len ? w : size - len - 1;
+		}
+	}
+	buf[len] = 0;
+	return len;
+}
+
+/**
+ * Format all queued records, oldest first across threads.
+ * @return number of records written.
+ */
+static inline int rt_log__drain(void) {
+	static char line[RT_LOG__LINE_SIZE];
+	int written = 0;
+	int num_of_rings = atomic_load(&rt_log__num_of_rings);
+	if(num_of_rings > RT_LOG__MAX_THREADS){
+		num_of_rings = RT_LOG__MAX_THREADS;
+	}
+	while(1){
+		rt_log_ring_t* oldest = NULL;
+		rt_log_rec_t* rec = NULL;
+		for(int i = 0; i < num_of_rings; i++){
+			rt_log_ring_t* r = atomic_load_explicit(&rt_log__rings[i], memory_order_acquire);
+			if(!r){
+				continue;
+			}
+			uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+			uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+			if(tail == head){
+				continue;
+			}
+			rt_log_rec_t* c = &r->recs[tail & (RT_LOG__RING_SIZE - 1)];
+			if(!rec || c->t_ns < rec->t_ns){
+				oldest = r;
+				rec = c;
+			}
+		}
+		if(!rec){
+			break;
+		}
+		rt_log__format(line, sizeof(line), rec);
+		fputs(line, rec->level >= RT_LOG__LEVEL_WARN ? stderr : rt_log__out);
+		atomic_store_explicit(
+			&oldest->tail,
+			atomic_load_explicit(&oldest->tail, memory_order_relaxed) + 1,
+			memory_order_release
+		);
+		written++;
+	}
+	if(written){
+		fflush(rt_log__out);
+	}
+	return written;
+}
+
+/**
+ * @return records dropped so far, because a ring was full.
+ */
+static inline uint64_t rt_log__dropped(void) {
+	uint64_t dropped = atomic_load(&rt_log__unregistered_dropped);
+	for(int i = 0; i < RT_LOG__MAX_THREADS; i++){
+		rt_log_ring_t* r = atomic_load_explicit(&rt_log__rings[i], memory_order_acquire);
+		if(r){
+			dropped += atomic_load_explicit(&r->dropped, memory_order_relaxed);
+		}
+	}
+	return dropped;
+}
+
+static inline void* rt_log__formatter(void* arg) {
+	(void)arg;
+	while(atomic_load(&rt_log__running)){
+		if(rt_log__drain() == 0){
+			struct timespec ts = { 0, RT_LOG__IDLE_NS };
+			nanosleep(&ts, NULL);
+		}
+	}
+	rt_log__drain();
+	return NULL;
+}
+
+/**
+ * Start formatter thread, writing to @a out, stdout if NULL.
+ * It runs at normal priority, it must never preempt real-time threads.
+ * @return 0 if Ok, else error number.
+ */
+static inline int rt_log__start(FILE* out) {
+	rt_log__out = out ? out : stdout;
+	atomic_store(&rt_log__running, 1);
+	// Not inherited from a caller that is already real-time.
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	struct sched_param param = { .sched_priority = 0 };
+	pthread_attr_setschedparam(&attr, &param);
+	int e = pthread_create(&rt_log__thread, &attr, rt_log__formatter, NULL);
+	pthread_attr_destroy(&attr);
+	if(e != 0){
+		atomic_store(&rt_log__running, 0);
+	}
+	return e;
+}
+
+/**
+ * Write out what is queued and stop formatter thread.
+ */
+static inline void rt_log__stop(void) {
+	if(!atomic_exchange(&rt_log__running, 0)){
+		return;
+	}
+	pthread_join(rt_log__thread, NULL);
+	uint64_t dropped = rt_log__dropped();
+	if(dropped){
+		fprintf(stderr, "Log dropped %llu records\n", (unsigned long long)dropped);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // RT_LOG_H
@@ -0,0 +1,180 @@
+
+#ifndef RT_PROFILE_H
+#define RT_PROFILE_H
+
+// For CPU_SET() and pthread_setaffinity_np(). It has to be defined before
+// the first system header, so it is up to the including .c file.
+#ifndef _GNU_SOURCE
+#error "Define _GNU_SOURCE at the top of the .c file!"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/mman.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Opt-in real-time execution profile for the wiper control apps.
+
+#define RT_PROFILE__ACTUATOR_PRIO 80
+#define RT_PROFILE__READER_PRIO 70
+#define RT_PROFILE__PREFAULT_STACK (256*1024)
+#define RT_PROFILE__PREFAULT_HEAP (1024*1024)
+
+typedef struct {
+	int prio; // SCHED_FIFO priority [1, 99].
+	int cpu;  // CPU to pin to, -1 for any.
+} rt_profile__thread_t;
+
+/**
+ * Parse "<prio>[@<cpu>]", e.g. "80" or "80@3".
+ * @return 0 if Ok, -1 if malformed.
+ */
+static inline int rt_profile__parse_thread(
+	const char* s,
+	rt_profile__thread_t* t
+) {
+	int prio;
+	int cpu = -1;
+	int n = sscanf(s, "%d@%d", &prio, &cpu);
+	if(n < 1 || prio < 1 || prio > 99 || (n == 2 && cpu < 0)){
+		return -1;
+	}
+	t->prio = prio;
+	t->cpu = cpu;
+	return 0;
+}
+
+static inline void rt_profile__prefault_stack(void) {
+	volatile char stack[RT_PROFILE__PREFAULT_STACK];
+	long page = sysconf(_SC_PAGESIZE);
+	for(size_t i = 0; i < sizeof(stack); i += page){
+		stack[i] = 0;
+	}
+}
+
+/**
+ * Lock all current and future pages, then fault in stack and heap, so
+ * that the control loop never takes a page fault. Heap is not given back
+ * to the kernel afterwards, later malloc()s are served from it.
+ * @return 0 if Ok, -1 with errno set.
+ */
+static inline int rt_profile__lock_memory(void) {
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0){
+		return -1;
+	}
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	rt_profile__prefault_stack();
+
+	char* heap = (char*)malloc(RT_PROFILE__PREFAULT_HEAP);
+	if(heap){
+		long page = sysconf(_SC_PAGESIZE);
+		for(size_t i = 0; i < RT_PROFILE__PREFAULT_HEAP; i += page){
+			heap[i] = 0;
+		}
+		free(heap);
+	}
+	return 0;
+}
+
+/**
+ * Make thread SCHED_FIFO with given priority and pin it.
+ * @return 0 if Ok, otherwise error number of the failed call.
+ */
+static inline int rt_profile__set_thread(
+	pthread_t th,
+	const rt_profile__thread_t* t
+) {
+	int r;
+	struct sched_param sp = { .sched_priority = t->prio };
+	r = pthread_setschedparam(th, SCHED_FIFO, &sp);
+	if(r){
+		return r;
+	}
+	if(t->cpu >= 0){
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(t->cpu, &set);
+		r = pthread_setaffinity_np(th, sizeof(set), &set);
+	}
+	return r;
+}
+
+/**
+ * Log achieved policy, priority and affinity of every thread of the
+ * process, libzmq's I/O threads included, and whether memory is locked.
+ */
+static inline void rt_profile__log(FILE* f) {
+	DIR* d = opendir("/proc/self/task");
+	if(!d){
+		return;
+	}
+	struct dirent* e;
+	while((e = readdir(d))){
+		if(e->d_name[0] == '.'){
+			continue;
+		}
+		pid_t tid = atoi(e->d_name);
+
+		char path[64];
+		char comm[32] = "?";
+		snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+		FILE* cf = fopen(path, "r");
+		if(cf){
+			if(fgets(comm, sizeof(comm), cf)){
+				comm[strcspn(comm, "\n")] = '\0';
+			}
+			fclose(cf);
+		}
+
+		int policy = sched_getscheduler(tid);
+		struct sched_param sp = { 0 };
+		sched_getparam(tid, &sp);
+
+		char cpus[128] = "";
+		cpu_set_t set;
+		if(sched_getaffinity(tid, sizeof(set), &set) == 0){
+			int len = 0;
+			for(int c = 0; c < CPU_SETSIZE && len < (int)sizeof(cpus) - 8; c++){
+				if(CPU_ISSET(c, &set)){
+					len += snprintf(cpus + len, sizeof(cpus) - len, "%s%d", len ? "," : "", c);
+				}
+			}
+		}
+
+		fprintf(
+			f,
+			"rt: thread %d (%s): %s prio %d, cpus %s\n",
+			tid,
+			comm,
+			policy == SCHED_FIFO ? "SCHED_FIFO" :
+				policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER",
+			sp.sched_priority,
+			cpus
+		);
+	}
+	closedir(d);
+
+	FILE* sf = fopen("/proc/self/status", "r");
+	if(sf){
+		char line[128];
+		while(fgets(line, sizeof(line), sf)){
+			if(!strncmp(line, "VmLck:", 6)){
+				fprintf(f, "rt: locked memory %s", line + 6 + strspn(line + 6, " \t"));
+			}
+		}
+		fclose(sf);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // RT_PROFILE_H
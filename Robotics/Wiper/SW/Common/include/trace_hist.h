@@ -0,0 +1,94 @@
+
+#ifndef TRACE_HIST_H
+#define TRACE_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "lat_hist.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Always-on per-stage latency histogram.
+//
+// Same buckets as lat_hist_t, but safe to read from another thread while
+// one thread adds to it. With a single writer, a relaxed load and store
+// is enough and compiles to plain moves, so adding costs a few ns, no
+// locked instruction. A reader sees each counter whole, but may see the
+// counters of one sample not all updated yet.
+
+typedef struct {
+	_Atomic uint64_t count;
+	_Atomic uint64_t sum;
+	_Atomic uint64_t min;
+	_Atomic uint64_t max;
+	_Atomic uint64_t buckets[LAT_HIST__BUCKETS];
+} trace_hist_t;
+
+#define TRACE_HIST__LOAD(x) atomic_load_explicit(&(x), memory_order_relaxed)
+#define TRACE_HIST__STORE(x, v) atomic_store_explicit(&(x), (v), memory_order_relaxed)
+
+/**
+ * Call before the writer starts.
+ */
+static inline void trace_hist__reset(trace_hist_t* h) {
+	TRACE_HIST__STORE(h->count, 0);
+	TRACE_HIST__STORE(h->sum, 0);
+	TRACE_HIST__STORE(h->min, UINT64_MAX);
+	TRACE_HIST__STORE(h->max, 0);
+	for(int b = 0; b < LAT_HIST__BUCKETS; b++){
+		TRACE_HIST__STORE(h->buckets[b], 0);
+	}
+}
+
+/**
+ * Only one thread may add to a histogram.
+ */
+static inline void trace_hist__add(trace_hist_t* h, uint64_t v) {
+	int b = lat_hist__bucket(v);
+	TRACE_HIST__STORE(h->buckets[b], TRACE_HIST__LOAD(h->buckets[b]) + 1);
+	TRACE_HIST__STORE(h->sum, TRACE_HIST__LOAD(h->sum) + v);
+	if(v < TRACE_HIST__LOAD(h->min)){
+		TRACE_HIST__STORE(h->min, v);
+	}
+	if(v > TRACE_HIST__LOAD(h->max)){
+		TRACE_HIST__STORE(h->max, v);
+	}
+	TRACE_HIST__STORE(h->count, TRACE_HIST__LOAD(h->count) + 1);
+}
+
+/**
+ * Copy, from any thread, for lat_hist__percentile() and lat_hist__print().
+ */
+static inline void trace_hist__snapshot(const trace_hist_t* h, lat_hist_t* out) {
+	uint64_t count = 0;
+	for(int b = 0; b < LAT_HIST__BUCKETS; b++){
+		out->buckets[b] = TRACE_HIST__LOAD(h->buckets[b]);
+		count += out->buckets[b];
+	}
+	// Consistent with buckets, which percentiles are taken from.
+	out->count = count;
+	out->sum = TRACE_HIST__LOAD(h->sum);
+	out->min = TRACE_HIST__LOAD(h->min);
+	out->max = TRACE_HIST__LOAD(h->max);
+}
+
+/**
+ * Print stages @a names of @a hists in us.
+ */
+static inline void trace_hist__print(
+	FILE* f,
+	const char* const* names,
+	const trace_hist_t* hists,
+	int num_of_stages
+) {
+	static lat_hist_t snap; // Big for a stack of an RT thread.
+	for(int s = 0; s < num_of_stages; s++){
+		trace_hist__snapshot(&hists[s], &snap);
+		lat_hist__print(f, names[s], &snap, 1000, "us");
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // TRACE_HIST_H
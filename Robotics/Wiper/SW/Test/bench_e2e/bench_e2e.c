@@ -0,0 +1,435 @@
+
+/*
+ * End-to-end latency of the wiper apps, from input edge to GPIO write.
+ * Apps run unmodified, with gpio_shim.so preloaded in place of hardware:
+ * - joystick apps (1_Joy_Wiper, 2_IPC) get button presses over a FIFO
+ *   instead of /dev/input/js0, measured until the direction pin changes,
+ * - limit switch app (3_Limit_SW, -L) gets pin 22 raised, measured until
+ *   EN drops.
+ * All processes are on this host and stamp with CLOCK_MONOTONIC.
+ */
+
+#include <stdint.h> // uint16_t and family
+#include <stdio.h> // printf and family
+#include <stdlib.h> // exit()
+#include <string.h> // strerror()
+#include <unistd.h> // getopt()
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h> // clock_nanosleep()
+#include <limits.h> // PATH_MAX
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <linux/joystick.h>
+
+#include "bench_e2e.h"
+#include "lat_hist.h"
+
+#define DEFAULT_SHIM "build/libgpio_shim.so"
+#define DEFAULT_EDGES 200
+#define DEFAULT_RUNS 20 // With -L, app is restarted for every sample.
+#define MAX_RATES 8
+#define MAX_APPS 4
+
+#define SOCK_FN "/tmp/bench_e2e.sock"
+#define JS_FIFO_FN "/tmp/bench_e2e.js"
+#define PINS_FN "/tmp/bench_e2e.pins"
+
+#define PIN_EN 2
+#define PIN_CCW 3
+#define PIN_CW 4
+#define PIN_LIMIT 22
+
+#define EDGE_TIMEOUT_MS 1000
+// 3_Limit_SW sleeps a while after enabling the motor, before it polls.
+#define LIMIT_SETTLE_MS 200
+#define READY_TIMEOUT_MS 10000
+
+static const int default_rates[] = { 10, 100, 500 }; // [edge/s]
+
+static int sock_fd = -1;
+static int js_fd = -1;
+static volatile uint8_t* pins;
+static int verbose = 0;
+static pid_t pids[MAX_APPS];
+static int num_of_apps = 0;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t_ns) {
+	struct timespec ts = {
+		.tv_sec = t_ns/1000000000ULL,
+		.tv_nsec = t_ns%1000000000ULL
+	};
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR){
+	}
+}
+
+static void js_button(uint8_t number, int16_t value) {
+	struct js_event ev = {
+		.time = (uint32_t)(now_ns()/1000000),
+		.value = value,
+		.type = JS_EVENT_BUTTON,
+		.number = number
+	};
+	if(write(js_fd, &ev, sizeof(ev)) != sizeof(ev)){
+		perror("Failed to write joystick event");
+	}
+}
+
+/**
+ * Wait for app to write @a value to @a pin, not before @a after_ns.
+ * @return 1 and time of write in @a t_ns, or 0 on timeout.
+ */
+static int wait_write(
+	uint8_t pin,
+	uint8_t value,
+	uint64_t after_ns,
+	int timeout_ms,
+	uint64_t* t_ns
+) {
+	uint64_t deadline_ns = now_ns() + timeout_ms*1000000ULL;
+	while(1){
+		bench_e2e_write_t w;
+		ssize_t n = recv(sock_fd, &w, sizeof(w), MSG_DONTWAIT);
+		if(n == sizeof(w)){
+			if(w.pin == pin && w.value == value && w.t_ns >= after_ns){
+				*t_ns = w.t_ns;
+				return 1;
+			}
+			continue;
+		}
+		uint64_t t = now_ns();
+		if(t >= deadline_ns){
+			return 0;
+		}
+		struct pollfd pfd = { .fd = sock_fd, .events = POLLIN };
+		poll(&pfd, 1, (deadline_ns - t + 999999)/1000000);
+	}
+}
+
+static void start_apps(int argc, char** argv) {
+	num_of_apps = 0;
+	for(int i = 0; i < argc; i++){
+		pid_t pid = fork();
+		if(pid < 0){
+			perror("fork() failed");
+			exit(1);
+		}
+		if(pid == 0){
+			// Own group, so that kill() reaches what sh starts.
+			setpgid(0, 0);
+			if(!verbose){
+				int fd = open("/dev/null", O_WRONLY);
+				dup2(fd, STDOUT_FILENO);
+				close(fd);
+			}
+			execl("/bin/sh", "sh", "-c", argv[i], (char*)NULL);
+			perror("exec failed");
+			_exit(127);
+		}
+		setpgid(pid, pid);
+		pids[num_of_apps++] = pid;
+	}
+}
+
+static void stop_apps(void) {
+	for(int i = 0; i < num_of_apps; i++){
+		kill(-pids[i], SIGTERM);
+	}
+	// Grace period for clean exit and stats print.
+	for(int t = 0; t < 100; t++){
+		int alive = 0;
+		for(int i = 0; i < num_of_apps; i++){
+			if(pids[i] > 0 && waitpid(pids[i], NULL, WNOHANG) == 0){
+				alive = 1;
+			}else{
+				pids[i] = 0;
+			}
+		}
+		if(!alive){
+			break;
+		}
+		usleep(10000);
+	}
+	for(int i = 0; i < num_of_apps; i++){
+		if(pids[i] > 0){
+			kill(-pids[i], SIGKILL);
+			waitpid(pids[i], NULL, 0);
+		}
+	}
+	num_of_apps = 0;
+}
+
+static void print_header(const char* unit) {
+	printf(
+		"%10s %10s %7s %7s %10s %10s %10s\n",
+		unit,
+		"actual",
+		"n",
+		"missed",
+		"p50 [us]",
+		"p99 [us]",
+		"max [us]"
+	);
+}
+
+static void print_row(int rate, double actual, int n, int missed, const lat_hist_t* h) {
+	printf(
+		"%10d %10.1f %7d %7d %10.1f %10.1f %10.1f\n",
+		rate,
+		actual,
+		n,
+		missed,
+		lat_hist__percentile(h, 50)/1e3,
+		lat_hist__percentile(h, 99)/1e3,
+		h->max/1e3
+	);
+}
+
+/**
+ * Press alternately CCW and CW, each until its direction pin goes high.
+ */
+static int bench_joystick(const int* rates, int num_of_rates, int edges) {
+	// Until it reacts, ZeroMQ nodes may still be connecting.
+	uint64_t t_ns;
+	uint64_t start_ns = now_ns();
+	int ready = 0;
+	while(!ready && now_ns() - start_ns < READY_TIMEOUT_MS*1000000ULL){
+		uint64_t t0_ns = now_ns();
+		js_button(0, 1);
+		ready = wait_write(PIN_CCW, 1, t0_ns, 500, &t_ns);
+		js_button(0, 0);
+	}
+	if(!ready){
+		fprintf(stderr, "ERROR: App did not react in %d ms!\n", READY_TIMEOUT_MS);
+		return -1;
+	}
+	printf("App ready after %.0f ms\n", (now_ns() - start_ns)/1e6);
+	usleep(100000);
+
+	static lat_hist_t h;
+	unsigned seed = 1;
+	print_header("rate [1/s]");
+	for(int r = 0; r < num_of_rates; r++){
+		lat_hist__reset(&h);
+		int missed = 0;
+		uint64_t period_ns = 1000000000ULL/rates[r];
+		uint64_t begin_ns = now_ns();
+		uint64_t next_ns = begin_ns + period_ns;
+		for(int k = 0; k < edges; k++){
+			uint8_t button = k%2; // 0 CCW, 1 CW.
+			uint8_t pin = button == 0 ? PIN_CCW : PIN_CW;
+			// Random phase, else edges lock to a periodic loop of the app
+			// and always see the same part of its period.
+			sleep_until(next_ns + rand_r(&seed)%(period_ns/2));
+			uint64_t t0_ns = now_ns();
+			js_button(button, 1);
+			if(wait_write(pin, 1, t0_ns, EDGE_TIMEOUT_MS, &t_ns)){
+				lat_hist__add(&h, t_ns - t0_ns);
+			}else{
+				missed++;
+			}
+			js_button(button, 0);
+			// Slower app than rate, edges go back to back.
+			next_ns += period_ns;
+			if(next_ns < now_ns()){
+				next_ns = now_ns();
+			}
+		}
+		double actual = edges/((now_ns() - begin_ns)/1e9);
+		print_row(rates[r], actual, edges, missed, &h);
+	}
+	return 0;
+}
+
+/**
+ * Restart app per sample, raise limit switch once it enabled the motor,
+ * until EN goes low.
+ */
+static int bench_limit(int argc, char** argv, int runs) {
+	static lat_hist_t h;
+	uint64_t begin_ns = now_ns();
+	lat_hist__reset(&h);
+	int missed = 0;
+	uint64_t t_ns;
+	for(int k = 0; k < runs; k++){
+		pins[PIN_LIMIT] = 0;
+		uint64_t start_ns = now_ns();
+		start_apps(argc, argv);
+		if(!wait_write(PIN_EN, 1, start_ns, READY_TIMEOUT_MS, &t_ns)){
+			fprintf(stderr, "ERROR: App did not enable motor in %d ms!\n", READY_TIMEOUT_MS);
+			stop_apps();
+			return -1;
+		}
+		usleep(LIMIT_SETTLE_MS*1000);
+		uint64_t t0_ns = now_ns();
+		pins[PIN_LIMIT] = 1;
+		if(wait_write(PIN_EN, 0, t0_ns, EDGE_TIMEOUT_MS, &t_ns)){
+			lat_hist__add(&h, t_ns - t0_ns);
+		}else{
+			missed++;
+		}
+		stop_apps();
+	}
+	print_header("runs");
+	print_row(runs, runs/((now_ns() - begin_ns)/1e9), runs, missed, &h);
+	return 0;
+}
+
+static void usage(FILE* f) {
+	fprintf(f,
+"\nUsage: "\
+"\n	bench_e2e [-s <shim.so>] [-r <rate>[,<rate>]...] [-n <edges>] [-L] [-v]"\
+"\n		<command>..."\
+"\n	-s	gpio_shim.so to preload (default %s)"\
+"\n	-r	button edges per second (default %d,%d,%d)"\
+"\n	-n	edges per rate, with -L app restarts (default %d, -L %d)"\
+"\n	-L	limit switch app, from pin %d high until EN low"\
+"\n	-v	show output of apps"\
+"\n	commands run in parallel by sh, e.g."\
+"\n		bench_e2e ../../App/1_Joy_Wiper/build/joy_wiper"\
+"\n		bench_e2e 'joy_node -j /dev/input/js0 -e ipc:///tmp/e2e.ipc -r 0' \\"\
+"\n			'wiper_node -e ipc:///tmp/e2e.ipc'"\
+"\n		bench_e2e -L wiper_limit_switch_node"\
+"\n",
+		DEFAULT_SHIM,
+		default_rates[0], default_rates[1], default_rates[2],
+		DEFAULT_EDGES,
+		DEFAULT_RUNS,
+		PIN_LIMIT
+	);
+}
+
+int main(int argc, char** argv) {
+	const char* shim = DEFAULT_SHIM;
+	int rates[MAX_RATES];
+	int num_of_rates = 0;
+	int edges = -1;
+	int limit = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "s:r:n:Lvh")) != -1){
+		switch(opt){
+			case 's':
+				shim = optarg;
+				break;
+			case 'r':
+				for(char* s = strtok(optarg, ","); s; s = strtok(NULL, ",")){
+					if(num_of_rates == MAX_RATES || atoi(s) <= 0){
+						fprintf(stderr, "ERROR: Invalid rates!\n");
+						return 1;
+					}
+					rates[num_of_rates++] = atoi(s);
+				}
+				break;
+			case 'n':
+				edges = atoi(optarg);
+				break;
+			case 'L':
+				limit = 1;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'h':
+				usage(stdout);
+				return 0;
+			default:
+				usage(stderr);
+				return 1;
+		}
+	}
+	int num_of_cmds = argc - optind;
+	if(num_of_cmds < 1 || num_of_cmds > MAX_APPS){
+		usage(stderr);
+		return 1;
+	}
+	if(num_of_rates == 0){
+		for(int i = 0; i < 3; i++){
+			rates[num_of_rates++] = default_rates[i];
+		}
+	}
+	if(edges <= 0){
+		edges = limit ? DEFAULT_RUNS : DEFAULT_EDGES;
+	}
+
+	char shim_path[PATH_MAX];
+	if(!realpath(shim, shim_path)){
+		fprintf(stderr, "ERROR: No shim \"%s\": %s\n", shim, strerror(errno));
+		return 1;
+	}
+
+	// Records from shim.
+	sock_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, SOCK_FN, sizeof(addr.sun_path) - 1);
+	unlink(SOCK_FN);
+	if(sock_fd < 0 || bind(sock_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+		perror("Failed to bind " SOCK_FN);
+		return 1;
+	}
+
+	// Input levels for shim.
+	int pins_fd = open(PINS_FN, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(pins_fd < 0 || ftruncate(pins_fd, BENCH_E2E__PINS) != 0){
+		perror("Failed to create " PINS_FN);
+		return 1;
+	}
+	void* p = mmap(NULL, BENCH_E2E__PINS, PROT_READ | PROT_WRITE, MAP_SHARED, pins_fd, 0);
+	close(pins_fd);
+	if(p == MAP_FAILED){
+		perror("Failed to map " PINS_FN);
+		return 1;
+	}
+	pins = p;
+
+	// Joystick for shim. Opened read-write, so it never blocks on reader.
+	unlink(JS_FIFO_FN);
+	if(mkfifo(JS_FIFO_FN, 0644) != 0){
+		perror("Failed to create " JS_FIFO_FN);
+		return 1;
+	}
+	js_fd = open(JS_FIFO_FN, O_RDWR | O_CLOEXEC);
+	if(js_fd < 0){
+		perror("Failed to open " JS_FIFO_FN);
+		return 1;
+	}
+
+	setenv("LD_PRELOAD", shim_path, 1);
+	setenv(BENCH_E2E__ENV_SOCK, SOCK_FN, 1);
+	setenv(BENCH_E2E__ENV_JS, JS_FIFO_FN, 1);
+	setenv(BENCH_E2E__ENV_PINS, PINS_FN, 1);
+	signal(SIGPIPE, SIG_IGN);
+
+	for(int i = optind; i < argc; i++){
+		printf("%s %s\n", i == optind ? "App:" : "    ", argv[i]);
+	}
+
+	int r;
+	if(limit){
+		r = bench_limit(num_of_cmds, argv + optind, edges);
+	}else{
+		start_apps(num_of_cmds, argv + optind);
+		r = bench_joystick(rates, num_of_rates, edges);
+		stop_apps();
+	}
+
+	close(js_fd);
+	close(sock_fd);
+	unlink(JS_FIFO_FN);
+	unlink(SOCK_FN);
+	unlink(PINS_FN);
+
+	return r == 0 ? 0 : 1;
+}
@@ -0,0 +1,31 @@
+
+#ifndef BENCH_E2E_H
+#define BENCH_E2E_H
+
+#include <stdint.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Contract between bench_e2e and gpio_shim.so, preloaded into the app.
+
+// Unix datagram socket of bench_e2e, receives bench_e2e_write_t.
+#define BENCH_E2E__ENV_SOCK "BENCH_E2E_SOCK"
+// FIFO opened instead of /dev/input/js0.
+#define BENCH_E2E__ENV_JS "BENCH_E2E_JS"
+// File of BENCH_E2E__PINS bytes, levels the app reads back per pin.
+#define BENCH_E2E__ENV_PINS "BENCH_E2E_PINS"
+
+#define BENCH_E2E__PINS 64
+// What the shim reports to JSIOCGBUTTONS and JSIOCGAXES.
+#define BENCH_E2E__BUTTONS 12
+#define BENCH_E2E__AXES 2
+
+// One GPIO write of the app, stamped in the app at write().
+typedef struct {
+	uint64_t t_ns; // CLOCK_MONOTONIC
+	uint8_t pin;
+	uint8_t value;
+} bench_e2e_write_t;
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // BENCH_E2E_H
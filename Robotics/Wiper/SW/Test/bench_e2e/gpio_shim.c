@@ -0,0 +1,175 @@
+
+/*
+ * LD_PRELOAD shim which stands in for the hardware of the wiper apps:
+ * - /dev/gpio_stream writes are stamped and sent to bench_e2e,
+ *   reads return levels bench_e2e set in the pins file,
+ * - /dev/input/js0 is replaced by a FIFO that bench_e2e feeds.
+ * Apps run unmodified.
+ */
+
+#define _GNU_SOURCE // RTLD_NEXT
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/joystick.h>
+
+#include "gpio_ctrl.h"
+#include "bench_e2e.h"
+
+#define JS_DEV_FN "/dev/input/js0"
+
+static int (*real_open)(const char*, int, ...);
+static int (*real_open64)(const char*, int, ...);
+static ssize_t (*real_read)(int, void*, size_t);
+static ssize_t (*real_write)(int, const void*, size_t);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_close)(int);
+
+static int gpio_fd = -1;
+static int js_fd = -1;
+static int sock_fd = -1;
+static struct sockaddr_un sock_addr;
+static volatile uint8_t* pins;
+static uint8_t read_pin;
+
+__attribute__((constructor))
+static void shim_init(void) {
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_open64 = dlsym(RTLD_NEXT, "open64");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_close = dlsym(RTLD_NEXT, "close");
+
+	const char* sock_path = getenv(BENCH_E2E__ENV_SOCK);
+	if(sock_path){
+		sock_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		memset(&sock_addr, 0, sizeof(sock_addr));
+		sock_addr.sun_family = AF_UNIX;
+		strncpy(sock_addr.sun_path, sock_path, sizeof(sock_addr.sun_path) - 1);
+	}
+	const char* pins_path = getenv(BENCH_E2E__ENV_PINS);
+	if(pins_path){
+		int fd = real_open(pins_path, O_RDONLY | O_CLOEXEC);
+		if(fd >= 0){
+			void* p = mmap(NULL, BENCH_E2E__PINS, PROT_READ, MAP_SHARED, fd, 0);
+			if(p != MAP_FAILED){
+				pins = p;
+			}
+			real_close(fd);
+		}
+	}
+}
+
+static int shim_open(
+	int (*real)(const char*, int, ...),
+	const char* path,
+	int flags,
+	mode_t mode
+) {
+	if(strcmp(path, DEV_STREAM_FN) == 0){
+		// Any valid fd, which epoll refuses like the real driver does.
+		gpio_fd = real("/dev/null", O_RDWR | (flags & O_CLOEXEC));
+		return gpio_fd;
+	}
+	const char* js_path = getenv(BENCH_E2E__ENV_JS);
+	if(js_path && strcmp(path, JS_DEV_FN) == 0){
+		js_fd = real(js_path, flags);
+		return js_fd;
+	}
+	return real(path, flags, mode);
+}
+
+int open(const char* path, int flags, ...) {
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, mode_t);
+	va_end(ap);
+	return shim_open(real_open, path, flags, mode);
+}
+
+int open64(const char* path, int flags, ...) {
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, mode_t);
+	va_end(ap);
+	return shim_open(real_open64, path, flags, mode);
+}
+
+ssize_t write(int fd, const void* buf, size_t count) {
+	if(fd != gpio_fd || fd < 0){
+		return real_write(fd, buf, count);
+	}
+	const uint8_t* pkg = buf;
+	if(count >= 3 && pkg[0] == GPIO_CTRL__WRITE){
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		bench_e2e_write_t w = {
+			.t_ns = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec,
+			.pin = pkg[1],
+			.value = pkg[2]
+		};
+		if(sock_fd >= 0){
+			sendto(
+				sock_fd,
+				&w,
+				sizeof(w),
+				MSG_DONTWAIT,
+				(struct sockaddr*)&sock_addr,
+				sizeof(sock_addr)
+			);
+		}
+	}else if(count >= 2){
+		// Read, pull-up or pull-down, followed by read() of the level.
+		read_pin = pkg[1];
+	}
+	return count;
+}
+
+ssize_t read(int fd, void* buf, size_t count) {
+	if(fd != gpio_fd || fd < 0){
+		return real_read(fd, buf, count);
+	}
+	if(count < 1){
+		return 0;
+	}
+	*(uint8_t*)buf = pins && read_pin < BENCH_E2E__PINS ? pins[read_pin] : 0;
+	return 1;
+}
+
+int ioctl(int fd, unsigned long request, ...) {
+	va_list ap;
+	va_start(ap, request);
+	void* arg = va_arg(ap, void*);
+	va_end(ap);
+	if(fd == js_fd && fd >= 0){
+		if(request == JSIOCGBUTTONS){
+			*(uint8_t*)arg = BENCH_E2E__BUTTONS;
+			return 0;
+		}
+		if(request == JSIOCGAXES){
+			*(uint8_t*)arg = BENCH_E2E__AXES;
+			return 0;
+		}
+	}
+	return real_ioctl(fd, request, arg);
+}
+
+int close(int fd) {
+	if(fd == gpio_fd){
+		gpio_fd = -1;
+	}else if(fd == js_fd){
+		js_fd = -1;
+	}
+	return real_close(fd);
+}
@@ -0,0 +1,285 @@
+
+/*
+ * Fan-out of joy_node states to a fleet of wiper nodes, on loopback.
+ * Each subscriber is a process of its own, like a wiper_node, so CPU time
+ * of this process is that of the publisher: its thread and the ZeroMQ I/O
+ * thread, which does the per-subscriber work. For 1 to 64 subscribers,
+ * each state is sent:
+ * - all: broadcast, delivered to every subscriber,
+ * - node: to one node, round robin, dropped for the others by the
+ *   publisher, as subscriptions are filtered there.
+ */
+
+#include <stdint.h> // uint16_t and family
+#include <stdio.h> // printf and family
+#include <stdlib.h> // atoi()
+#include <string.h> // strerror()
+#include <unistd.h> // getopt(), fork()
+#include <time.h> // clock_nanosleep()
+#include <sys/mman.h>
+#include <sys/resource.h> // getrusage()
+#include <sys/wait.h>
+
+#include <zmq.h>
+
+#include "joy_msg.h"
+#include "lat_hist.h"
+
+#define DEFAULT_ENDPOINT "tcp://127.0.0.1:5557"
+#define DEFAULT_RATE 1000 // [msg/s]
+#define DEFAULT_DURATION 2 // [s] per case
+#define DEFAULT_MAX_SUBS 64
+
+// seq of the message which tells subscribers to stop.
+#define END_SEQ UINT32_MAX
+#define SUBSCRIBE_TIMEOUT_MS 5000
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t cpu_ns(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return
+		(uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)*1000000000ULL +
+		(uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)*1000ULL;
+}
+
+/**
+ * Body of a subscriber process, like wiper_node -n <id>.
+ */
+static void subscriber(int id, const char* endpoint, lat_hist_t* h) {
+	void* ctx = zmq_ctx_new();
+	void* sub = zmq_socket(ctx, ZMQ_SUB);
+	int hwm = 0; // Do not drop, loss would hide latency.
+	int timeout = 5000;
+	int linger = 0;
+	zmq_setsockopt(sub, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+	zmq_setsockopt(sub, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+	zmq_setsockopt(sub, ZMQ_LINGER, &linger, sizeof(linger));
+	char topic[JOY_MSG__TOPIC_SIZE];
+	char name[16];
+	snprintf(name, sizeof(name), "%d", id);
+	joy_msg__topic(topic, JOY_MSG__TOPIC_ALL, "");
+	zmq_setsockopt(sub, ZMQ_SUBSCRIBE, topic, JOY_MSG__TOPIC_SIZE);
+	joy_msg__topic(topic, JOY_MSG__TOPIC_NODE, name);
+	zmq_setsockopt(sub, ZMQ_SUBSCRIBE, topic, JOY_MSG__TOPIC_SIZE);
+	// Publisher may not be bound yet, connect retries.
+	zmq_connect(sub, endpoint);
+
+	joy_frame_t frame;
+	while(1){
+		int n = zmq_recv(sub, &frame, sizeof(frame), 0);
+		uint64_t t = now_ns();
+		if(n < 0){
+			break; // Timeout, publisher is gone.
+		}
+		const joy_msg_t* msg = joy_msg__parse_frame(&frame, n);
+		if(!msg){
+			continue;
+		}
+		if(msg->seq == END_SEQ){
+			break;
+		}
+		lat_hist__add(h, t - msg->pub_time_ns);
+	}
+
+	zmq_close(sub);
+	zmq_ctx_destroy(ctx);
+}
+
+static int run_case(
+	const char* endpoint,
+	int num_of_subs,
+	int unicast,
+	int rate,
+	int duration,
+	lat_hist_t* hists
+) {
+	// Fork before this process has a ZeroMQ context, children make their own.
+	pid_t pids[DEFAULT_MAX_SUBS];
+	for(int i = 0; i < num_of_subs; i++){
+		lat_hist__reset(&hists[i]);
+		pids[i] = fork();
+		if(pids[i] < 0){
+			perror("ERROR: fork()");
+			return 1;
+		}
+		if(pids[i] == 0){
+			subscriber(i, endpoint, &hists[i]);
+			_exit(0);
+		}
+	}
+
+	void* ctx = zmq_ctx_new();
+	void* pub = zmq_socket(ctx, ZMQ_XPUB);
+	int hwm = 0;
+	int linger = 0;
+	int verbose = 1;
+	int timeout = SUBSCRIBE_TIMEOUT_MS;
+	zmq_setsockopt(pub, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+	zmq_setsockopt(pub, ZMQ_LINGER, &linger, sizeof(linger));
+	zmq_setsockopt(pub, ZMQ_XPUB_VERBOSE, &verbose, sizeof(verbose));
+	zmq_setsockopt(pub, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+	int r = 0;
+	if(zmq_bind(pub, endpoint) != 0){
+		fprintf(stderr, "ERROR: %s: %s\n", endpoint, zmq_strerror(zmq_errno()));
+		r = 1;
+	}
+
+	// Each subscriber subscribes to broadcast and to itself.
+	uint8_t sub_msg[64];
+	for(int got = 0; r == 0 && got < 2*num_of_subs; got++){
+		if(zmq_recv(pub, sub_msg, sizeof(sub_msg), 0) < 0){
+			fprintf(stderr, "ERROR: Only %d of %d subscriptions\n", got, 2*num_of_subs);
+			r = 1;
+		}
+	}
+
+	long n_msgs = (long)rate*duration;
+	joy_frame_t frame;
+	joy_msg__init(&frame.msg, 12, 6);
+	char name[16];
+	uint64_t period_ns = 1000000000ULL/rate;
+	uint64_t t0 = now_ns();
+	uint64_t cpu0 = cpu_ns();
+	uint64_t next_ns = t0;
+	for(long i = 0; r == 0 && i < n_msgs; i++){
+		next_ns += period_ns;
+		struct timespec ts = {
+			.tv_sec = next_ns/1000000000ULL,
+			.tv_nsec = next_ns%1000000000ULL
+		};
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		if(unicast){
+			snprintf(name, sizeof(name), "%ld", i % num_of_subs);
+			joy_msg__topic(frame.topic, JOY_MSG__TOPIC_NODE, name);
+		}else{
+			joy_msg__topic(frame.topic, JOY_MSG__TOPIC_ALL, "");
+		}
+		frame.msg.seq = i;
+		frame.msg.buttons = i & 0x7;
+		frame.msg.pub_time_ns = now_ns(); // Monotonic here, all ends share it.
+		zmq_send(pub, &frame, sizeof(frame), 0);
+	}
+	uint64_t cpu = cpu_ns() - cpu0;
+	uint64_t wall = now_ns() - t0;
+
+	joy_msg__topic(frame.topic, JOY_MSG__TOPIC_ALL, "");
+	frame.msg.seq = END_SEQ;
+	zmq_send(pub, &frame, sizeof(frame), 0);
+	for(int i = 0; i < num_of_subs; i++){
+		waitpid(pids[i], NULL, 0);
+	}
+
+	if(r == 0){
+		static lat_hist_t all;
+		lat_hist__reset(&all);
+		for(int i = 0; i < num_of_subs; i++){
+			lat_hist__merge(&all, &hists[i]);
+		}
+		long expected = unicast ? n_msgs : n_msgs*num_of_subs;
+		printf(
+			"%6d %-5s %8ld %10llu %10ld %7.1f %9.2f %9.1f %9.1f %9.1f\n",
+			num_of_subs,
+			unicast ? "node" : "all",
+			n_msgs,
+			(unsigned long long)all.count,
+			expected,
+			100.0*cpu/wall,
+			cpu/1e3/n_msgs,
+			lat_hist__percentile(&all, 50)/1e3,
+			lat_hist__percentile(&all, 99)/1e3,
+			all.max/1e3
+		);
+	}
+
+	// Free endpoint right away, next case binds it again.
+	zmq_unbind(pub, endpoint);
+	zmq_close(pub);
+	zmq_ctx_destroy(ctx);
+	return r;
+}
+
+static void usage(FILE* f) {
+	fprintf(f,
+"\nUsage: "\
+"\n	bench_fanout [-e <endpoint>] [-r <msg/s>] [-d <seconds>] [-n <subs>]"\
+"\n	-e	endpoint of publisher (default %s)"\
+"\n	-r	states per second (default %d)"\
+"\n	-d	duration of each case (default %d)"\
+"\n	-n	max subscriber processes, doubled from 1 (default %d)"\
+"\n",
+		DEFAULT_ENDPOINT,
+		DEFAULT_RATE,
+		DEFAULT_DURATION,
+		DEFAULT_MAX_SUBS
+	);
+}
+
+int main(int argc, char** argv) {
+	const char* endpoint = DEFAULT_ENDPOINT;
+	int rate = DEFAULT_RATE;
+	int duration = DEFAULT_DURATION;
+	int max_subs = DEFAULT_MAX_SUBS;
+	int opt;
+	while((opt = getopt(argc, argv, "e:r:d:n:h")) != -1){
+		switch(opt){
+			case 'e':
+				endpoint = optarg;
+				break;
+			case 'r':
+				rate = atoi(optarg);
+				break;
+			case 'd':
+				duration = atoi(optarg);
+				break;
+			case 'n':
+				max_subs = atoi(optarg);
+				break;
+			case 'h':
+				usage(stdout);
+				return 0;
+			default:
+				usage(stderr);
+				return 1;
+		}
+	}
+	if(rate <= 0 || duration <= 0 || max_subs <= 0 || max_subs > DEFAULT_MAX_SUBS){
+		fprintf(stderr, "ERROR: Invalid rate, duration or subscribers!\n");
+		return 1;
+	}
+
+	// Subscriber processes fill in their histogram here.
+	lat_hist_t* hists = mmap(
+		NULL,
+		max_subs*sizeof(lat_hist_t),
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS,
+		-1,
+		0
+	);
+	if(hists == MAP_FAILED){
+		perror("ERROR: mmap()");
+		return 1;
+	}
+
+	printf(
+		"%6s %-5s %8s %10s %10s %7s %9s %9s %9s %9s\n",
+		"subs", "to", "sent", "delivered", "expected",
+		"cpu[%]", "cpu/msg", "p50[us]", "p99[us]", "max[us]"
+	);
+	int r = 0;
+	for(int n = 1; n <= max_subs && r == 0; n *= 2){
+		r |= run_case(endpoint, n, 0, rate, duration, hists);
+		r |= run_case(endpoint, n, 1, rate, duration, hists);
+	}
+	printf("cpu: publisher process, cpu/msg: [us] per state sent\n");
+
+	munmap(hists, max_subs*sizeof(lat_hist_t));
+	return r;
+}
@@ -0,0 +1,192 @@
+
+/*
+ * Nanosecond-scale benchmark of the shared-memory seqlock transport:
+ * cost of shm_state__publish() and shm_state__read(), and publish-to-snapshot
+ * latency of a reader that sleeps on the futex or spins on seq.
+ */
+
+#include <stdint.h> // uint16_t and family
+#include <stdio.h> // printf and family
+#include <stdlib.h> // qsort()
+#include <unistd.h> // getopt()
+#include <pthread.h>
+#include <time.h> // clock_nanosleep()
+
+#include "shm_state.h"
+
+#define SHM_NAME "/bench_shm"
+#define DEFAULT_N 100000
+#define LATENCY_PERIOD_US 200 // Between publishes in latency runs.
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void print_percentiles(const char* name, uint64_t* ns, long n) {
+	qsort(ns, n, sizeof(uint64_t), cmp_u64);
+	printf(
+		"%-24s %8ld %10llu %10llu %10llu\n",
+		name,
+		n,
+		(unsigned long long)ns[n*50/100],
+		(unsigned long long)ns[n*99/100],
+		(unsigned long long)ns[n-1]
+	);
+}
+
+typedef struct {
+	shm_state_t* shm;
+	long n;
+	int spin;
+	uint64_t* lat_ns;
+	long received;
+} reader_arg_t;
+
+static void* reader_thread(void* arg) {
+	reader_arg_t* a = arg;
+	shm_state_t* shm = shm_state__open(SHM_NAME, 0);
+	joy_msg_t msg;
+	uint32_t seen = shm_state__read(shm, &msg); // Skip leftovers.
+	while(a->received < a->n){
+		if(a->spin){
+			while(atomic_load_explicit(&shm->seq, memory_order_acquire) == seen){
+			}
+		}else if(!shm_state__wait(shm, seen, 1000)){
+			break; // Writer is gone.
+		}
+		uint32_t s = shm_state__read(shm, &msg);
+		uint64_t t = now_ns();
+		if(s == seen || s == SHM_STATE__BUSY){
+			continue;
+		}
+		seen = s;
+		if(msg.seq == (uint32_t)-1){
+			break; // End marker.
+		}
+		a->lat_ns[a->received++] = t - msg.pub_time_ns;
+	}
+	shm_state__close(shm);
+	return NULL;
+}
+
+static void run_latency(shm_state_t* shm, long n, int spin) {
+	reader_arg_t a = {
+		.n = n,
+		.spin = spin,
+		.lat_ns = malloc(n*sizeof(uint64_t)),
+	};
+	pthread_t reader;
+	pthread_create(&reader, NULL, reader_thread, &a);
+	usleep(100000); // Let reader go to sleep.
+
+	joy_msg_t msg;
+	joy_msg__init(&msg, 12, 6);
+	uint64_t next_ns = now_ns();
+	for(long i = 0; i < n; i++){
+		// Spaced out, so the reader sees every update.
+		next_ns += LATENCY_PERIOD_US*1000ULL;
+		struct timespec ts = {
+			.tv_sec = next_ns/1000000000ULL,
+			.tv_nsec = next_ns%1000000000ULL
+		};
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		msg.seq = i;
+		msg.pub_time_ns = now_ns();
+		shm_state__publish(shm, &msg);
+	}
+	usleep(LATENCY_PERIOD_US);
+	msg.seq = (uint32_t)-1;
+	shm_state__publish(shm, &msg);
+	pthread_join(reader, NULL);
+
+	if(a.received){
+		print_percentiles(spin ? "latency, spin [ns]" : "latency, futex [ns]", a.lat_ns, a.received);
+	}
+	if(a.received != n){
+		printf("  reader missed %ld updates\n", n - a.received);
+	}
+	free(a.lat_ns);
+}
+
+static void usage(FILE* f) {
+	fprintf(f,
+"\nUsage: "\
+"\n	bench_shm [-n <count>]"\
+"\n	-n	samples per measurement (default %d)"\
+"\n",
+		DEFAULT_N
+	);
+}
+
+int main(int argc, char** argv) {
+	long n = DEFAULT_N;
+	int opt;
+	while((opt = getopt(argc, argv, "n:h")) != -1){
+		switch(opt){
+			case 'n':
+				n = atol(optarg);
+				break;
+			case 'h':
+				usage(stdout);
+				return 0;
+			default:
+				usage(stderr);
+				return 1;
+		}
+	}
+	if(n <= 0){
+		fprintf(stderr, "ERROR: Count must be positive!\n");
+		return 1;
+	}
+
+	shm_state_t* shm = shm_state__open(SHM_NAME, 1);
+	if(!shm){
+		perror("ERROR: shm_state__open()");
+		return 2;
+	}
+	uint64_t* ns = malloc(n*sizeof(uint64_t));
+	joy_msg_t msg;
+	joy_msg__init(&msg, 12, 6);
+
+	printf(
+		"%-24s %8s %10s %10s %10s\n",
+		"measurement", "samples", "p50", "p99", "max"
+	);
+
+	// Cost of one call, timed in blocks of 100 to be above clock resolution.
+	for(long i = 0; i < n; i++){
+		uint64_t t0 = now_ns();
+		for(int j = 0; j < 100; j++){
+			msg.seq++;
+			shm_state__publish(shm, &msg);
+		}
+		ns[i] = (now_ns() - t0)/100;
+	}
+	print_percentiles("publish [ns]", ns, n);
+
+	for(long i = 0; i < n; i++){
+		uint64_t t0 = now_ns();
+		for(int j = 0; j < 100; j++){
+			shm_state__read(shm, &msg);
+		}
+		ns[i] = (now_ns() - t0)/100;
+	}
+	print_percentiles("read [ns]", ns, n);
+
+	long n_latency = n < 10000 ? n : 10000;
+	run_latency(shm, n_latency, 1);
+	run_latency(shm, n_latency, 0);
+
+	free(ns);
+	shm_state__close(shm);
+	shm_unlink(SHM_NAME);
+	return 0;
+}
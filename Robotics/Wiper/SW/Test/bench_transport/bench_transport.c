@@ -0,0 +1,207 @@
+
+/*
+ * Publish-to-receive latency of joy_msg_t over ZeroMQ transports.
+ * Publisher and subscriber run as two threads of this process, so inproc://
+ * can be compared with tcp:// and ipc://, and one CLOCK_MONOTONIC serves
+ * both ends.
+ */
+
+#include <stdint.h> // uint16_t and family
+#include <stdio.h> // printf and family
+#include <stdlib.h> // qsort()
+#include <string.h> // strerror()
+#include <unistd.h> // getopt()
+#include <pthread.h>
+#include <time.h> // clock_nanosleep()
+
+#include <zmq.h>
+
+#include "joy_msg.h"
+
+#define DEFAULT_DURATION 2 // [s] per case
+
+static const char* default_endpoints[] = {
+	"tcp://127.0.0.1:5556",
+	"ipc:///tmp/bench_transport.ipc",
+	"inproc://bench_transport",
+};
+static const int rates[] = { 100, 1000, 10000 }; // [msg/s]
+
+#define ARRAY_LEN(a) (sizeof(a)/sizeof((a)[0]))
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+typedef struct {
+	void* sub;
+	long n_msgs;
+	uint64_t* lat_ns;
+	long received;
+} rx_arg_t;
+
+static void* rx_thread(void* arg) {
+	rx_arg_t* a = arg;
+	joy_msg_t buf;
+	while(a->received < a->n_msgs){
+		int n = zmq_recv(a->sub, &buf, sizeof(buf), 0);
+		uint64_t t = now_ns();
+		if(n < 0){
+			break; // Timeout, rest is lost.
+		}
+		const joy_msg_t* msg = joy_msg__parse(&buf, n);
+		if(msg){
+			a->lat_ns[a->received++] = t - msg->pub_time_ns;
+		}
+	}
+	return NULL;
+}
+
+static int run_case(
+	void* ctx,
+	const char* endpoint,
+	int rate,
+	int duration
+) {
+	long n_msgs = (long)rate*duration;
+	void* pub = zmq_socket(ctx, ZMQ_PUB);
+	void* sub = zmq_socket(ctx, ZMQ_SUB);
+	int hwm = 0; // Do not drop, loss would hide latency.
+	int timeout = 1000;
+	int linger = 0;
+	zmq_setsockopt(pub, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+	zmq_setsockopt(pub, ZMQ_LINGER, &linger, sizeof(linger));
+	zmq_setsockopt(sub, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+	zmq_setsockopt(sub, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+	zmq_setsockopt(sub, ZMQ_LINGER, &linger, sizeof(linger));
+	zmq_setsockopt(sub, ZMQ_SUBSCRIBE, "", 0);
+	if(zmq_bind(pub, endpoint) != 0 || zmq_connect(sub, endpoint) != 0){
+		fprintf(stderr, "ERROR: %s: %s\n", endpoint, zmq_strerror(zmq_errno()));
+		zmq_close(sub);
+		zmq_close(pub);
+		return 1;
+	}
+
+	// Wait for subscription to reach the publisher.
+	uint8_t probe[64];
+	while(1){
+		zmq_send(pub, "", 0, 0);
+		zmq_pollitem_t item = { sub, 0, ZMQ_POLLIN, 0 };
+		if(zmq_poll(&item, 1, 10) > 0){
+			break;
+		}
+	}
+	while(zmq_recv(sub, probe, sizeof(probe), ZMQ_DONTWAIT) >= 0){
+	}
+
+	rx_arg_t a = {
+		.sub = sub,
+		.n_msgs = n_msgs,
+		.lat_ns = malloc(n_msgs*sizeof(uint64_t)),
+	};
+	pthread_t rx;
+	pthread_create(&rx, NULL, rx_thread, &a);
+
+	joy_msg_t msg;
+	joy_msg__init(&msg, 12, 6);
+	uint64_t period_ns = 1000000000ULL/rate;
+	uint64_t next_ns = now_ns();
+	for(long i = 0; i < n_msgs; i++){
+		next_ns += period_ns;
+		struct timespec ts = {
+			.tv_sec = next_ns/1000000000ULL,
+			.tv_nsec = next_ns%1000000000ULL
+		};
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		msg.seq = i;
+		msg.buttons = i & 0x7;
+		msg.pub_time_ns = now_ns(); // Monotonic here, both ends share it.
+		zmq_send(pub, &msg, sizeof(msg), 0);
+	}
+	pthread_join(rx, NULL);
+
+	printf("%-32s %8d %8ld %8ld", endpoint, rate, n_msgs, a.received);
+	if(a.received){
+		qsort(a.lat_ns, a.received, sizeof(uint64_t), cmp_u64);
+		printf(
+			" %9.1f %9.1f %9.1f\n",
+			a.lat_ns[a.received*50/100]/1e3,
+			a.lat_ns[a.received*99/100]/1e3,
+			a.lat_ns[a.received-1]/1e3
+		);
+	}else{
+		printf(" %9s %9s %9s\n", "-", "-", "-");
+	}
+
+	free(a.lat_ns);
+	zmq_close(sub);
+	// Free endpoint right away, next case binds it again.
+	zmq_unbind(pub, endpoint);
+	zmq_close(pub);
+	return 0;
+}
+
+static void usage(FILE* f) {
+	fprintf(f,
+"\nUsage: "\
+"\n	bench_transport [-d <seconds>] [<endpoint>...]"\
+"\n	-d	duration of each case (default %d)"\
+"\n	Each endpoint is measured at 100, 1k and 10k msg/s."\
+"\n	Default endpoints are tcp://, ipc:// and inproc:// ones."\
+"\n",
+		DEFAULT_DURATION
+	);
+}
+
+int main(int argc, char** argv) {
+	int duration = DEFAULT_DURATION;
+	int opt;
+	while((opt = getopt(argc, argv, "d:h")) != -1){
+		switch(opt){
+			case 'd':
+				duration = atoi(optarg);
+				break;
+			case 'h':
+				usage(stdout);
+				return 0;
+			default:
+				usage(stderr);
+				return 1;
+		}
+	}
+	if(duration <= 0){
+		fprintf(stderr, "ERROR: Duration must be positive!\n");
+		return 1;
+	}
+
+	const char** endpoints = default_endpoints;
+	int num_of_endpoints = ARRAY_LEN(default_endpoints);
+	if(optind < argc){
+		endpoints = (const char**)&argv[optind];
+		num_of_endpoints = argc - optind;
+	}
+
+	void* ctx = zmq_ctx_new();
+	printf(
+		"%-32s %8s %8s %8s %9s %9s %9s\n",
+		"endpoint", "msg/s", "sent", "recv", "p50[us]", "p99[us]", "max[us]"
+	);
+	int r = 0;
+	for(int e = 0; e < num_of_endpoints; e++){
+		for(unsigned i = 0; i < ARRAY_LEN(rates); i++){
+			r |= run_case(ctx, endpoints[e], rates[i], duration);
+		}
+	}
+	zmq_ctx_destroy(ctx);
+
+	return r;
+}
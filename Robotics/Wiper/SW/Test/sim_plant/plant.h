@@ -0,0 +1,187 @@
+
+#ifndef PLANT_H
+#define PLANT_H
+
+#include <stdint.h>
+#include <math.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Simulated wiper, what /dev/gpio_stream drives, see work.txt.
+//
+// Motor is enabled by pin 2 and turns CCW (3 = 1, 4 = 0) back towards
+// park, or CW (3 = 0, 4 = 1) forward. Its angular velocity follows the
+// drive as a first order lag, so it spins up and coasts down. The park
+// switch is shorted at the backward limit, the external limit switch on
+// pin 22 at the forward limit. Past either the wiper hits a hard stop.
+//
+// State is shared between sim_plant and plant_shim.so, preloaded into the
+// app, through a mapped file. The plant is advanced to the app's clock
+// whenever the app looks at it. That clock is CLOCK_MONOTONIC, or on the
+// virtual clock, CLOCK_MONOTONIC plus all sleeps the app skipped so far,
+// so the app's own computing still takes the time it really takes.
+
+// Contract between sim_plant and plant_shim.so.
+#define PLANT__ENV_STATE "SIM_PLANT_STATE"
+
+#define PLANT__PINS 64
+#define PLANT__PIN_EN 2
+#define PLANT__PIN_CCW 3
+#define PLANT__PIN_CW 4
+#define PLANT__PIN_LIMIT 22
+// Park switch is not wired to the Pi yet, this is where it would go.
+#define PLANT__PIN_PARK 23
+
+// Longest step of integration, switches are found within it.
+#define PLANT__STEP_NS 50000
+
+typedef struct {
+	double speed;     // Motor at full drive [deg/s].
+	double spin_up_s; // Time constant of spin-up and coasting [s].
+	double brake_s;   // Time constant with both bridge halves equal [s].
+	double park;      // Park switch shorted at or below [deg].
+	double limit;     // Limit switch shorted at or above [deg].
+	double hard_stop; // Beyond park and limit, by this much [deg].
+} plant_params_t;
+
+#define PLANT__DEFAULT_PARAMS { \
+	.speed = 120, \
+	.spin_up_s = 0.05, \
+	.brake_s = 0.01, \
+	.park = 2, \
+	.limit = 90, \
+	.hard_stop = 10 \
+}
+
+typedef struct {
+	// Set by sim_plant.
+	plant_params_t params;
+	uint8_t virtual_clock;
+	uint64_t skipped_ns; // Virtual clock is ahead of CLOCK_MONOTONIC by this.
+
+	// Plant.
+	uint64_t t_ns;     // Plant is advanced until here.
+	double angle;      // 0 at park, growing CW [deg].
+	double omega;      // [deg/s]
+	uint8_t pins[PLANT__PINS]; // Levels written by the app.
+
+	// Of the run, for sim_plant.
+	uint64_t trip_ns;  // Limit switch shorted, 0 if it never was.
+	uint64_t stop_ns;  // First EN low after trip_ns, 0 if none.
+	double peak;       // Furthest angle reached [deg].
+	uint32_t hard_stops;
+	uint32_t writes;
+	uint32_t reads;
+} plant_t;
+
+/**
+ * Back to park, at rest, with nothing driven.
+ */
+static inline void plant__reset(plant_t* p, uint64_t now_ns) {
+	for(int i = 0; i < PLANT__PINS; i++){
+		p->pins[i] = 0;
+	}
+	p->t_ns = now_ns;
+	p->angle = 0;
+	p->omega = 0;
+	p->trip_ns = 0;
+	p->stop_ns = 0;
+	p->peak = 0;
+	p->hard_stops = 0;
+	p->writes = 0;
+	p->reads = 0;
+}
+
+/**
+ * Velocity the drive pulls towards, and how fast [s].
+ */
+static inline double plant__drive(const plant_t* p, double* tau) {
+	*tau = p->params.spin_up_s;
+	if(!p->pins[PLANT__PIN_EN]){
+		return 0; // Coasting.
+	}
+	uint8_t ccw = p->pins[PLANT__PIN_CCW];
+	uint8_t cw = p->pins[PLANT__PIN_CW];
+	if(ccw == cw){
+		*tau = p->params.brake_s; // Motor shorted through the bridge.
+		return 0;
+	}
+	return cw ? p->params.speed : -p->params.speed;
+}
+
+static inline void plant__step(plant_t* p, double dt) {
+	double tau;
+	double target = plant__drive(p, &tau);
+	double decay = exp(-dt/tau);
+	// Exact for a first order lag over the step.
+	double angle = p->angle + target*dt + (p->omega - target)*tau*(1 - decay);
+	double omega = target + (p->omega - target)*decay;
+
+	double lo = p->params.park - p->params.hard_stop;
+	double hi = p->params.limit + p->params.hard_stop;
+	if(angle < lo || angle > hi){
+		angle = angle < lo ? lo : hi;
+		omega = 0;
+		p->hard_stops++;
+	}
+	p->angle = angle;
+	p->omega = omega;
+	if(angle > p->peak){
+		p->peak = angle;
+	}
+}
+
+static inline int plant__switch(const plant_t* p, uint8_t pin) {
+	if(pin == PLANT__PIN_LIMIT){
+		return p->angle >= p->params.limit;
+	}
+	if(pin == PLANT__PIN_PARK){
+		return p->angle <= p->params.park;
+	}
+	return -1;
+}
+
+/**
+ * Advance plant to @a now_ns.
+ */
+static inline void plant__advance(plant_t* p, uint64_t now_ns) {
+	while(p->t_ns < now_ns){
+		uint64_t dt_ns = now_ns - p->t_ns;
+		if(dt_ns > PLANT__STEP_NS){
+			dt_ns = PLANT__STEP_NS;
+		}
+		plant__step(p, dt_ns/1e9);
+		p->t_ns += dt_ns;
+		if(!p->trip_ns && plant__switch(p, PLANT__PIN_LIMIT)){
+			p->trip_ns = p->t_ns;
+		}
+	}
+}
+
+static inline void plant__write(plant_t* p, uint8_t pin, uint8_t value, uint64_t now_ns) {
+	plant__advance(p, now_ns);
+	p->writes++;
+	if(pin >= PLANT__PINS){
+		return;
+	}
+	p->pins[pin] = value != 0;
+	if(pin == PLANT__PIN_EN && !value && p->trip_ns && !p->stop_ns){
+		p->stop_ns = now_ns;
+	}
+}
+
+/**
+ * @return level of @a pin: a switch, else what was written to it.
+ */
+static inline uint8_t plant__read(plant_t* p, uint8_t pin, uint64_t now_ns) {
+	plant__advance(p, now_ns);
+	p->reads++;
+	if(pin >= PLANT__PINS){
+		return 0;
+	}
+	int level = plant__switch(p, pin);
+	return level >= 0 ? level : p->pins[pin];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+#endif // PLANT_H
@@ -0,0 +1,251 @@
+/*
+ * LD_PRELOAD shim which puts the simulated wiper of plant.h behind
+ * /dev/gpio_stream: writes drive the motor, reads return its switches.
+ * With the virtual clock, sleeps of the app return at once and move its
+ * CLOCK_MONOTONIC and CLOCK_REALTIME ahead by what they skipped, so the app
+ * only takes as long as it computes. That holds for apps which wait by
+ * sleeping, as 3_Limit_SW does; timerfd and epoll timeouts stay real.
+ * Apps run unmodified.
+ */
+
+#define _GNU_SOURCE // RTLD_NEXT
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "gpio_ctrl.h"
+#include "plant.h"
+
+static int (*real_open)(const char*, int, ...);
+static int (*real_open64)(const char*, int, ...);
+static ssize_t (*real_read)(int, void*, size_t);
+static ssize_t (*real_write)(int, const void*, size_t);
+static int (*real_close)(int);
+static int (*real_clock_gettime)(clockid_t, struct timespec*);
+
+static int gpio_fd = -1;
+static plant_t* plant;
+static uint8_t read_pin;
+// Apps may drive GPIO from several threads.
+static pthread_mutex_t plant_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t ts_to_ns(const struct timespec* ts) {
+	return (uint64_t)ts->tv_sec*1000000000ULL + ts->tv_nsec;
+}
+
+static void ns_to_ts(uint64_t ns, struct timespec* ts) {
+	ts->tv_sec = ns/1000000000ULL;
+	ts->tv_nsec = ns%1000000000ULL;
+}
+
+static uint64_t real_now_ns(clockid_t clk) {
+	struct timespec ts;
+	real_clock_gettime(clk, &ts);
+	return ts_to_ns(&ts);
+}
+
+static int is_virtual(void) {
+	return plant && plant->virtual_clock;
+}
+
+/**
+ * Clock of the app, which the plant follows.
+ */
+static uint64_t plant_now_ns(void) {
+	uint64_t skipped_ns = plant->virtual_clock ? __atomic_load_n(&plant->skipped_ns, __ATOMIC_RELAXED) : 0;
+	return real_now_ns(CLOCK_MONOTONIC) + skipped_ns;
+}
+
+__attribute__((constructor))
+static void shim_init(void) {
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_open64 = dlsym(RTLD_NEXT, "open64");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_clock_gettime = dlsym(RTLD_NEXT, "clock_gettime");
+
+	const char* state_path = getenv(PLANT__ENV_STATE);
+	if(state_path){
+		int fd = real_open(state_path, O_RDWR | O_CLOEXEC);
+		if(fd >= 0){
+			void* p = mmap(NULL, sizeof(plant_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(p != MAP_FAILED){
+				plant = p;
+			}
+			real_close(fd);
+		}
+	}
+}
+
+static int shim_open(
+	int (*real)(const char*, int, ...),
+	const char* path,
+	int flags,
+	mode_t mode
+) {
+	if(plant && strcmp(path, DEV_STREAM_FN) == 0){
+		// Any valid fd, which epoll refuses like the real driver does.
+		gpio_fd = real("/dev/null", O_RDWR | (flags & O_CLOEXEC));
+		return gpio_fd;
+	}
+	return real(path, flags, mode);
+}
+
+int open(const char* path, int flags, ...) {
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, mode_t);
+	va_end(ap);
+	return shim_open(real_open, path, flags, mode);
+}
+
+int open64(const char* path, int flags, ...) {
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, mode_t);
+	va_end(ap);
+	return shim_open(real_open64, path, flags, mode);
+}
+
+ssize_t write(int fd, const void* buf, size_t count) {
+	if(fd != gpio_fd || fd < 0){
+		return real_write(fd, buf, count);
+	}
+	const uint8_t* pkg = buf;
+	pthread_mutex_lock(&plant_mtx);
+	if(count >= 3 && pkg[0] == GPIO_CTRL__WRITE){
+		plant__write(plant, pkg[1], pkg[2], plant_now_ns());
+	}else if(count >= 2){
+		// Read, pull-up or pull-down, followed by read() of the level.
+		read_pin = pkg[1];
+	}
+	pthread_mutex_unlock(&plant_mtx);
+	return count;
+}
+
+ssize_t read(int fd, void* buf, size_t count) {
+	if(fd != gpio_fd || fd < 0){
+		return real_read(fd, buf, count);
+	}
+	if(count < 1){
+		return 0;
+	}
+	pthread_mutex_lock(&plant_mtx);
+	*(uint8_t*)buf = plant__read(plant, read_pin, plant_now_ns());
+	pthread_mutex_unlock(&plant_mtx);
+	return 1;
+}
+
+int close(int fd) {
+	if(fd == gpio_fd){
+		gpio_fd = -1;
+	}
+	return real_close(fd);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Virtual clock.
+
+int clock_gettime(clockid_t clk, struct timespec* ts) {
+	int r = real_clock_gettime(clk, ts);
+	if(r != 0 || !is_virtual()){
+		return r;
+	}
+	switch(clk){
+		case CLOCK_MONOTONIC:
+		case CLOCK_MONOTONIC_RAW:
+		case CLOCK_MONOTONIC_COARSE:
+		case CLOCK_BOOTTIME:
+		case CLOCK_REALTIME:
+		case CLOCK_REALTIME_COARSE:
+			ns_to_ts(ts_to_ns(ts) + __atomic_load_n(&plant->skipped_ns, __ATOMIC_RELAXED), ts);
+			break;
+		default:
+			// CPU time clocks stay real.
+			break;
+	}
+	return 0;
+}
+
+/**
+ * Skip a sleep of @a ns: move the clock ahead instead, and let other
+ * threads run, as a sleep would.
+ */
+static void virtual_sleep(int64_t ns) {
+	if(ns > 0){
+		__atomic_add_fetch(&plant->skipped_ns, ns, __ATOMIC_RELAXED);
+	}
+	sched_yield();
+}
+
+int clock_nanosleep(clockid_t clk, int flags, const struct timespec* req, struct timespec* rem) {
+	if(!is_virtual() || (clk != CLOCK_MONOTONIC && clk != CLOCK_REALTIME)){
+		static int (*real)(clockid_t, int, const struct timespec*, struct timespec*);
+		if(!real){
+			real = dlsym(RTLD_NEXT, "clock_nanosleep");
+		}
+		return real(clk, flags, req, rem);
+	}
+	if(flags & TIMER_ABSTIME){
+		struct timespec now;
+		clock_gettime(clk, &now);
+		virtual_sleep(ts_to_ns(req) - ts_to_ns(&now));
+	}else{
+		virtual_sleep(ts_to_ns(req));
+	}
+	if(rem){
+		memset(rem, 0, sizeof(*rem));
+	}
+	return 0;
+}
+
+int nanosleep(const struct timespec* req, struct timespec* rem) {
+	if(!is_virtual()){
+		static int (*real)(const struct timespec*, struct timespec*);
+		if(!real){
+			real = dlsym(RTLD_NEXT, "nanosleep");
+		}
+		return real(req, rem);
+	}
+	virtual_sleep(ts_to_ns(req));
+	if(rem){
+		memset(rem, 0, sizeof(*rem));
+	}
+	return 0;
+}
+
+int usleep(useconds_t us) {
+	if(!is_virtual()){
+		static int (*real)(useconds_t);
+		if(!real){
+			real = dlsym(RTLD_NEXT, "usleep");
+		}
+		return real(us);
+	}
+	virtual_sleep(us*1000ULL);
+	return 0;
+}
+
+unsigned int sleep(unsigned int s) {
+	if(!is_virtual()){
+		static unsigned int (*real)(unsigned int);
+		if(!real){
+			real = dlsym(RTLD_NEXT, "sleep");
+		}
+		return real(s);
+	}
+	virtual_sleep(s*1000000000ULL);
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,288 @@
+/*
+ * Closed loop test of the wiper apps against a simulated wiper, plant.h,
+ * preloaded as plant_shim.so in place of /dev/gpio_stream. The app is
+ * restarted for every run, with the wiper back at park, and drives it on
+ * its own, like 3_Limit_SW: CW until the limit switch trips, then stop.
+ * Per run:
+ * - stop latency: limit switch shorted until EN low, plant time,
+ * - overshoot: how far the wiper coasted past the switch,
+ * - hard stops: runs which drove the wiper into the end of travel.
+ * On the virtual clock, runs take only as long as the app computes.
+ */
+
+#include <stdint.h> // uint16_t and family
+#include <stdio.h> // printf and family
+#include <stdlib.h> // exit()
+#include <string.h> // strerror()
+#include <unistd.h> // getopt()
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <limits.h> // PATH_MAX
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "plant.h"
+#include "lat_hist.h"
+
+#define DEFAULT_SHIM "build/libplant_shim.so"
+#define DEFAULT_RUNS 1000
+#define DEFAULT_TIMEOUT_MS 10000 // Real time, per run.
+
+#define STATE_FN "/tmp/sim_plant.state"
+
+// After the app exits, the wiper coasts this long before it is measured.
+#define SETTLE_NS 1000000000ULL
+
+static int verbose = 0;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static pid_t start_app(const char* cmd) {
+	pid_t pid = fork();
+	if(pid < 0){
+		perror("fork() failed");
+		exit(1);
+	}
+	if(pid == 0){
+		// Own group, so that kill() reaches what sh starts.
+		setpgid(0, 0);
+		if(!verbose){
+			int fd = open("/dev/null", O_WRONLY);
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+		execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+		perror("exec failed");
+		_exit(127);
+	}
+	setpgid(pid, pid);
+	return pid;
+}
+
+/**
+ * @return 1 if app exited within @a timeout_ms, else 0, and it is killed.
+ */
+static int wait_app(pid_t pid, int timeout_ms) {
+	uint64_t deadline_ns = now_ns() + timeout_ms*1000000ULL;
+	while(waitpid(pid, NULL, WNOHANG) == 0){
+		if(now_ns() >= deadline_ns){
+			kill(-pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+			return 0;
+		}
+		usleep(100);
+	}
+	return 1;
+}
+
+static int cmp_double(const void* a, const void* b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const double* sorted, int n, double p) {
+	if(n == 0){
+		return 0;
+	}
+	int i = (int)(p/100*n);
+	return sorted[i < n ? i : n - 1];
+}
+
+static void usage(FILE* f) {
+	plant_params_t d = PLANT__DEFAULT_PARAMS;
+	fprintf(f,
+"\nUsage: "\
+"\n	sim_plant [-s <shim.so>] [-n <runs>] [-R] [-t <ms>] [-w <deg/s>] [-c <ms>] [-v]"\
+"\n		<command>"\
+"\n	-s	plant_shim.so to preload (default %s)"\
+"\n	-n	runs, app restarted with the wiper at park (default %d)"\
+"\n	-R	real time, instead of the virtual clock"\
+"\n	-t	real time limit of a run, app is killed after (default %d ms)"\
+"\n	-w	motor speed (default %.0f deg/s)"\
+"\n	-c	spin-up and coast time constant (default %.0f ms)"\
+"\n	-v	show output of app"\
+"\n	command run by sh, e.g."\
+"\n		sim_plant ../../App/3_Limit_SW/build/wiper_limit_switch_node"\
+"\n"\
+"\nWiper: park switch (pin %d) at or below %.0f deg, limit switch (pin %d)"\
+"\nat or above %.0f deg, hard stops %.0f deg beyond those.\n",
+		DEFAULT_SHIM,
+		DEFAULT_RUNS,
+		DEFAULT_TIMEOUT_MS,
+		d.speed,
+		d.spin_up_s*1e3,
+		PLANT__PIN_PARK,
+		d.park,
+		PLANT__PIN_LIMIT,
+		d.limit,
+		d.hard_stop
+	);
+}
+
+int main(int argc, char** argv) {
+	const char* shim = DEFAULT_SHIM;
+	int runs = DEFAULT_RUNS;
+	int virtual_clock = 1;
+	int timeout_ms = DEFAULT_TIMEOUT_MS;
+	plant_params_t params = PLANT__DEFAULT_PARAMS;
+	int opt;
+	while((opt = getopt(argc, argv, "s:n:Rt:w:c:vh")) != -1){
+		switch(opt){
+			case 's':
+				shim = optarg;
+				break;
+			case 'n':
+				runs = atoi(optarg);
+				break;
+			case 'R':
+				virtual_clock = 0;
+				break;
+			case 't':
+				timeout_ms = atoi(optarg);
+				break;
+			case 'w':
+				params.speed = atof(optarg);
+				break;
+			case 'c':
+				params.spin_up_s = atof(optarg)/1e3;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'h':
+				usage(stdout);
+				return 0;
+			default:
+				usage(stderr);
+				return 1;
+		}
+	}
+	if(argc - optind != 1){
+		usage(stderr);
+		return 1;
+	}
+	if(runs <= 0 || timeout_ms <= 0 || params.speed <= 0 || params.spin_up_s <= 0){
+		fprintf(stderr, "ERROR: Invalid runs, time limit, speed or time constant!\n");
+		return 1;
+	}
+	const char* cmd = argv[optind];
+
+	char shim_path[PATH_MAX];
+	if(!realpath(shim, shim_path)){
+		fprintf(stderr, "ERROR: No shim \"%s\": %s\n", shim, strerror(errno));
+		return 1;
+	}
+
+	int fd = open(STATE_FN, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0 || ftruncate(fd, sizeof(plant_t)) != 0){
+		perror("Failed to create " STATE_FN);
+		return 1;
+	}
+	void* m = mmap(NULL, sizeof(plant_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED){
+		perror("Failed to map " STATE_FN);
+		return 1;
+	}
+	plant_t* p = m;
+	p->params = params;
+	p->virtual_clock = virtual_clock;
+	// Skipped sleeps add up across runs, the clock never goes back.
+	p->skipped_ns = 0;
+
+	setenv("LD_PRELOAD", shim_path, 1);
+	setenv(PLANT__ENV_STATE, STATE_FN, 1);
+
+	printf("App: %s\n", cmd);
+	printf(
+		"Plant: %.0f deg/s, time constant %.0f ms, limit at %.0f deg, %s clock\n",
+		params.speed,
+		params.spin_up_s*1e3,
+		params.limit,
+		virtual_clock ? "virtual" : "real"
+	);
+
+	static lat_hist_t stop;
+	lat_hist__reset(&stop);
+	double* overshoot = malloc(runs*sizeof(double));
+	if(!overshoot){
+		perror("malloc() failed");
+		return 1;
+	}
+	int num_of_overshoots = 0;
+	int no_trip = 0;
+	int no_stop = 0;
+	int timeouts = 0;
+	int hard_stops = 0;
+	uint64_t sim_ns = 0;
+	uint64_t begin_ns = now_ns();
+	for(int k = 0; k < runs; k++){
+		uint64_t t0_ns = now_ns() + p->skipped_ns;
+		plant__reset(p, t0_ns);
+		if(!wait_app(start_app(cmd), timeout_ms)){
+			timeouts++;
+		}
+		// Nothing drives it any more, let it come to rest.
+		uint64_t end_ns = now_ns() + p->skipped_ns;
+		if(end_ns < p->t_ns){
+			end_ns = p->t_ns;
+		}
+		plant__advance(p, end_ns + SETTLE_NS);
+		sim_ns += end_ns - t0_ns;
+
+		if(!p->trip_ns){
+			no_trip++;
+		}else if(!p->stop_ns){
+			no_stop++;
+		}else{
+			lat_hist__add(&stop, p->stop_ns - p->trip_ns);
+			overshoot[num_of_overshoots++] = p->peak - params.limit;
+		}
+		if(p->hard_stops){
+			hard_stops++;
+		}
+	}
+	double wall_s = (now_ns() - begin_ns)/1e9;
+	qsort(overshoot, num_of_overshoots, sizeof(double), cmp_double);
+
+	printf(
+		"%7s %7s %7s %7s %9s %9s %8s\n",
+		"runs", "no trip", "no stop", "timeout", "hard stop", "sim [s]", "speedup"
+	);
+	printf(
+		"%7d %7d %7d %7d %9d %9.1f %7.1fx\n",
+		runs, no_trip, no_stop, timeouts, hard_stops, sim_ns/1e9, sim_ns/1e9/wall_s
+	);
+	printf(
+		"%-16s %10s %10s %10s\n",
+		"", "p50", "p99", "max"
+	);
+	printf(
+		"%-16s %10.1f %10.1f %10.1f\n",
+		"stop [us]",
+		lat_hist__percentile(&stop, 50)/1e3,
+		lat_hist__percentile(&stop, 99)/1e3,
+		stop.count ? stop.max/1e3 : 0
+	);
+	printf(
+		"%-16s %10.2f %10.2f %10.2f\n",
+		"overshoot [deg]",
+		percentile(overshoot, num_of_overshoots, 50),
+		percentile(overshoot, num_of_overshoots, 99),
+		num_of_overshoots ? overshoot[num_of_overshoots - 1] : 0
+	);
+
+	free(overshoot);
+	munmap(p, sizeof(plant_t));
+	unlink(STATE_FN);
+
+	int failed = no_trip + no_stop + timeouts + hard_stops;
+	return failed == 0 ? 0 : 1;
+}
@@ -12,3 +12,6 @@ exit 0
 ./waf build && ./build/test_gpio u 22 # Read from pin 22 with pull-up on
 ./waf build && ./build/test_gpio u 22 # Read from pin 22 with pull-down on
 
+# Benchmark driver: toggle pin 2 and read pin 22 with pull-down, on one fd.
+./waf build && echo 'w 2 1; w 2 0; d 22' | ./build/test_gpio b 10000 -
+./waf build && echo 'w 2 1; w 2 0; d 22' | ./build/test_gpio b 10000 - csv > bench.csv
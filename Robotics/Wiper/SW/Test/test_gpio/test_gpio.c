@@ -5,11 +5,19 @@
 #include <fcntl.h> // open() flags
 #include <string.h> // strerror()
 #include <errno.h> // errno
+#include <stdlib.h> // atoi()
+#include <time.h> // clock_gettime()
+
+#include "../../Common/include/lat_hist.h"
 
 #define DEV_STREAM_FN "/dev/gpio_stream"
 
 #define DEBUG 0
 
+// Benchmark mode, see usage().
+#define MAX_SCRIPT_OPS 256
+#define MAX_SCRIPT_SIZE 16384
+
 void usage(FILE* f){
 	fprintf(f,
 "\nUsage: "\
@@ -19,6 +27,11 @@ void usage(FILE* f){
 "\n		set GPIO to output and write it 0 or 1"\
 "\n	test_gpio <gpio_no> r"\
 "\n		set GPIO to input and read value"\
+"\n	test_gpio b <iterations> <script> [csv]"\
+"\n		benchmark: run ops of script iterations times, on one open fd,"\
+"\n		print ops/s and p50/p99/max latency per op type, as CSV with csv"\
+"\n		script = file, or - for stdin, of ops separated by new line or ;"\
+"\n		e.g. echo 'w 2 1; w 2 0; d 22' | test_gpio b 10000 -"\
 "\n	gpio_no = [2, 26]"\
 "\n wr_val = 0 or 1"\
 "\n"\
@@ -98,7 +111,219 @@ int parse_args(
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Benchmark mode.
+
+typedef struct {
+	char op; // w, r, u or d.
+	uint8_t gpio_no;
+	uint8_t wr_val;
+} script_op_t;
+
+// Row per op type, in this order.
+static const char bench_op_types[] = "wrud";
+#define NUM_OF_OP_TYPES 4
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Parse ops from @a f, like "w 2 1" or "d 22", # starts a comment.
+ * @return number of ops, or -1 on error.
+ */
+static int parse_script(FILE* f, script_op_t* ops) {
+	static char buf[MAX_SCRIPT_SIZE];
+	size_t size = fread(buf, 1, sizeof(buf) - 1, f);
+	buf[size] = '\0';
+
+	int n = 0;
+	char* save;
+	for(char* s = strtok_r(buf, ";\n", &save); s; s = strtok_r(NULL, ";\n", &save)){
+		char* comment = strchr(s, '#');
+		if(comment){
+			*comment = '\0';
+		}
+		char op;
+		int gpio_no;
+		int wr_val;
+		int k = sscanf(s, " %c %d %d", &op, &gpio_no, &wr_val);
+		if(k <= 0){
+			continue; // Empty.
+		}
+		if(n == MAX_SCRIPT_OPS){
+			fprintf(stderr, "ERROR: More than %d ops!\n", MAX_SCRIPT_OPS);
+			return -1;
+		}
+		int ok;
+		if(op == 'w'){
+			ok = k == 3 && (wr_val == 0 || wr_val == 1);
+		}else{
+			ok = k == 2 && strchr("rud", op);
+			wr_val = 0;
+		}
+		if(!ok || gpio_no < 0 || gpio_no > 255){
+			fprintf(stderr, "ERROR: Wrong op \"%s\"!\n", s);
+			return -1;
+		}
+		ops[n].op = op;
+		ops[n].gpio_no = gpio_no;
+		ops[n].wr_val = wr_val;
+		n++;
+	}
+	return n;
+}
+
+/**
+ * @return 0 if Ok, else as main() would.
+ */
+static int run_op(int fd, const script_op_t* o) {
+	uint8_t pkg[3];
+	pkg[0] = o->op;
+	pkg[1] = o->gpio_no;
+	pkg[2] = o->wr_val;
+	size_t size = o->op == 'w' ? 3 : 2;
+	if(write(fd, pkg, size) != (ssize_t)size){
+		fprintf(stderr, "ERROR: write went wrong!\n");
+		return 4;
+	}
+	if(o->op != 'w'){
+		uint8_t rd_val;
+		if(read(fd, (char*)&rd_val, sizeof(rd_val)) != sizeof(rd_val)){
+			fprintf(stderr, "ERROR: read went wrong!\n");
+			return 5;
+		}
+	}
+	return 0;
+}
+
+static void print_bench_row(
+	const char* name,
+	const lat_hist_t* h,
+	double ops_per_s,
+	int csv
+) {
+	if(csv){
+		printf(
+			"%s,%llu,%.0f,%llu,%llu,%llu\n",
+			name,
+			(unsigned long long)h->count,
+			ops_per_s,
+			(unsigned long long)lat_hist__percentile(h, 50),
+			(unsigned long long)lat_hist__percentile(h, 99),
+			(unsigned long long)h->max
+		);
+	}else{
+		printf(
+			"%-4s %10llu %10.0f %10.2f %10.2f %10.2f\n",
+			name,
+			(unsigned long long)h->count,
+			ops_per_s,
+			lat_hist__percentile(h, 50)/1e3,
+			lat_hist__percentile(h, 99)/1e3,
+			h->max/1e3
+		);
+	}
+}
+
+/**
+ * Each op is timed from its write() until it is done, that is its read()
+ * returned for r, u and d.
+ */
+static int bench(int argc, char** argv) {
+	if(argc != 4 && !(argc == 5 && c_str_eq(argv[4], "csv"))){
+		fprintf(stderr, "ERROR: Wrong number of arguments!\n");
+		usage(stderr);
+		return 1;
+	}
+	int csv = argc == 5;
+	int iterations = atoi(argv[2]);
+	if(iterations <= 0){
+		fprintf(stderr, "ERROR: Invalid number \"%s\"!\n", argv[2]);
+		return 3;
+	}
+
+	static script_op_t ops[MAX_SCRIPT_OPS];
+	FILE* f = c_str_eq(argv[3], "-") ? stdin : fopen(argv[3], "r");
+	if(!f){
+		fprintf(stderr, "ERROR: \"%s\" not opened: %s\n", argv[3], strerror(errno));
+		return 3;
+	}
+	int num_of_ops = parse_script(f, ops);
+	if(f != stdin){
+		fclose(f);
+	}
+	if(num_of_ops < 0){
+		return 2;
+	}
+	if(num_of_ops == 0){
+		fprintf(stderr, "ERROR: No ops in script!\n");
+		return 2;
+	}
+
+	int fd = open(DEV_STREAM_FN, O_RDWR);
+	if(fd < 0){
+		fprintf(stderr, "ERROR: \"%s\" not opened!\n", DEV_STREAM_FN);
+		fprintf(stderr, "fd = %d %s\n", fd, strerror(errno));
+		return 4;
+	}
+
+	static lat_hist_t hists[NUM_OF_OP_TYPES];
+	static lat_hist_t all;
+	for(int t = 0; t < NUM_OF_OP_TYPES; t++){
+		lat_hist__reset(&hists[t]);
+	}
+	lat_hist__reset(&all);
+
+	int r = 0;
+	uint64_t begin_ns = now_ns();
+	for(int it = 0; it < iterations && r == 0; it++){
+		for(int i = 0; i < num_of_ops && r == 0; i++){
+			uint64_t t0_ns = now_ns();
+			r = run_op(fd, &ops[i]);
+			uint64_t lat_ns = now_ns() - t0_ns;
+			int t = strchr(bench_op_types, ops[i].op) - bench_op_types;
+			lat_hist__add(&hists[t], lat_ns);
+			lat_hist__add(&all, lat_ns);
+		}
+	}
+	uint64_t wall_ns = now_ns() - begin_ns;
+	close(fd);
+	if(r){
+		return r;
+	}
+
+	if(csv){
+		printf("op,count,ops_per_s,p50_ns,p99_ns,max_ns\n");
+	}else{
+		printf(
+			"%-4s %10s %10s %10s %10s %10s\n",
+			"op", "count", "ops/s", "p50 [us]", "p99 [us]", "max [us]"
+		);
+	}
+	for(int t = 0; t < NUM_OF_OP_TYPES; t++){
+		const lat_hist_t* h = &hists[t];
+		if(h->count){
+			// As if only ops of this type ran back to back.
+			char name[2] = { bench_op_types[t], '\0' };
+			print_bench_row(name, h, h->count*1e9/h->sum, csv);
+		}
+	}
+	// Overall rate includes timing and loop overhead.
+	print_bench_row("all", &all, all.count*1e9/wall_ns, csv);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 int main(int argc, char** argv){
+	if(argc >= 2 && c_str_eq(argv[1], "b")){
+		return bench(argc, argv);
+	}
+
 	int gpio_no;
 	char op;
 	int wr_val;
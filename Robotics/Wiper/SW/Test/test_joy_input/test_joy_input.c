@@ -0,0 +1,124 @@
+/*
+ * Feeds raw evdev frames through a pipe into joy_input__read(), checks
+ * batching at SYN_REPORT and recovery after SYN_DROPPED. A pipe cannot
+ * answer EVIOCGKEY, so a resync shows up as -1 with ENOTTY.
+ */
+
+#include <stdio.h> // printf and family
+#include <stdlib.h> // EXIT_SUCCESS
+
+#include "joy_input.h"
+
+static int failed = 0;
+
+#define CHECK(cond) \
+	do{ \
+		if(!(cond)){ \
+			fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failed++; \
+		} \
+	}while(0)
+
+static int pipe_fd[2];
+
+static void emit(uint16_t type, uint16_t code, int32_t value) {
+	struct input_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	if(write(pipe_fd[1], &ev, sizeof(ev)) != sizeof(ev)){
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void open_fake(joy_input_t* in) {
+	memset(in, 0, sizeof(*in));
+	in->fd = pipe_fd[0];
+	in->evdev = 1;
+	memset(in->key_to_button, -1, sizeof(in->key_to_button));
+	memset(in->abs_to_axis, -1, sizeof(in->abs_to_axis));
+	in->key_to_button[BTN_A] = 0;
+	in->button_to_key[0] = BTN_A;
+	in->key_to_button[BTN_B] = 1;
+	in->button_to_key[1] = BTN_B;
+	in->num_of_buttons = 2;
+}
+
+static void test_batches() {
+	joy_input_t in;
+	struct js_event evs[JOY_INPUT__MAX_EVENTS];
+	open_fake(&in);
+
+	// Held back until SYN_REPORT.
+	emit(EV_KEY, BTN_A, 1);
+	emit(EV_KEY, BTN_B, 1);
+	CHECK(joy_input__read(&in, evs) == 0);
+	emit(EV_SYN, SYN_REPORT, 0);
+	CHECK(joy_input__read(&in, evs) == 2);
+	CHECK(evs[0].type == JS_EVENT_BUTTON && evs[0].number == 0 && evs[0].value == 1);
+	CHECK(evs[1].type == JS_EVENT_BUTTON && evs[1].number == 1 && evs[1].value == 1);
+
+	// Autorepeat dropped, open frame stays staged.
+	emit(EV_KEY, BTN_A, 2);
+	emit(EV_KEY, BTN_A, 0);
+	emit(EV_SYN, SYN_REPORT, 0);
+	emit(EV_KEY, BTN_B, 0);
+	CHECK(joy_input__read(&in, evs) == 1);
+	CHECK(evs[0].number == 0 && evs[0].value == 0);
+	CHECK(in.num_of_staged == 1);
+	emit(EV_SYN, SYN_REPORT, 0);
+	CHECK(joy_input__read(&in, evs) == 1);
+	CHECK(evs[0].number == 1 && evs[0].value == 0);
+	CHECK(in.num_of_staged == 0);
+}
+
+static void test_dropped() {
+	joy_input_t in;
+	struct js_event evs[JOY_INPUT__MAX_EVENTS];
+	open_fake(&in);
+
+	// Committed frame, then overflow, all in one read().
+	emit(EV_KEY, BTN_A, 1);
+	emit(EV_KEY, BTN_B, 1);
+	emit(EV_SYN, SYN_REPORT, 0);
+	emit(EV_SYN, SYN_DROPPED, 0);
+	emit(EV_KEY, BTN_A, 0);
+	emit(EV_SYN, SYN_REPORT, 0);
+	errno = 0;
+	int n = joy_input__read(&in, evs);
+	CHECK(n == -1 && errno == ENOTTY);
+	CHECK(in.need_sync && !in.dropping);
+	CHECK(in.num_of_staged == 0);
+
+	// Overflow with the frame after it still open.
+	open_fake(&in);
+	emit(EV_KEY, BTN_A, 1);
+	emit(EV_SYN, SYN_REPORT, 0);
+	emit(EV_SYN, SYN_DROPPED, 0);
+	emit(EV_KEY, BTN_B, 1);
+	CHECK(joy_input__read(&in, evs) == 0);
+	CHECK(in.dropping && in.num_of_staged == 0);
+	emit(EV_SYN, SYN_REPORT, 0);
+	errno = 0;
+	n = joy_input__read(&in, evs);
+	CHECK(n == -1 && errno == ENOTTY);
+	CHECK(in.num_of_staged == 0);
+}
+
+int main() {
+	if(pipe(pipe_fd) != 0){
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+	fcntl(pipe_fd[0], F_SETFL, fcntl(pipe_fd[0], F_GETFL) | O_NONBLOCK);
+	test_batches();
+	test_dropped();
+	if(failed){
+		fprintf(stderr, "%d checks failed!\n", failed);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed.\n");
+	return EXIT_SUCCESS;
+}
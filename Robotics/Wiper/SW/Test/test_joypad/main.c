@@ -1,88 +1,292 @@
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <signal.h>
 #include <linux/joystick.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 #include <time.h>
 
+#include "../../Common/include/joy_input.h"
+#include "../../Common/include/lat_hist.h"
 
-struct timespec diff_timespec(const struct timespec *time1, const struct timespec *time0) {
-	struct timespec diff;
+// Event rate is counted in windows of this, its max is the burst rate.
+#define RATE_WINDOW_NS 100000000ULL
 
-	// Calculate the difference in seconds
-	diff.tv_sec = time1->tv_sec - time0->tv_sec;
+// Profile of one axis or button, or of all reads.
+typedef struct {
+	lat_hist_t delta; // Between successive events [ns].
+	uint64_t last_ns;
+	uint64_t count;
+} source_t;
 
-	// Calculate the difference in nanoseconds
-	diff.tv_nsec = time1->tv_nsec - time0->tv_nsec;
+// Filled in by the loop only, printed from it too, so nothing perturbs
+// the reads but clock_gettime() and a few adds per event.
+static source_t axes[JOY_INPUT__MAX_AXES];
+static source_t buttons[JOY_INPUT__MAX_BUTTONS];
+static source_t reads;
+static lat_hist_t batch_size;
+// Driver to read(): js_event.time is ms of jiffies, on another epoch than
+// CLOCK_MONOTONIC, so the lag is over the best one seen.
+static lat_hist_t lag;
+static int32_t lag_offset_ms;
+static int lag_synced = 0;
+static uint64_t start_ns;
+static uint64_t num_of_events = 0;
+static uint64_t window_start_ns;
+static uint64_t window_events = 0;
+static uint64_t max_window_events = 0;
 
-	// Handle cases where nanoseconds become negative due to borrowing from seconds
-	if (diff.tv_nsec < 0) {
-		diff.tv_sec--; // Decrement seconds
-		diff.tv_nsec += 1000000000; // Add one billion nanoseconds (1 second)
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void source_add(source_t* s, uint64_t t_ns) {
+	if (s->count) {
+		lat_hist__add(&s->delta, t_ns - s->last_ns);
+	}
+	s->last_ns = t_ns;
+	s->count++;
+}
+
+static void trace_lag(uint32_t js_time, uint64_t t_ns) {
+	int32_t offset_ms = (int32_t)((uint32_t)(t_ns/1000000) - js_time);
+	if (!lag_synced || offset_ms < lag_offset_ms) {
+		lag_offset_ms = offset_ms;
+		lag_synced = 1;
 	}
+	lat_hist__add(&lag, (uint64_t)(offset_ms - lag_offset_ms)*1000000);
+}
+
+static void count_rate(int n, uint64_t t_ns) {
+	if (t_ns - window_start_ns >= RATE_WINDOW_NS) {
+		window_start_ns = t_ns;
+		window_events = 0;
+	}
+	window_events += n;
+	if (window_events > max_window_events) {
+		max_window_events = window_events;
+	}
+}
 
-	return diff;
+static void print_row(const char* name, int i, const source_t* s, double duration_s) {
+	const lat_hist_t* h = &s->delta;
+	char label[16];
+	snprintf(label, sizeof(label), i < 0 ? "%s" : "%s %d", name, i);
+	printf(
+		"%-10s %8llu %9.1f %9.2f %9.2f %9.2f %9.2f %9.1f\n",
+		label,
+		(unsigned long long)s->count,
+		s->count/duration_s,
+		lat_hist__percentile(h, 50)/1e6,
+		lat_hist__percentile(h, 99)/1e6,
+		h->count ? h->max/1e6 : 0,
+		h->count ? h->min/1e6 : 0,
+		h->count && h->min ? 1e9/h->min : 0
+	);
 }
 
-int main() {
-	int js_fd;
-	struct js_event js_event_data;
+static void print_profile(const joy_input_t* in) {
+	double duration_s = (now_ns() - start_ns)/1e9;
+	printf(
+		"\nEvents %llu in %.1f s: %.1f/s avg, %.1f/s max in %llu ms windows\n",
+		(unsigned long long)num_of_events,
+		duration_s,
+		num_of_events/duration_s,
+		max_window_events*1e9/RATE_WINDOW_NS,
+		(unsigned long long)(RATE_WINDOW_NS/1000000)
+	);
+	printf(
+		"Events per read: p50 %llu, p99 %llu, max %llu\n",
+		(unsigned long long)lat_hist__percentile(&batch_size, 50),
+		(unsigned long long)lat_hist__percentile(&batch_size, 99),
+		(unsigned long long)(batch_size.count ? batch_size.max : 0)
+	);
+	printf(
+		"Driver to read, over best: p50 %.0f ms, p99 %.0f ms, max %.0f ms\n",
+		lat_hist__percentile(&lag, 50)/1e6,
+		lat_hist__percentile(&lag, 99)/1e6,
+		lag.count ? lag.max/1e6 : 0
+	);
+	printf(
+		"%-10s %8s %9s %9s %9s %9s %9s %9s\n",
+		"source", "events", "rate[1/s]", "p50[ms]", "p99[ms]", "max[ms]", "min[ms]", "peak[1/s]"
+	);
+	print_row("reads", -1, &reads, duration_s);
+	for (int i = 0; i < in->num_of_axes; i++) {
+		if (axes[i].count) {
+			print_row("axis", i, &axes[i], duration_s);
+		}
+	}
+	for (int i = 0; i < in->num_of_buttons; i++) {
+		if (buttons[i].count) {
+			print_row("button", i, &buttons[i], duration_s);
+		}
+	}
+	printf("Deltas between successive events of each, peak is 1/min.\n");
+	fflush(stdout);
+}
 
-	int num_of_axes = 0;
-	int num_of_buttons = 0;
+static void print_event(const struct js_event* e) {
+	if (e->type & JS_EVENT_INIT) {
+		printf("Initial state event (type: %d, number: %d, value: %d)\n",
+			   e->type, e->number, e->value);
+	} else if (e->type & JS_EVENT_BUTTON) {
+		printf("Button %d %s (value: %d)\n",
+			   e->number,
+			   (e->value == 0) ? "released" : "pressed",
+			   e->value);
+	} else if (e->type & JS_EVENT_AXIS) {
+		printf("Axis %d moved (value: %d)\n",
+			   e->number,
+			   e->value);
+	}
+}
 
-	struct timespec t_curr;
-	struct timespec t_prev;
+static void usage(FILE* f) {
+	fprintf(f,
+"\nUsage: "\
+"\n	main [-v] [<device>]"\
+"\n	device	jsX or evdev eventX (default /dev/input/js0)"\
+"\n	-v	also print every event, which perturbs the timing"\
+"\n"\
+"\nProfiles event timing in memory: deltas per axis and button, events"\
+"\nper read, driver to read lag, max event rate. Printed on SIGUSR1 and"\
+"\nat exit, on SIGINT/SIGTERM.\n"
+	);
+}
+
+int main(int argc, char** argv) {
+	int verbose = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "vh")) != -1) {
+		switch (opt) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'h':
+				usage(stdout);
+				return 0;
+			default:
+				usage(stderr);
+				return 1;
+		}
+	}
+	const char* js_path = optind < argc ? argv[optind] : "/dev/input/js0";
+	static joy_input_t in;
+	static struct js_event evs[JOY_INPUT__MAX_EVENTS];
 
-	// Open the joystick device file in read-only mode
-	js_fd = open("/dev/input/js0", O_RDONLY);
-	if (js_fd == -1) {
+	// Open the joystick device file, jsX or evdev eventX, non-blocking
+	if (joy_input__open(&in, js_path) != 0) {
 		perror("Error opening joystick device");
 		return 1;
 	}
 
-	ioctl(js_fd, JSIOCGAXES, &num_of_axes);
-	ioctl(js_fd, JSIOCGBUTTONS, &num_of_buttons);
-
-	printf("Number of axes: %d\n", num_of_axes);
-	printf("Number of buttons: %d\n", num_of_buttons);
-	
-	clock_gettime(CLOCK_MONOTONIC, &t_prev);
-
-	// Continuously read joystick events
-	while (1) {
-		if (read(js_fd, &js_event_data, sizeof(struct js_event)) == sizeof(struct js_event)) {
-			clock_gettime(CLOCK_MONOTONIC, &t_curr);
-
-			struct timespec T_delta = diff_timespec(&t_curr, &t_prev);
-			double delta = T_delta.tv_sec + T_delta.tv_nsec*1e-9;
-			double rate = 1.0/delta;
-			printf("delta = %lf ms, rate = %lfHz\n", delta*1e3, rate);
-			t_prev = t_curr;
-
-
-			// Process the event based on its type
-			if (js_event_data.type & JS_EVENT_BUTTON) {
-				printf("Button %d %s (value: %d)\n",
-					   js_event_data.number,
-					   (js_event_data.value == 0) ? "released" : "pressed",
-					   js_event_data.value);
-			} else if (js_event_data.type & JS_EVENT_AXIS) {
-				printf("Axis %d moved (value: %d)\n",
-					   js_event_data.number,
-					   js_event_data.value);
-			} else if (js_event_data.type & JS_EVENT_INIT) {
-				printf("Initial state event (type: %d, number: %d, value: %d)\n",
-					   js_event_data.type, js_event_data.number, js_event_data.value);
+	printf("Number of axes: %d\n", in.num_of_axes);
+	printf("Number of buttons: %d\n", in.num_of_buttons);
+	if (in.evdev) {
+		printf("evdev device, one batch per SYN_REPORT\n");
+	}
+
+	// Taken in the loop, so the profile is only read by the thread that
+	// writes it.
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &sigs, NULL);
+	int sig_fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	int ep_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = in.fd };
+	struct epoll_event sig_ev = { .events = EPOLLIN, .data.fd = sig_fd };
+	if (
+		sig_fd < 0 || ep_fd < 0 ||
+		epoll_ctl(ep_fd, EPOLL_CTL_ADD, in.fd, &ev) != 0 ||
+		epoll_ctl(ep_fd, EPOLL_CTL_ADD, sig_fd, &sig_ev) != 0
+	) {
+		perror("Error polling joystick device");
+		joy_input__close(&in);
+		return 1;
+	}
+
+	for (int i = 0; i < JOY_INPUT__MAX_AXES; i++) {
+		lat_hist__reset(&axes[i].delta);
+	}
+	for (int i = 0; i < JOY_INPUT__MAX_BUTTONS; i++) {
+		lat_hist__reset(&buttons[i].delta);
+	}
+	lat_hist__reset(&reads.delta);
+	lat_hist__reset(&batch_size);
+	lat_hist__reset(&lag);
+	start_ns = now_ns();
+	window_start_ns = start_ns;
+
+	// Continuously read joystick events, whatever is queued at once
+	int running = 1;
+	while (running) {
+		if (epoll_wait(ep_fd, &ev, 1, -1) < 0) {
+			perror("Error polling joystick device");
+			break;
+		}
+		if (ev.data.fd == sig_fd) {
+			struct signalfd_siginfo si;
+			if (read(sig_fd, &si, sizeof(si)) != sizeof(si)) {
+				continue;
+			}
+			if (si.ssi_signo != SIGUSR1) {
+				running = 0;
+			}
+			print_profile(&in);
+			continue;
+		}
+
+		int n;
+		while ((n = joy_input__read(&in, evs)) > 0) {
+			uint64_t t_ns = now_ns();
+			source_add(&reads, t_ns);
+			lat_hist__add(&batch_size, n);
+
+			int m = 0;
+			for (int i = 0; i < n; i++) {
+				const struct js_event* e = &evs[i];
+				// State at open is not an event of the device.
+				if (e->type & JS_EVENT_INIT) {
+					continue;
+				}
+				m++;
+				trace_lag(e->time, t_ns);
+				if ((e->type & JS_EVENT_BUTTON) && e->number < JOY_INPUT__MAX_BUTTONS) {
+					source_add(&buttons[e->number], t_ns);
+				} else if ((e->type & JS_EVENT_AXIS) && e->number < JOY_INPUT__MAX_AXES) {
+					source_add(&axes[e->number], t_ns);
+				}
+			}
+			count_rate(m, t_ns);
+			num_of_events += m;
+			if (verbose) {
+				for (int i = 0; i < n; i++) {
+					print_event(&evs[i]);
+				}
 			}
-		} else {
+		}
+		if (n < 0) {
 			perror("Error reading joystick event");
+			print_profile(&in);
 			break;
 		}
 	}
 
 	// Close the device file
-	close(js_fd);
+	close(ep_fd);
+	close(sig_fd);
+	joy_input__close(&in);
 	return 0;
-}
\ No newline at end of file
+}
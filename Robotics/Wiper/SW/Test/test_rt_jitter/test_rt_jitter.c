@@ -0,0 +1,180 @@
+
+/*
+ * cyclictest-style jitter measurement of a wiper control loop: wake up on
+ * absolute deadlines of the loop period, do the loop's GPIO I/O, and
+ * record how late each wakeup was. Run it with and without -R on a loaded
+ * Pi to see what the real-time profile buys.
+ */
+
+#define _GNU_SOURCE // rt_profile.h
+
+#include <stdint.h> // uint16_t and family
+#include <stdio.h> // printf and family
+#include <stdlib.h> // atoi()
+#include <unistd.h> // getopt()
+#include <fcntl.h> // open() flags
+#include <signal.h>
+#include <time.h> // clock_nanosleep()
+
+#include "gpio_ctrl.h"
+#include "rt_profile.h"
+#include "lat_hist.h"
+
+#define DEFAULT_INTERVAL_US 10000 // Same as the control loops.
+#define DEFAULT_DURATION 10 // [s]
+#define LIMIT_SW_PIN 22
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig) {
+	(void)sig;
+	running = 0;
+}
+
+static uint64_t ts_to_ns(const struct timespec* ts) {
+	return (uint64_t)ts->tv_sec*1000000000ULL + ts->tv_nsec;
+}
+
+static void usage(FILE* f) {
+	fprintf(f,
+"\nUsage: "\
+"\n	test_rt_jitter [-R] [-p <prio>[@<cpu>]] [-i <us>] [-d <s>] [-g] [-H]"\
+"\n	-R	real-time profile: SCHED_FIFO, mlockall and prefault"\
+"\n	-p	loop priority and CPU (default %d, any CPU)"\
+"\n	-i	loop period in us (default %d)"\
+"\n	-d	duration in s (default %d)"\
+"\n	-g	read limit switch from %s every period, like the loop does"\
+"\n	-H	print histogram, 1 line per non-empty bucket"\
+"\n",
+		RT_PROFILE__ACTUATOR_PRIO,
+		DEFAULT_INTERVAL_US,
+		DEFAULT_DURATION,
+		DEV_STREAM_FN
+	);
+}
+
+int main(int argc, char** argv) {
+	int rt = 0;
+	rt_profile__thread_t loop_thread = { RT_PROFILE__ACTUATOR_PRIO, -1 };
+	int interval_us = DEFAULT_INTERVAL_US;
+	int duration = DEFAULT_DURATION;
+	int use_gpio = 0;
+	int print_hist = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "Rp:i:d:gHh")) != -1){
+		switch(opt){
+			case 'R':
+				rt = 1;
+				break;
+			case 'p':
+				if(rt_profile__parse_thread(optarg, &loop_thread)){
+					fprintf(stderr, "ERROR: Invalid priority \"%s\"!\n", optarg);
+					return 1;
+				}
+				break;
+			case 'i':
+				interval_us = atoi(optarg);
+				break;
+			case 'd':
+				duration = atoi(optarg);
+				break;
+			case 'g':
+				use_gpio = 1;
+				break;
+			case 'H':
+				print_hist = 1;
+				break;
+			case 'h':
+				usage(stdout);
+				return 0;
+			default:
+				usage(stderr);
+				return 1;
+		}
+	}
+	if(interval_us <= 0 || duration <= 0){
+		fprintf(stderr, "ERROR: Interval and duration must be positive!\n");
+		return 1;
+	}
+
+	int gpio_fd = -1;
+	if(use_gpio){
+		gpio_fd = open(DEV_STREAM_FN, O_RDWR);
+		if(gpio_fd < 0){
+			perror("ERROR: open() " DEV_STREAM_FN);
+			return 4;
+		}
+	}
+
+	static lat_hist_t hist;
+	lat_hist__reset(&hist);
+
+	if(rt){
+		if(rt_profile__lock_memory()){
+			perror("WARNING: mlockall()");
+		}
+		int r = rt_profile__set_thread(pthread_self(), &loop_thread);
+		if(r){
+			fprintf(stderr, "WARNING: SCHED_FIFO: %s\n", strerror(r));
+		}
+	}
+	rt_profile__log(stdout);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	uint64_t period_ns = interval_us*1000ULL;
+	long loops = (long)duration*1000000L/interval_us;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t next_ns = ts_to_ns(&now);
+	uint64_t overruns = 0;
+	for(long i = 0; i < loops && running; i++){
+		next_ns += period_ns;
+		struct timespec next = {
+			.tv_sec = next_ns/1000000000ULL,
+			.tv_nsec = next_ns%1000000000ULL
+		};
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		uint64_t late_ns = ts_to_ns(&now) - next_ns;
+		lat_hist__add(&hist, late_ns);
+		if(late_ns >= period_ns){
+			overruns++;
+		}
+
+		if(gpio_fd >= 0){
+			uint8_t pkg[2] = { GPIO_CTRL__READ, LIMIT_SW_PIN };
+			uint8_t rd_val;
+			if(
+				write(gpio_fd, pkg, sizeof(pkg)) != sizeof(pkg) ||
+				read(gpio_fd, &rd_val, sizeof(rd_val)) != sizeof(rd_val)
+			){
+				fprintf(stderr, "ERROR: GPIO I/O went wrong!\n");
+				return 5;
+			}
+		}
+	}
+
+	printf("period %d us, %llu wakeups, %llu missed deadlines\n",
+		interval_us,
+		(unsigned long long)hist.count,
+		(unsigned long long)overruns
+	);
+	lat_hist__print(stdout, "wakeup latency", &hist, 1000, "us");
+	if(print_hist){
+		for(int b = 0; b < LAT_HIST__BUCKETS; b++){
+			if(hist.buckets[b]){
+				printf("%10.1f %llu\n",
+					lat_hist__bucket_low(b)/1e3,
+					(unsigned long long)hist.buckets[b]
+				);
+			}
+		}
+	}
+
+	if(gpio_fd >= 0){
+		close(gpio_fd);
+	}
+	return 0;
+}
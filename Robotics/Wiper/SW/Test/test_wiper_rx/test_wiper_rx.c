@@ -0,0 +1,177 @@
+
+/*
+ * Replays a synthetic joystick stream through wiper_rx__recv(), the receive
+ * path of wiper_node, and counts heap allocations done by the receiving
+ * thread. Messages are sent in batches with counting off, then received
+ * with counting on, so only the receive side is measured.
+ */
+
+#include <stdint.h> // uint16_t and family
+#include <stdio.h> // printf and family
+#include <stdlib.h> // atol()
+#include <time.h> // clock_gettime()
+
+#include <zmq.h>
+
+#include "wiper_rx.h"
+
+#define DEFAULT_N_MSGS 1000000
+#define DEFAULT_ENDPOINT "inproc://test_wiper_rx"
+#define BATCH 1000
+// A batch not received within this is lost, the test fails.
+#define RECV_TIMEOUT_NS 5000000000ULL
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocation counting, by interposing glibc allocator.
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static __thread int counting;
+static uint64_t n_allocs;
+
+void* malloc(size_t size) {
+	if(counting){
+		n_allocs++;
+	}
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+	if(counting){
+		n_allocs++;
+	}
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+	if(counting){
+		n_allocs++;
+	}
+	return __libc_realloc(ptr, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static wiper_rx_t rx;
+
+int main(int argc, char** argv) {
+	long n_msgs = argc > 1 ? atol(argv[1]) : DEFAULT_N_MSGS;
+	const char* endpoint = argc > 2 ? argv[2] : DEFAULT_ENDPOINT;
+	if(n_msgs < 2*BATCH){
+		fprintf(stderr, "ERROR: Need at least %d messages!\n", 2*BATCH);
+		return 1;
+	}
+
+	void* ctx = zmq_ctx_new();
+	void* pub = zmq_socket(ctx, ZMQ_PUB);
+	void* sub = zmq_socket(ctx, ZMQ_SUB);
+	// No limit, PUB drops what is over the high water mark, and a lost
+	// message would leave a batch short.
+	int hwm = 0;
+	zmq_setsockopt(pub, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+	zmq_setsockopt(sub, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+	joy_frame_t frame;
+	joy_msg__topic(frame.topic, JOY_MSG__TOPIC_ALL, "");
+	zmq_setsockopt(sub, ZMQ_SUBSCRIBE, frame.topic, JOY_MSG__TOPIC_SIZE);
+	if(zmq_bind(pub, endpoint) != 0 || zmq_connect(sub, endpoint) != 0){
+		fprintf(stderr, "ERROR: %s\n", zmq_strerror(zmq_errno()));
+		return 2;
+	}
+
+	// Wait for subscription to reach the publisher.
+	joy_msg_t msg;
+	joy_msg__init(&msg, 12, 6);
+	uint8_t probe[WIPER_RX__SLOT_SIZE];
+	while(1){
+		zmq_send(pub, frame.topic, JOY_MSG__TOPIC_SIZE, 0);
+		zmq_pollitem_t item = { sub, 0, ZMQ_POLLIN, 0 };
+		if(zmq_poll(&item, 1, 10) > 0){
+			zmq_recv(sub, probe, sizeof(probe), 0);
+			break;
+		}
+	}
+	while(zmq_recv(sub, probe, sizeof(probe), ZMQ_DONTWAIT) >= 0){
+	}
+
+	uint64_t warmup_allocs = 0;
+	uint64_t rx_ns = 0;
+	uint32_t seq = 0;
+	long received = 0;
+	for(long sent = 0; sent < n_msgs; ){
+		long batch = n_msgs - sent < BATCH ? n_msgs - sent : BATCH;
+		for(long i = 0; i < batch; i++){
+			msg.seq = seq++;
+			msg.buttons = seq >> 3 & 0x7; // Cycle CCW/CW/STOP.
+			msg.axes[0] = (int16_t)seq;
+			msg.pub_time_ns = joy_msg__now_ns();
+			frame.msg = msg;
+			zmq_send(pub, &frame, sizeof(frame), 0);
+		}
+		sent += batch;
+
+		uint64_t t0 = now_ns();
+		counting = 1;
+		for(long got = 0; got < batch; ){
+			if(now_ns() - t0 > RECV_TIMEOUT_NS){
+				counting = 0;
+				printf(
+					"FAIL: %ld of %ld messages of a batch received, sent %ld\n",
+					got,
+					batch,
+					sent
+				);
+				return 6;
+			}
+			int r = wiper_rx__recv(&rx, sub);
+			if(r < 0){
+				counting = 0;
+				perror("ERROR: wiper_rx__recv()");
+				return 3;
+			}
+			if(r > 0){
+				got++;
+			}
+		}
+		counting = 0;
+		rx_ns += now_ns() - t0;
+		received += batch;
+
+		// First batch warms up ZeroMQ pipes, it is not the steady state.
+		if(sent == batch){
+			warmup_allocs = n_allocs;
+			n_allocs = 0;
+		}
+	}
+
+	const joy_msg_t* state = wiper_rx__state(&rx);
+	printf("messages:         %ld\n", received);
+	printf("last seq:         %u\n", state ? state->seq : 0);
+	printf("lost:             %llu\n", (unsigned long long)rx.seq_stats.lost);
+	printf("invalid:          %llu\n", (unsigned long long)rx.invalid);
+	printf("warm-up allocs:   %llu\n", (unsigned long long)warmup_allocs);
+	printf("steady allocs:    %llu\n", (unsigned long long)n_allocs);
+	printf("receive time:     %.1f ns/msg\n", (double)rx_ns/received);
+
+	zmq_close(sub);
+	zmq_close(pub);
+	zmq_ctx_destroy(ctx);
+
+	if(rx.seq_stats.lost || rx.invalid || rx.seq_stats.received != (uint64_t)received){
+		printf("FAIL: stream not received intact\n");
+		return 4;
+	}
+	if(n_allocs){
+		printf("FAIL: receive path allocates in steady state\n");
+		return 5;
+	}
+	printf("PASS\n");
+	return 0;
+}